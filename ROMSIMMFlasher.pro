@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui widgets
+QT       += core gui widgets concurrent
 
 TARGET = SIMMProgrammer
 TEMPLATE = app
@@ -12,26 +12,72 @@ QMAKE_TARGET_BUNDLE_PREFIX = com.downtowndougbrown
 
 SOURCES += main.cpp\
     3rdparty/fc8-compression.c \
+    bufferpool.cpp \
     chipid.cpp \
+    combinedromdevice.cpp \
+    compressedimagecache.cpp \
+    compressedimagestream.cpp \
     createblankdiskdialog.cpp \
     droppablegroupbox.cpp \
+    filecontentcache.cpp \
+    fc8backgroundcompressor.cpp \
+    fc8benchmark.cpp \
+    fc8blockcache.cpp \
     fc8compressor.cpp \
+    fc8decoder.cpp \
+    fc8fastencoder.cpp \
+    fc8sizeestimator.cpp \
+    fc8streamcompressor.cpp \
+    hfsscrubber.cpp \
+    jobprogress.cpp \
+    linkbenchmark.cpp \
     labelwithlinks.cpp \
     mainwindow.cpp \
     programmer.cpp \
+    protocoltrace.cpp \
+    rombuilder.cpp \
+    romchecksum.cpp \
+    romsignatures.cpp \
+    simminterleaver.cpp \
+    simulatedprogrammer.cpp \
     aboutbox.cpp \
-    textbrowserwithlinks.cpp
+    textbrowserwithlinks.cpp \
+    writesource.cpp
 
 HEADERS  += mainwindow.h \
     3rdparty/fc8-compression/fc8.h \
+    bufferpool.h \
     chipid.h \
+    combinedromdevice.h \
+    compressedimagecache.h \
+    compressedimagestream.h \
     createblankdiskdialog.h \
     droppablegroupbox.h \
+    filecontentcache.h \
+    fc8backgroundcompressor.h \
+    fc8benchmark.h \
+    fc8blockcache.h \
     fc8compressor.h \
+    fc8decoder.h \
+    fc8fastencoder.h \
+    fc8format.h \
+    fc8sizeestimator.h \
+    fc8streamcompressor.h \
+    hfsscrubber.h \
+    jobprogress.h \
+    linkbenchmark.h \
     labelwithlinks.h \
     programmer.h \
+    programmerprotocol.h \
+    protocoltrace.h \
+    rombuilder.h \
+    romchecksum.h \
+    romsignatures.h \
+    simminterleaver.h \
+    simulatedprogrammer.h \
     aboutbox.h \
-    textbrowserwithlinks.h
+    textbrowserwithlinks.h \
+    writesource.h
 
 FORMS    += mainwindow.ui \
     aboutbox.ui \
@@ -68,7 +114,18 @@ win32:QMAKE_TARGET_COPYRIGHT = "Copyright (C) Doug Brown"
 win32:QMAKE_TARGET_PRODUCT = "Mac ROM SIMM Programmer"
 
 DISTFILES += \
-    chipid.txt
+    chipid.txt \
+    chipidgen.py
 
-RESOURCES += \
-    chipid.qrc
+# The chip list gets compiled in as tables instead of being parsed at startup
+isEmpty(PYTHON) {
+    win32:PYTHON = python
+    else:PYTHON = python3
+}
+CHIPID_DATABASE = chipid.txt
+chipidgen.input = CHIPID_DATABASE
+chipidgen.output = ${QMAKE_FILE_BASE}_table.cpp
+chipidgen.commands = $$PYTHON $$PWD/chipidgen.py ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+chipidgen.depends = $$PWD/chipidgen.py
+chipidgen.variable_out = SOURCES
+QMAKE_EXTRA_COMPILERS += chipidgen
@@ -0,0 +1,90 @@
+#include "bufferpool.h"
+
+BufferPool::BufferPool(int maxIdleBuffers) :
+    maxIdle(maxIdleBuffers)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    qDeleteAll(idle);
+}
+
+BufferPool &BufferPool::shared()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+QByteArray *BufferPool::lease(int capacity)
+{
+    QByteArray *buffer = NULL;
+    {
+        QMutexLocker locker(&mutex);
+
+        // The smallest one that's big enough, or failing that, the biggest one
+        int best = -1;
+        for (int i = 0; i < idle.count(); i++)
+        {
+            const int c = idle[i]->capacity();
+            if (best < 0 ||
+                (c >= capacity && (idle[best]->capacity() < capacity || c < idle[best]->capacity())) ||
+                (c < capacity && idle[best]->capacity() < capacity && c > idle[best]->capacity()))
+            {
+                best = i;
+            }
+        }
+        if (best >= 0)
+        {
+            buffer = idle.takeAt(best);
+        }
+    }
+
+    if (!buffer)
+    {
+        buffer = new QByteArray();
+    }
+
+    // reserve() is what makes truncate() hang on to the memory (clear() never does)
+    if (buffer->capacity() < capacity)
+    {
+        buffer->reserve(capacity);
+    }
+    buffer->truncate(0);
+    return buffer;
+}
+
+void BufferPool::release(QByteArray *buffer)
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    buffer->truncate(0);
+
+    QMutexLocker locker(&mutex);
+    if (idle.count() < maxIdle)
+    {
+        idle.append(buffer);
+        buffer = NULL;
+    }
+    locker.unlock();
+
+    delete buffer;
+}
+
+PooledBuffer::PooledBuffer(int capacity, QObject *parent) :
+    QBuffer(parent),
+    array(BufferPool::shared().lease(capacity))
+{
+    setBuffer(array);
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    close();
+    // QBuffer would otherwise still be pointing at it
+    setBuffer(NULL);
+    BufferPool::shared().release(array);
+}
@@ -0,0 +1,50 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+
+// Keeps SIMM-sized byte arrays around between jobs, so reading, verifying, and
+// splitting up a SIMM don't each allocate (and fault in) several megabytes every
+// time. Lease one, use it, and give it back; it comes back out with its room still
+// reserved, so filling it up again doesn't allocate anything.
+//
+// Don't hand out copies of a leased array that outlive the lease. Writing to it
+// while a copy is around would make it allocate a new one after all.
+class BufferPool
+{
+public:
+    explicit BufferPool(int maxIdleBuffers = 4);
+    ~BufferPool();
+
+    // The one everything shares
+    static BufferPool &shared();
+
+    // An empty array with room for at least capacity bytes
+    QByteArray *lease(int capacity);
+    // Takes it back (NULL is fine)
+    void release(QByteArray *buffer);
+
+private:
+    QMutex mutex;
+    QList<QByteArray *> idle;
+    int maxIdle;
+};
+
+// A QBuffer whose array is leased from the shared pool, and goes back to it when
+// the QBuffer is deleted
+class PooledBuffer : public QBuffer
+{
+    Q_OBJECT
+
+public:
+    explicit PooledBuffer(int capacity, QObject *parent = NULL);
+    ~PooledBuffer();
+
+private:
+    QByteArray *array;
+};
+
+#endif // BUFFERPOOL_H
@@ -1,6 +1,7 @@
 #include "chipid.h"
 #include <QFile>
 #include <QRegExp>
+#include <QStandardPaths>
 #include <QStringList>
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
@@ -9,9 +10,10 @@
 #define MySkipEmptyParts QString::SkipEmptyParts
 #endif
 
-ChipID::ChipID(QString filePath, QObject *parent) : QObject(parent)
+ChipID::ChipID(QString overrideFilePath, QObject *parent) : QObject(parent)
 {
-    QFile f(filePath);
+    // Most of the time there isn't one, and the built-in list is all there is
+    QFile f(overrideFilePath.isEmpty() ? defaultOverrideFilePath() : overrideFilePath);
     if (f.open(QFile::ReadOnly))
     {
         loadChips(f);
@@ -27,6 +29,62 @@ ChipID::ChipID(QString filePath, QObject *parent) : QObject(parent)
     dummyChipInfo.unlockShifted = false;
 }
 
+QString ChipID::defaultOverrideFilePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/chipid.txt";
+}
+
+uint32_t ChipID::indexHash(uint16_t manufacturerID, uint16_t productID, uint8_t width, bool shifted)
+{
+    // This has to match index_hash() in chipidgen.py
+    const uint32_t key = (static_cast<uint32_t>(manufacturerID) << 16) | productID;
+    const uint32_t salt = static_cast<uint32_t>((width << 1) | (shifted ? 1 : 0)) * 0x9E3779B9U;
+    return ((key ^ salt) * 2654435761U) >> (32 - chipIndexBits);
+}
+
+bool ChipID::lookup(uint16_t manufacturerID, uint16_t productID, uint8_t width, bool shifted, ChipInfo &info) const
+{
+    // Anything from the override file comes first. There's never more than a
+    // handful of them.
+    foreach (ChipInfo const &ci, overrideChips)
+    {
+        if (ci.width == width && ci.unlockShifted == shifted &&
+            ci.manufacturerID == manufacturerID && ci.productID == productID)
+        {
+            info = ci;
+            return true;
+        }
+    }
+
+    const uint32_t mask = (1U << chipIndexBits) - 1;
+    for (uint32_t slot = indexHash(manufacturerID, productID, width, shifted); chipIndex[slot] >= 0; slot = (slot + 1) & mask)
+    {
+        ChipRecord const &record = chipTable[chipIndex[slot]];
+        if (record.width != width || record.unlockShifted != shifted ||
+            record.manufacturerID != manufacturerID || record.productID != productID)
+        {
+            continue;
+        }
+
+        info.manufacturer = QString::fromLatin1(record.manufacturer);
+        info.manufacturerID = record.manufacturerID;
+        info.product = QString::fromLatin1(record.product);
+        info.productID = record.productID;
+        info.width = record.width;
+        info.capacity = record.capacity;
+        info.unlockShifted = record.unlockShifted;
+        info.sectors.clear();
+        for (int i = 0; i < record.sectorGroupCount; i++)
+        {
+            SectorGroup const &group = sectorGroupTable[record.firstSectorGroup + i];
+            info.sectors << qMakePair(group.count, group.size);
+        }
+        return true;
+    }
+
+    return false;
+}
+
 bool ChipID::findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devicesStraight, QList<uint8_t> manufacturersShifted, QList<uint8_t> devicesShifted, QList<ChipInfo> &info)
 {
     // Make sure we have a sane amount of info
@@ -47,8 +105,10 @@ bool ChipID::findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devi
         QList<uint8_t> const &manufacturers = devicesAndManufacturers[shiftType].first;
         QList<uint8_t> const &devices = devicesAndManufacturers[shiftType].second;
 
-        ChipInfo const *chipInfo16Bit[2];
-        ChipInfo const *chipInfo8Bit[4];
+        ChipInfo chipInfo16Bit[2];
+        ChipInfo chipInfo8Bit[4];
+        bool found16Bit[2];
+        bool found8Bit[4];
         uint16_t manufacturers16Bit[2];
         uint16_t devices16Bit[2];
 
@@ -58,48 +118,13 @@ bool ChipID::findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devi
         {
             manufacturers16Bit[i] = manufacturers[2*i] | manufacturers[2*i + 1] << 8;
             devices16Bit[i] = devices[2*i] | devices[2*i + 1] << 8;
-            chipInfo16Bit[i] = NULL;
-        }
-
-        foreach (ChipInfo const &ci, allChips)
-        {
-            // Only look for 16-bit chips that match the shift type we're currently looking at
-            if (ci.width != 16 || ci.unlockShifted != shifted) { continue; }
-
-            for (int i = 0; i < 2; i++)
-            {
-                // If we already found a match for this chip, skip it
-                if (chipInfo16Bit[i]) { continue; }
-
-                if (ci.manufacturerID == manufacturers16Bit[i] &&
-                    ci.productID == devices16Bit[i])
-                {
-                    chipInfo16Bit[i] = &ci;
-                }
-            }
+            found16Bit[i] = lookup(manufacturers16Bit[i], devices16Bit[i], 16, shifted, chipInfo16Bit[i]);
         }
 
         // Now let's try a 4-chip SIMM
         for (int i = 0; i < 4; i++)
         {
-            chipInfo8Bit[i] = NULL;
-        }
-
-        foreach (ChipInfo const &ci, allChips)
-        {
-            if (ci.width != 8 || ci.unlockShifted != shifted) { continue; }
-
-            for (int i = 0; i < 4; i++)
-            {
-                // If we already found a match for this chip, skip it
-                if (chipInfo8Bit[i]) { continue; }
-
-                if (ci.manufacturerID == manufacturers[i] &&
-                    ci.productID == devices[i])
-                {
-                    chipInfo8Bit[i] = &ci;
-                }
-            }
+            found8Bit[i] = lookup(manufacturers[i], devices[i], 8, shifted, chipInfo8Bit[i]);
         }
 
         // How many of each type were a match?
@@ -108,11 +133,11 @@ bool ChipID::findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devi
         int matches16Bit = 0;
         for (int i = 0; i < 2; i++)
         {
-            if (chipInfo16Bit[i]) { matches16Bit++; }
+            if (found16Bit[i]) { matches16Bit++; }
         }
         for (int i = 0; i < 4; i++)
         {
-            if (chipInfo8Bit[i]) { matches8Bit++; }
+            if (found8Bit[i]) { matches8Bit++; }
         }
 
         if (matches16Bit > 0)
@@ -120,9 +145,9 @@ bool ChipID::findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devi
             // It's a 2-chip SIMM.
             for (int i = 0; i < 2; i++)
             {
-                if (chipInfo16Bit[i])
+                if (found16Bit[i])
                 {
-                    info << *chipInfo16Bit[i];
+                    info << chipInfo16Bit[i];
                 }
                 else
                 {
@@ -141,9 +166,9 @@ bool ChipID::findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devi
             // It's a 4-chip SIMM.
             for (int i = 0; i < 4; i++)
             {
-                if (chipInfo8Bit[i])
+                if (found8Bit[i])
                 {
-                    info << *chipInfo8Bit[i];
+                    info << chipInfo8Bit[i];
                 }
                 else
                 {
@@ -163,6 +188,8 @@ bool ChipID::findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devi
     return false;
 }
 
+// The override file is in the same format as chipid.txt, so it's parsed the same
+// way chipidgen.py does it
 void ChipID::loadChips(QIODevice &file)
 {
     QRegExp whitespace("\\s+");
@@ -235,7 +262,7 @@ void ChipID::loadChips(QIODevice &file)
         info.manufacturerID = components[5].toUInt(NULL, 16);
         info.productID = components[6].toUInt(NULL, 16);
         info.unlockShifted = components[7].toUpper() == "YES";
-        allChips.append(info);
+        overrideChips.append(info);
     }
 }
 
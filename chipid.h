@@ -6,6 +6,12 @@
 #include <QPair>
 #include <stdint.h>
 
+// Knows which flash chips go with which manufacturer and device IDs. The list
+// comes from chipid.txt, which chipidgen.py turns into static tables at build
+// time (chipid_table.cpp), so there's nothing to parse at startup and looking a
+// chip up is a hash lookup. A chipid.txt in the app's data directory is still
+// read at startup, and anything in it takes priority over the built-in list, so
+// new chips can be tried out without rebuilding.
 class ChipID : public QObject
 {
     Q_OBJECT
@@ -23,16 +29,51 @@ public:
         bool unlockShifted;
     };
 
-    explicit ChipID(QString filePath, QObject *parent = NULL);
+    // One chip from the built-in list. Its sector groups are sectorGroupCount
+    // entries of sectorGroupTable starting at firstSectorGroup.
+    struct ChipRecord
+    {
+        const char *manufacturer;
+        const char *product;
+        uint16_t manufacturerID;
+        uint16_t productID;
+        uint8_t width;
+        bool unlockShifted;
+        uint32_t capacity;
+        uint16_t firstSectorGroup;
+        uint16_t sectorGroupCount;
+    };
+
+    struct SectorGroup
+    {
+        uint16_t count;
+        uint32_t size;
+    };
+
+    // An empty path means the usual override file, if there is one
+    explicit ChipID(QString overrideFilePath = QString(), QObject *parent = NULL);
+
+    static QString defaultOverrideFilePath();
 
     bool findChips(QList<uint8_t> manufacturersStraight, QList<uint8_t> devicesStraight, QList<uint8_t> manufacturersShifted, QList<uint8_t> devicesShifted, QList<ChipInfo> &info);
 
 private:
     void loadChips(QIODevice &file);
     static uint32_t decodeSectorSize(QString sizeString);
+    bool lookup(uint16_t manufacturerID, uint16_t productID, uint8_t width, bool shifted, ChipInfo &info) const;
+    static uint32_t indexHash(uint16_t manufacturerID, uint16_t productID, uint8_t width, bool shifted);
 
     ChipInfo dummyChipInfo;
-    QList<ChipInfo> allChips;
+    QList<ChipInfo> overrideChips;
+
+    // Generated by chipidgen.py. chipIndex has 2^chipIndexBits slots, each one
+    // either -1 or an entry in chipTable, and it's probed linearly from
+    // indexHash().
+    static const ChipRecord chipTable[];
+    static const int chipTableCount;
+    static const SectorGroup sectorGroupTable[];
+    static const int16_t chipIndex[];
+    static const int chipIndexBits;
 };
 
 #endif // CHIPID_H
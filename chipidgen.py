@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+#
+# Turns chipid.txt into chipid_table.cpp: the chip list as plain static tables
+# that ChipID can use without parsing anything at startup, plus a hash index
+# so identifying a chip is a lookup instead of a search.
+#
+# Usage: chipidgen.py chipid.txt chipid_table.cpp
+#
+# The hash here has to stay in sync with ChipID::indexHash() in chipid.cpp.
+
+import sys
+
+MASK32 = 0xFFFFFFFF
+
+
+def index_hash(manufacturer_id, product_id, width, shifted, bits):
+    key = (manufacturer_id << 16) | product_id
+    salt = ((((width << 1) | (1 if shifted else 0)) * 0x9E3779B9) & MASK32)
+    h = ((key ^ salt) * 2654435761) & MASK32
+    return h >> (32 - bits)
+
+
+def decode_sector_size(text):
+    multiplier = 1
+    if text.endswith("K"):
+        multiplier = 1024
+        text = text[:-1]
+    elif text.endswith("M"):
+        multiplier = 1048576
+        text = text[:-1]
+    return int(text) * multiplier
+
+
+def fail(path, line_number, message):
+    sys.stderr.write("%s:%d: error: %s\n" % (path, line_number, message))
+    sys.exit(1)
+
+
+def load_chips(path):
+    chips = []
+    with open(path) as f:
+        for line_number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith(";"):
+                continue
+
+            components = line.split()
+            if len(components) != 8:
+                fail(path, line_number, "expected 8 columns, found %d" % len(components))
+
+            manufacturer, product, width, capacity, sectors, manufacturer_id, product_id, shifted = components
+            chip = {
+                "manufacturer": manufacturer,
+                "product": product,
+                "width": int(width),
+                "capacity": int(capacity) * 1024,
+                "manufacturer_id": int(manufacturer_id, 16),
+                "product_id": int(product_id, 16),
+                "shifted": shifted.upper() == "YES",
+                "sectors": [],
+                "line": line_number,
+            }
+
+            for group in sectors.split(","):
+                parts = group.split("*")
+                if len(parts) == 1:
+                    count, size = 1, decode_sector_size(parts[0])
+                elif len(parts) == 2:
+                    count, size = int(parts[0]), decode_sector_size(parts[1])
+                else:
+                    fail(path, line_number, "bad sector group \"%s\"" % group)
+                if count != 0 and size != 0:
+                    chip["sectors"].append((count, size))
+
+            # In 16-bit mode the sector sizes are in words
+            total = sum(count * size for count, size in chip["sectors"])
+            if chip["width"] == 16:
+                total *= 2
+            if total != chip["capacity"]:
+                fail(path, line_number, "%s %s has mismatched sector sizes" % (manufacturer, product))
+
+            chips.append(chip)
+    return chips
+
+
+def build_index(chips):
+    # At least twice as many slots as chips keeps the probes short
+    bits = 4
+    while (1 << bits) < 2 * len(chips):
+        bits += 1
+
+    index = [-1] * (1 << bits)
+    for number, chip in enumerate(chips):
+        key = (chip["manufacturer_id"], chip["product_id"], chip["width"], chip["shifted"])
+        slot = index_hash(chip["manufacturer_id"], chip["product_id"], chip["width"], chip["shifted"], bits)
+        while index[slot] >= 0:
+            other = chips[index[slot]]
+            if (other["manufacturer_id"], other["product_id"], other["width"], other["shifted"]) == key:
+                # Same as always: the first one in the file wins
+                sys.stderr.write("warning: line %d (%s %s) is hidden by line %d\n" %
+                                 (chip["line"], chip["manufacturer"], chip["product"], other["line"]))
+                break
+            slot = (slot + 1) & ((1 << bits) - 1)
+        else:
+            index[slot] = number
+    return bits, index
+
+
+def write_table(path, chips, bits, index):
+    out = []
+    out.append("// Generated from chipid.txt by chipidgen.py. Don't edit this; edit chipid.txt.")
+    out.append("")
+    out.append("#include \"chipid.h\"")
+    out.append("")
+
+    out.append("const ChipID::SectorGroup ChipID::sectorGroupTable[] = {")
+    first_groups = []
+    group_count = 0
+    for chip in chips:
+        first_groups.append(group_count)
+        for count, size in chip["sectors"]:
+            out.append("    {%d, %d}," % (count, size))
+            group_count += 1
+    out.append("};")
+    out.append("")
+
+    out.append("const ChipID::ChipRecord ChipID::chipTable[] = {")
+    for chip, first in zip(chips, first_groups):
+        out.append("    {\"%s\", \"%s\", 0x%04X, 0x%04X, %d, %s, %d, %d, %d}," % (
+            chip["manufacturer"], chip["product"], chip["manufacturer_id"], chip["product_id"],
+            chip["width"], "true" if chip["shifted"] else "false", chip["capacity"],
+            first, len(chip["sectors"])))
+    out.append("};")
+    out.append("")
+    out.append("const int ChipID::chipTableCount = %d;" % len(chips))
+    out.append("")
+
+    out.append("const int16_t ChipID::chipIndex[] = {")
+    for start in range(0, len(index), 16):
+        out.append("    " + ", ".join("%d" % n for n in index[start:start + 16]) + ",")
+    out.append("};")
+    out.append("")
+    out.append("const int ChipID::chipIndexBits = %d;" % bits)
+    out.append("")
+
+    with open(path, "w") as f:
+        f.write("\n".join(out))
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write("Usage: %s chipid.txt chipid_table.cpp\n" % sys.argv[0])
+        return 1
+
+    chips = load_chips(sys.argv[1])
+    bits, index = build_index(chips)
+    write_table(sys.argv[2], chips, bits, index)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,136 @@
+#include "combinedromdevice.h"
+#include "compressedimagestream.h"
+#include <string.h>
+
+CombinedROMDevice::CombinedROMDevice(QObject *parent) :
+    QIODevice(parent),
+    diskStream(NULL)
+{
+}
+
+CombinedROMDevice::~CombinedROMDevice()
+{
+    close();
+    delete diskStream;
+}
+
+void CombinedROMDevice::setBaseROM(QByteArray const &rom)
+{
+    baseROM = rom;
+}
+
+void CombinedROMDevice::setPatches(QList<ROMPatch> const &patches)
+{
+    romPatches = patches;
+}
+
+void CombinedROMDevice::setDiskImage(QByteArray const &image)
+{
+    delete diskStream;
+    diskStream = NULL;
+    diskImage = image;
+}
+
+void CombinedROMDevice::setDiskImage(QIODevice *stream)
+{
+    delete diskStream;
+    diskStream = stream;
+    diskImage.clear();
+}
+
+void CombinedROMDevice::cancelPendingReads()
+{
+    CompressedImageStream *compressing = qobject_cast<CompressedImageStream *>(diskStream);
+    if (compressing)
+    {
+        compressing->cancel();
+    }
+}
+
+bool CombinedROMDevice::open(OpenMode mode)
+{
+    if (mode & WriteOnly)
+    {
+        return false;
+    }
+    if (diskStream && !diskStream->isOpen() && !diskStream->open(ReadOnly))
+    {
+        setErrorString(diskStream->errorString());
+        return false;
+    }
+
+    // No buffering, so nothing reads into the disk image part (which might still
+    // be compressing) before it's asked for
+    return QIODevice::open(mode | Unbuffered);
+}
+
+void CombinedROMDevice::close()
+{
+    if (diskStream)
+    {
+        diskStream->close();
+    }
+    QIODevice::close();
+}
+
+qint64 CombinedROMDevice::size() const
+{
+    return baseROM.length() + (diskStream ? diskStream->size() : diskImage.length());
+}
+
+qint64 CombinedROMDevice::readData(char *data, qint64 maxSize)
+{
+    const qint64 romLength = baseROM.length();
+    qint64 p = pos();
+    qint64 done = 0;
+
+    if (p < romLength)
+    {
+        const qint64 n = qMin(maxSize, romLength - p);
+        memcpy(data, baseROM.constData() + p, n);
+
+        // Lay whatever patches land in this chunk over it
+        foreach (ROMPatch const &patch, romPatches)
+        {
+            const qint64 from = qMax(p, static_cast<qint64>(patch.offset));
+            const qint64 to = qMin(p + n, static_cast<qint64>(patch.offset) + patch.bytes.length());
+            if (from < to)
+            {
+                memcpy(data + (from - p), patch.bytes.constData() + (from - patch.offset), to - from);
+            }
+        }
+
+        done += n;
+        p += n;
+    }
+
+    if (done < maxSize)
+    {
+        const qint64 offset = p - romLength;
+        qint64 n;
+        if (diskStream)
+        {
+            n = diskStream->seek(offset) ? diskStream->read(data + done, maxSize - done) : -1;
+            if (n < 0)
+            {
+                setErrorString(diskStream->errorString());
+                return done ? done : -1;
+            }
+        }
+        else
+        {
+            n = qMax(Q_INT64_C(0), qMin(maxSize - done, diskImage.length() - offset));
+            memcpy(data + done, diskImage.constData() + offset, n);
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+qint64 CombinedROMDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
@@ -0,0 +1,52 @@
+#ifndef COMBINEDROMDEVICE_H
+#define COMBINEDROMDEVICE_H
+
+#include <QIODevice>
+#include <QList>
+#include "romsignatures.h"
+
+// A base ROM followed by a disk image, read straight from where they already are
+// instead of being put together in one big array first. The base ROM is the array
+// the patches were worked out from (shared, not copied), and the few bytes that
+// need patching are laid over it as it's read. The disk image is either an array
+// that's already in memory (also shared) or another device, like a
+// CompressedImageStream.
+//
+// This is what gets written to a SIMM or saved to a file.
+class CombinedROMDevice : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    explicit CombinedROMDevice(QObject *parent = NULL);
+    ~CombinedROMDevice();
+
+    void setBaseROM(QByteArray const &rom);
+    qint64 baseROMSize() const { return baseROM.length(); }
+    void setPatches(QList<ROMPatch> const &patches);
+
+    void setDiskImage(QByteArray const &image);
+    // Takes ownership of the stream; it's opened along with this
+    void setDiskImage(QIODevice *stream);
+
+    // If the disk image is still being compressed, stop compressing it; whatever is
+    // waiting to read it gets an error. Safe to call from any thread.
+    void cancelPendingReads();
+
+    bool open(OpenMode mode);
+    void close();
+    bool isSequential() const { return false; }
+    qint64 size() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    QByteArray baseROM;
+    QList<ROMPatch> romPatches;
+    QByteArray diskImage;
+    QIODevice *diskStream;
+};
+
+#endif // COMBINEDROMDEVICE_H
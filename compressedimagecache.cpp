@@ -0,0 +1,116 @@
+#include "compressedimagecache.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// Bump this if anything changes about how images get compressed, so old entries
+// are never used
+#define COMPRESSED_IMAGE_CACHE_VERSION      2
+
+CompressedImageCache::CompressedImageCache(QString const &directory, qint64 maxTotalSize) :
+    dir(directory),
+    maxTotalSize(maxTotalSize)
+{
+    if (dir.isEmpty())
+    {
+        dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/compressed-disk-images";
+    }
+}
+
+QString CompressedImageCache::entryPath(QByteArray const &sourceHash, int blockSize) const
+{
+    return QString("%1/%2-%3-v%4.fc8").arg(dir)
+            .arg(QString::fromLatin1(sourceHash.toHex()))
+            .arg(blockSize)
+            .arg(COMPRESSED_IMAGE_CACHE_VERSION);
+}
+
+bool CompressedImageCache::lookup(QByteArray const &sourceHash, int blockSize, QByteArray &compressed)
+{
+    QFile f(entryPath(sourceHash, blockSize));
+    if (!f.open(QFile::ReadOnly))
+    {
+        return false;
+    }
+
+    compressed = f.readAll();
+    if (compressed.size() != f.size() || !compressed.startsWith("FC8"))
+    {
+        // Something's wrong with it; get rid of it so it gets redone
+        f.close();
+        f.remove();
+        compressed.clear();
+        return false;
+    }
+
+    // Eviction goes by modification time, so mark it as recently used
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
+    f.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+#endif
+    return true;
+}
+
+void CompressedImageCache::store(QByteArray const &sourceHash, int blockSize, QByteArray const &compressed)
+{
+    if (sourceHash.isEmpty() || compressed.isEmpty() || compressed.size() > maxTotalSize)
+    {
+        return;
+    }
+
+    if (!QDir().mkpath(dir))
+    {
+        qWarning() << "Unable to create compressed image cache directory" << dir;
+        return;
+    }
+
+    // QSaveFile so that a half-written entry never shows up if we crash
+    QSaveFile f(entryPath(sourceHash, blockSize));
+    if (!f.open(QFile::WriteOnly) || f.write(compressed) != compressed.size() || !f.commit())
+    {
+        qWarning() << "Unable to save compressed image to the cache:" << f.errorString();
+        return;
+    }
+
+    evict();
+}
+
+QSaveFile *CompressedImageCache::newEntry(QByteArray const &sourceHash, int blockSize) const
+{
+    if (sourceHash.isEmpty() || !QDir().mkpath(dir))
+    {
+        return NULL;
+    }
+    return new QSaveFile(entryPath(sourceHash, blockSize));
+}
+
+void CompressedImageCache::evict()
+{
+    // Oldest last
+    QFileInfoList entries = QDir(dir).entryInfoList(QStringList() << "*.fc8", QDir::Files, QDir::Time);
+
+    qint64 total = 0;
+    for (int x = 0; x < entries.count(); x++)
+    {
+        total += entries[x].size();
+    }
+
+    while (total > maxTotalSize && !entries.isEmpty())
+    {
+        QFileInfo oldest = entries.takeLast();
+        total -= oldest.size();
+        QFile::remove(oldest.absoluteFilePath());
+    }
+}
+
+void CompressedImageCache::clear()
+{
+    QFileInfoList entries = QDir(dir).entryInfoList(QStringList() << "*.fc8", QDir::Files);
+    for (int x = 0; x < entries.count(); x++)
+    {
+        QFile::remove(entries[x].absoluteFilePath());
+    }
+}
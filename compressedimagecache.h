@@ -0,0 +1,40 @@
+#ifndef COMPRESSEDIMAGECACHE_H
+#define COMPRESSEDIMAGECACHE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QSaveFile>
+
+// A directory of FC8-compressed disk images that survives restarts, so picking a disk
+// image we've compressed before (even in an earlier session) doesn't mean compressing
+// it all over again. Entries are named after the hash of the uncompressed image and
+// the compression settings. Once the directory gets bigger than the limit, the least
+// recently used entries are deleted.
+class CompressedImageCache
+{
+public:
+    // An empty path means the standard cache location for the app
+    explicit CompressedImageCache(QString const &directory = QString(),
+                                  qint64 maxTotalSize = 256*1024*1024);
+
+    QString directory() const { return dir; }
+
+    // sourceHash is the hash FC8Compressor reports for the uncompressed image
+    bool lookup(QByteArray const &sourceHash, int blockSize, QByteArray &compressed);
+    void store(QByteArray const &sourceHash, int blockSize, QByteArray const &compressed);
+    void clear();
+
+    // For writing an entry a piece at a time, from any thread. It doesn't show up
+    // until it's committed, and evict() should be called after that. NULL if the
+    // cache directory can't be created.
+    QSaveFile *newEntry(QByteArray const &sourceHash, int blockSize) const;
+    void evict();
+
+private:
+    QString entryPath(QByteArray const &sourceHash, int blockSize) const;
+
+    QString dir;
+    qint64 maxTotalSize;
+};
+
+#endif // COMPRESSEDIMAGECACHE_H
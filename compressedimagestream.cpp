@@ -0,0 +1,119 @@
+#include "compressedimagestream.h"
+#include "fc8compressor.h"
+#include "fc8streamcompressor.h"
+#include "fc8decoder.h"
+#include <string.h>
+namespace fc8 {
+extern "C" {
+#include "3rdparty/fc8-compression/fc8.h"
+}
+}
+
+CompressedImageStream::CompressedImageStream(QByteArray const &diskImage, int blockSize,
+                                             QFuture<QByteArray> const &compressedBlocks, qint64 maxSize, QObject *parent) :
+    QIODevice(parent),
+    diskImage(diskImage),
+    blockSize(blockSize),
+    blocks(compressedBlocks),
+    sizeLimit(maxSize),
+    finished(false)
+{
+    // Worst case is what the block compressor allows for every block, plus the header
+    // and block table
+    const qint64 numBlocks = FC8Compressor::blockIndexList(diskImage.length(), blockSize).count();
+    sizeBound = qMin(sizeLimit, FC8_BLOCK_HEADER_SIZE + 4 * numBlocks + numBlocks * 2 * blockSize);
+}
+
+CompressedImageStream::~CompressedImageStream()
+{
+    // Nothing more is going to be read, so don't bother finishing
+    blocks.cancel();
+    blocks.waitForFinished();
+}
+
+bool CompressedImageStream::open(OpenMode mode)
+{
+    // QIODevice's read buffering would go looking for more (and wait for
+    // compression) sooner than it needs to
+    return QIODevice::open(mode | Unbuffered);
+}
+
+qint64 CompressedImageStream::size() const
+{
+    QMutexLocker locker(&mutex);
+    return finished ? compressed.length() : sizeBound;
+}
+
+QByteArray CompressedImageStream::compressedImage()
+{
+    finishCompression();
+    QMutexLocker locker(&mutex);
+    return compressed;
+}
+
+void CompressedImageStream::cancel()
+{
+    blocks.cancel();
+}
+
+bool CompressedImageStream::finishCompression()
+{
+    QMutexLocker locker(&mutex);
+    if (finished)
+    {
+        return !compressed.isEmpty();
+    }
+
+    // The block table comes first, and it can't be filled out until every block's
+    // size is known, so this is where we have to wait for all of them
+    blocks.waitForFinished();
+    finished = true;
+    if (blocks.isCanceled())
+    {
+        setErrorString("Compression was cancelled.");
+        return false;
+    }
+
+    compressed = FC8StreamCompressor::assemble(blocks.results(), diskImage.length(), blockSize);
+    if (compressed.isEmpty() || !FC8Decoder::verify(compressed, diskImage))
+    {
+        compressed.clear();
+        setErrorString("Unable to compress the disk image.");
+        return false;
+    }
+    if (compressed.length() > sizeLimit)
+    {
+        compressed.clear();
+        setErrorString("The compressed disk image doesn't fit.");
+        return false;
+    }
+
+    // That's all we need the original for
+    diskImage.clear();
+    return true;
+}
+
+qint64 CompressedImageStream::readData(char *data, qint64 maxSize)
+{
+    if (!finishCompression())
+    {
+        return -1;
+    }
+
+    // Once it's finished, it doesn't change, so there's no need for the lock
+    const qint64 p = pos();
+    if (p >= compressed.length())
+    {
+        return 0;
+    }
+    const qint64 n = qMin(maxSize, compressed.length() - p);
+    memcpy(data, compressed.constData() + p, n);
+    return n;
+}
+
+qint64 CompressedImageStream::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
@@ -0,0 +1,62 @@
+#ifndef COMPRESSEDIMAGESTREAM_H
+#define COMPRESSEDIMAGESTREAM_H
+
+#include <QIODevice>
+#include <QFuture>
+#include <QMutex>
+
+// A compressed disk image that can be read while it's still being compressed. The
+// blocks are being worked on in the thread pool the whole time, so put this after
+// the base ROM in a CombinedROMDevice, and the programmer can identify, erase, and
+// write the base ROM right away; only the disk image part has to wait, and only
+// for whatever compression is left by the time the transfer gets there.
+//
+// Until compression is done, size() is just an upper bound (capped at maxSize).
+// Programmer checks it again between chunks, so it stops at the real end.
+//
+// It's read on WriteSource's read-ahead thread, while whoever started the
+// compression asks for the result on the GUI thread, so whichever of them gets
+// there first puts the image together (under the mutex) and the other one just
+// gets what it came up with.
+class CompressedImageStream : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    CompressedImageStream(QByteArray const &diskImage, int blockSize,
+                          QFuture<QByteArray> const &compressedBlocks, qint64 maxSize, QObject *parent = NULL);
+    ~CompressedImageStream();
+
+    bool open(OpenMode mode);
+    bool isSequential() const { return false; }
+    qint64 size() const;
+
+    // Waits for compression to finish (if it hasn't), and returns the verified
+    // compressed image, or an empty array if something went wrong. Once the blocks
+    // are all done, the only wait is for the other thread if it's in the middle of
+    // putting them together.
+    QByteArray compressedImage();
+
+    // Stops compressing; anything still waiting to read gets an error once the
+    // blocks already being worked on are done. Safe to call from any thread.
+    void cancel();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    bool finishCompression();
+
+    QByteArray diskImage;
+    int blockSize;
+    QFuture<QByteArray> blocks;
+    qint64 sizeLimit;
+    qint64 sizeBound;
+    // Guards everything finishCompression() touches
+    mutable QMutex mutex;
+    QByteArray compressed;
+    bool finished;
+};
+
+#endif // COMPRESSEDIMAGESTREAM_H
@@ -0,0 +1,121 @@
+#include "fc8backgroundcompressor.h"
+#include "fc8compressor.h"
+#include "fc8streamcompressor.h"
+#include <QBuffer>
+#include <QDebug>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QtConcurrent/QtConcurrentRun>
+
+FC8BackgroundCompressor::FC8BackgroundCompressor(FC8BlockCache *blockCache, CompressedImageCache *imageCache,
+                                                 QObject *parent) :
+    QObject(parent),
+    blockCache(blockCache),
+    imageCache(imageCache),
+    cancelled(true),
+    reclaimed(0)
+{
+    connect(&watcher, SIGNAL(finished()), SLOT(compressionFinished()));
+}
+
+FC8BackgroundCompressor::~FC8BackgroundCompressor()
+{
+    cancel();
+}
+
+void FC8BackgroundCompressor::start(QByteArray const &scrubbedImage, qint64 reclaimedBytes, QByteArray const &hash)
+{
+    // Already on it, or already done it
+    if (hash == this->hash && !cancelled)
+    {
+        return;
+    }
+    cancel();
+
+    reclaimed = reclaimedBytes;
+    this->hash = hash;
+    compressed.clear();
+    cancelled = false;
+    cancelRequested.storeRelease(0);
+
+    watcher.setFuture(QtConcurrent::run(&FC8BackgroundCompressor::compress, scrubbedImage, hash,
+                                        blockCache, imageCache, &cancelRequested));
+}
+
+void FC8BackgroundCompressor::cancel()
+{
+    // It stops between blocks, but the ones already being worked on have to finish
+    // before the caches can go away
+    cancelled = true;
+    cancelRequested.storeRelease(1);
+    watcher.waitForFinished();
+}
+
+// Runs on a worker thread, so it only uses what it's given
+FC8BackgroundCompressor::Result FC8BackgroundCompressor::compress(QByteArray image, QByteArray hash, FC8BlockCache *blockCache,
+                                                                  CompressedImageCache *imageCache, QAtomicInt *cancelFlag)
+{
+    Result r;
+
+    // If it's not committed, the half-written entry is thrown away
+    QScopedPointer<QSaveFile> entry(imageCache->newEntry(hash, FC8_ROM_DISK_BLOCK_SIZE));
+    QByteArray inMemory;
+    QBuffer buffer(&inMemory);
+    QIODevice *sink = &buffer;
+    if (entry && entry->open(QFile::WriteOnly))
+    {
+        sink = entry.data();
+    }
+    else
+    {
+        buffer.open(QBuffer::WriteOnly);
+    }
+
+    FC8StreamCompressor stream(sink, FC8_ROM_DISK_BLOCK_SIZE, blockCache);
+    bool ok = stream.begin(image.length());
+    for (int pos = 0; ok && pos < image.length(); pos += FC8_ROM_DISK_BLOCK_SIZE)
+    {
+        if (cancelFlag->loadAcquire())
+        {
+            return r;
+        }
+        ok = stream.addBlock(image.mid(pos, FC8_ROM_DISK_BLOCK_SIZE));
+    }
+    if (!ok || !stream.finish())
+    {
+        qWarning() << "Unable to compress the disk image in the background:" << stream.errorString();
+        return r;
+    }
+
+    if (sink == &buffer)
+    {
+        r.compressed = inMemory;
+    }
+    else if (entry->commit())
+    {
+        r.storedInCache = true;
+    }
+    else
+    {
+        qWarning() << "Unable to save compressed image to the cache:" << entry->errorString();
+    }
+    return r;
+}
+
+void FC8BackgroundCompressor::compressionFinished()
+{
+    if (cancelRequested.loadAcquire())
+    {
+        return;
+    }
+
+    const Result r = watcher.result();
+    compressed = r.compressed;
+    if (r.storedInCache)
+    {
+        // Read it back before anything else can be evicted to make room
+        imageCache->lookup(hash, FC8_ROM_DISK_BLOCK_SIZE, compressed);
+        imageCache->evict();
+    }
+    emit finished();
+}
@@ -0,0 +1,69 @@
+#ifndef FC8BACKGROUNDCOMPRESSOR_H
+#define FC8BACKGROUNDCOMPRESSOR_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QAtomicInt>
+#include "fc8blockcache.h"
+#include "compressedimagecache.h"
+
+// Compresses a disk image in the thread pool, the same way ROMBuilder would (free
+// space scrubbed first, FC8_ROM_DISK_BLOCK_SIZE blocks), so that by the time a ROM
+// is put together, the compressed image is usually sitting there waiting for it.
+// The scrubbing is up to the caller; the size estimator has already done it.
+//
+// The blocks go through an FC8StreamCompressor on a worker thread, straight into a
+// new entry in the compressed image cache, so only a few of them are in memory at
+// a time. The finished image is read back out of the cache at the end. If the
+// cache can't be written to, it's put together in memory instead.
+class FC8BackgroundCompressor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FC8BackgroundCompressor(FC8BlockCache *blockCache, CompressedImageCache *imageCache,
+                                     QObject *parent = NULL);
+    ~FC8BackgroundCompressor();
+
+    // reclaimedBytes is just passed along, for whoever wants to know once it's done
+    void start(QByteArray const &scrubbedImage, qint64 reclaimedBytes, QByteArray const &hash);
+    void cancel();
+    bool isRunning() const { return watcher.isRunning(); }
+
+    QByteArray hashOfImage() const { return hash; }
+    // Empty if it couldn't be compressed
+    QByteArray compressedImage() const { return compressed; }
+    // How much of the image's free space wasn't zero before it was scrubbed
+    qint64 reclaimedBytes() const { return reclaimed; }
+
+signals:
+    void finished();
+
+private slots:
+    void compressionFinished();
+
+private:
+    struct Result
+    {
+        Result() : storedInCache(false) {}
+
+        bool storedInCache;
+        // Only if it isn't in the cache
+        QByteArray compressed;
+    };
+
+    static Result compress(QByteArray image, QByteArray hash, FC8BlockCache *blockCache,
+                           CompressedImageCache *imageCache, QAtomicInt *cancelFlag);
+
+    FC8BlockCache *blockCache;
+    CompressedImageCache *imageCache;
+    QFutureWatcher<Result> watcher;
+    QAtomicInt cancelRequested;
+    // Whether the last start() was cancelled (or there hasn't been one)
+    bool cancelled;
+    QByteArray hash;
+    qint64 reclaimed;
+    QByteArray compressed;
+};
+
+#endif // FC8BACKGROUNDCOMPRESSOR_H
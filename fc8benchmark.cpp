@@ -0,0 +1,109 @@
+#include "fc8benchmark.h"
+#include "fc8compressor.h"
+#include "fc8fastencoder.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QVector>
+
+// -1 is the reference encoder, anything else is an FC8EncoderEffort
+static QString encoderName(int encoder)
+{
+    return encoder < 0 ? QString("reference") : FC8FastEncoder::effortName(static_cast<FC8EncoderEffort>(encoder));
+}
+
+static QByteArray encodeWith(int encoder, QByteArray const &block)
+{
+    QByteArray compressed(2 * block.length(), static_cast<char>(0));
+    uint32_t len;
+    if (encoder < 0)
+    {
+        len = FC8Compressor::referenceEncode(reinterpret_cast<const uint8_t *>(block.constData()), block.length(),
+                reinterpret_cast<uint8_t *>(compressed.data()), compressed.length());
+    }
+    else
+    {
+        FC8FastEncoder fast(static_cast<FC8EncoderEffort>(encoder));
+        len = fast.encode(reinterpret_cast<const uint8_t *>(block.constData()), block.length(),
+                reinterpret_cast<uint8_t *>(compressed.data()), compressed.length());
+    }
+    compressed.truncate(len);
+    return compressed;
+}
+
+QString FC8Benchmark::run(QStringList const &imagePaths, int blockSize)
+{
+    QStringList lines;
+    lines << QString("Block size: %1 bytes").arg(blockSize);
+    lines << QString("Fast encoder token layout: %1").arg(FC8FastEncoder::matchesReferenceDecoder() ?
+                 "matches the reference decoder" : "DOESN'T MATCH the reference decoder");
+
+    foreach (QString const &path, imagePaths)
+    {
+        QFile f(path);
+        if (!f.open(QFile::ReadOnly))
+        {
+            lines << QString("%1: unable to open").arg(path);
+            continue;
+        }
+        const QByteArray image = f.readAll();
+        f.close();
+        if (image.isEmpty())
+        {
+            lines << QString("%1: empty").arg(path);
+            continue;
+        }
+
+        // Pad the last block the same way FC8Compressor does
+        const QVector<int> blockIndexes = FC8Compressor::blockIndexList(image.length(), blockSize);
+        QList<QByteArray> blocks;
+        foreach (int index, blockIndexes)
+        {
+            QByteArray block = image.mid(index * blockSize, blockSize);
+            block.append(QByteArray(blockSize - block.length(), static_cast<char>(0)));
+            blocks.append(block);
+        }
+
+        lines << QString("%1 (%2 bytes, %3 blocks):").arg(QFileInfo(path).fileName())
+                 .arg(image.length()).arg(blocks.count());
+
+        qint64 referenceTime = 0;
+        for (int encoder = -1; encoder <= FC8EffortMax; encoder++)
+        {
+            QList<QByteArray> compressedBlocks;
+            QElapsedTimer timer;
+            timer.start();
+            foreach (QByteArray const &block, blocks)
+            {
+                compressedBlocks.append(encodeWith(encoder, block));
+            }
+            const qint64 elapsed = qMax(timer.elapsed(), static_cast<qint64>(1));
+            if (encoder < 0)
+            {
+                referenceTime = elapsed;
+            }
+
+            qint64 total = 0;
+            int failed = 0;
+            for (int x = 0; x < blocks.count(); x++)
+            {
+                total += compressedBlocks[x].length();
+                if (compressedBlocks[x].isEmpty() || !FC8Compressor::decodesTo(compressedBlocks[x], blocks[x]))
+                {
+                    failed++;
+                }
+            }
+
+            lines << QString("  %1: %2 ms (%3 MB/s, %4x reference), %5 bytes (%6%), %7")
+                     .arg(encoderName(encoder), -9)
+                     .arg(elapsed)
+                     .arg(image.length() / 1048576.0 / (elapsed / 1000.0), 0, 'f', 1)
+                     .arg(static_cast<double>(referenceTime) / elapsed, 0, 'f', 1)
+                     .arg(total)
+                     .arg(100.0 * total / image.length(), 0, 'f', 1)
+                     .arg(failed ? QString("%1 blocks failed to decode").arg(failed) : QString("all blocks verified"));
+        }
+    }
+
+    return lines.join("\n") + "\n";
+}
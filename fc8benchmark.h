@@ -0,0 +1,18 @@
+#ifndef FC8BENCHMARK_H
+#define FC8BENCHMARK_H
+
+#include <QString>
+#include <QStringList>
+
+// Compresses disk images block by block with the reference FC8 encoder and with
+// each effort level of FC8FastEncoder, and reports how long each one took, how
+// small the result was, and whether every block decoded back to the original
+// with the reference decoder.
+// Everything runs on one thread so the timings are comparable.
+class FC8Benchmark
+{
+public:
+    static QString run(QStringList const &imagePaths, int blockSize);
+};
+
+#endif // FC8BENCHMARK_H
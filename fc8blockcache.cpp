@@ -0,0 +1,69 @@
+#include "fc8blockcache.h"
+#include <QCryptographicHash>
+#include <QMutexLocker>
+
+FC8BlockCache::FC8BlockCache(int maxCompressedBytes) :
+    blocks(maxCompressedBytes),
+    hitCount(0),
+    missCount(0)
+{
+}
+
+QByteArray FC8BlockCache::fingerprint(QByteArray const &block)
+{
+    // The length goes in too, so the same data compressed with a different block
+    // size can never be mixed up
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(block);
+    const int len = block.length();
+    const char lenBytes[4] = {static_cast<char>(len >> 24), static_cast<char>(len >> 16),
+                              static_cast<char>(len >> 8), static_cast<char>(len)};
+    return hash.result() + QByteArray(lenBytes, 4);
+}
+
+bool FC8BlockCache::lookup(QByteArray const &fingerprint, QByteArray &compressed)
+{
+    QMutexLocker locker(&mutex);
+    QByteArray const *found = blocks.object(fingerprint);
+    if (!found)
+    {
+        missCount++;
+        return false;
+    }
+
+    hitCount++;
+    compressed = *found;
+    return true;
+}
+
+void FC8BlockCache::insert(QByteArray const &fingerprint, QByteArray const &compressed)
+{
+    QMutexLocker locker(&mutex);
+    // Least recently used blocks fall out once the total size hits the limit
+    blocks.insert(fingerprint, new QByteArray(compressed), compressed.length());
+}
+
+void FC8BlockCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    blocks.clear();
+}
+
+int FC8BlockCache::hits() const
+{
+    QMutexLocker locker(&mutex);
+    return hitCount;
+}
+
+int FC8BlockCache::misses() const
+{
+    QMutexLocker locker(&mutex);
+    return missCount;
+}
+
+void FC8BlockCache::resetStatistics()
+{
+    QMutexLocker locker(&mutex);
+    hitCount = 0;
+    missCount = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef FC8BLOCKCACHE_H
+#define FC8BLOCKCACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QMutex>
+
+// Remembers the compressed version of recently compressed FC8 blocks, keyed by a
+// fingerprint of the uncompressed block. When a disk image is recompressed after
+// a small change, only the blocks that actually changed need to be encoded again;
+// everything else comes straight out of here. Since it's keyed by content rather
+// than position, blocks that just moved are reused too.
+//
+// It's used from several compression threads at once, so everything is locked.
+class FC8BlockCache
+{
+public:
+    explicit FC8BlockCache(int maxCompressedBytes = 64*1024*1024);
+
+    static QByteArray fingerprint(QByteArray const &block);
+
+    bool lookup(QByteArray const &fingerprint, QByteArray &compressed);
+    void insert(QByteArray const &fingerprint, QByteArray const &compressed);
+    void clear();
+
+    // How many lookups found something, and how many didn't, since the last reset
+    int hits() const;
+    int misses() const;
+    void resetStatistics();
+
+private:
+    mutable QMutex mutex;
+    QCache<QByteArray, QByteArray> blocks;
+    int hitCount;
+    int missCount;
+};
+
+#endif // FC8BLOCKCACHE_H
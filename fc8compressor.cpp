@@ -1,5 +1,9 @@
 #include "fc8compressor.h"
 #include <QCryptographicHash>
+#include <QAtomicInt>
+#include <QDebug>
+#include <QMutex>
+#include <QVector>
 #include <stdint.h>
 namespace fc8 {
 extern "C" {
@@ -17,91 +21,136 @@ static QCryptographicHash::Algorithm hashAlgorithm()
 #endif
 }
 
-FC8Compressor::FC8Compressor(const QByteArray &data, int blockSize, QObject *parent) :
-    QObject(parent),
-    _data(data),
-    _blockSize(blockSize)
+FC8Compressor::BlockCompressor::BlockCompressor(QByteArray const &data, int blockSize, FC8BlockCache *cache, FC8EncoderEffort effort) :
+    data(data),
+    blockSize(blockSize),
+    cache(cache),
+    effort(effort)
 {
-
 }
 
-void FC8Compressor::doCompression()
+QByteArray FC8Compressor::BlockCompressor::operator()(int index) const
 {
-    QByteArray compressedData(2 * _data.length(), static_cast<char>(0));
-    if (_blockSize == 0)
+    // Grab the block. Pad it with zeros to the block size if it's the last block
+    // and the input data wasn't a multiple of the block size.
+    const int chunkLen = qMin(blockSize, data.length() - (index * blockSize));
+    QByteArray block = QByteArray::fromRawData(data.constData() + index * blockSize, chunkLen);
+    if (chunkLen < blockSize)
+    {
+        block.append(QByteArray(blockSize - chunkLen, static_cast<char>(0)));
+    }
+
+    // If we've compressed this exact block before, there's no need to do it again
+    QByteArray fingerprint;
+    QByteArray compressed;
+    if (cache)
+    {
+        fingerprint = FC8BlockCache::fingerprint(block);
+        if (cache->lookup(fingerprint, compressed))
+        {
+            return compressed;
+        }
+    }
+
+    compressed = encodeBlock(block, effort);
+    if (cache && !compressed.isEmpty())
     {
-        uint32_t len = fc8::Encode(reinterpret_cast<const uint8_t *>(_data.constData()), _data.length(),
-                reinterpret_cast<uint8_t *>(compressedData.data()), compressedData.length());
-        // the encode routine returns the compressed length, or 0 if there's an error
-        compressedData.truncate(len);
+        cache->insert(fingerprint, compressed);
     }
-    else
+    return compressed;
+}
+
+QByteArray FC8Compressor::encodeBlock(QByteArray const &block, FC8EncoderEffort effort)
+{
+    // Same worst case allowance as for the whole thing
+    QByteArray compressed(2 * block.length(), static_cast<char>(0));
+    uint32_t len;
+    if (FC8FastEncoder::matchesReferenceDecoder())
     {
-        int numBlocks = (_data.length() - 1) / _blockSize + 1;
-        // If the input data isn't a multiple of the block size, make sure we've
-        // reserved enough room in the compression buffer
-        if (numBlocks * _blockSize > _data.length())
+        FC8FastEncoder encoder(effort);
+        len = encoder.encode(reinterpret_cast<const uint8_t *>(block.constData()), block.length(),
+                reinterpret_cast<uint8_t *>(compressed.data()), compressed.length());
+        compressed.truncate(len);
+
+        // Whatever goes into the ROM has to come back out exactly the same, so make
+        // sure the reference decoder agrees. If it doesn't, the reference encoder
+        // does this block instead.
+        if (len != 0 && decodesTo(compressed, block))
         {
-            const int extraBytes = numBlocks * _blockSize - _data.length();
-            compressedData.append(QByteArray(2 * extraBytes, static_cast<char>(0)));
+            return compressed;
         }
 
-        // Fill out the header
-        compressedData.replace(0, 4, "FC8b", 4);
-        compressedData[FC8_DECODED_SIZE_OFFSET + 0] = (_data.length() >> 24) & 0xFF;
-        compressedData[FC8_DECODED_SIZE_OFFSET + 1] = (_data.length() >> 16) & 0xFF;
-        compressedData[FC8_DECODED_SIZE_OFFSET + 2] = (_data.length() >> 8) & 0xFF;
-        compressedData[FC8_DECODED_SIZE_OFFSET + 3] = (_data.length() >> 0) & 0xFF;
-        compressedData[FC8_BLOCK_SIZE_OFFSET + 0] = (_blockSize >> 24) & 0xFF;
-        compressedData[FC8_BLOCK_SIZE_OFFSET + 1] = (_blockSize >> 16) & 0xFF;
-        compressedData[FC8_BLOCK_SIZE_OFFSET + 2] = (_blockSize >> 8) & 0xFF;
-        compressedData[FC8_BLOCK_SIZE_OFFSET + 3] = (_blockSize >> 0) & 0xFF;
-
-        int blockpos = FC8_BLOCK_HEADER_SIZE;
-        int pos = FC8_BLOCK_HEADER_SIZE + (4 * numBlocks);
-        for (int i = 0; i < numBlocks; i++)
+        static QAtomicInt warned(0);
+        if (warned.testAndSetRelaxed(0, 1))
         {
-            // Grab another block to write out. Pad it with zeros to the block size if
-            // it's the last block and the input data wasn't a multiple of the block size.
-            int chunkLen = qMin(_blockSize, _data.length() - (i * _blockSize));
-            QByteArray block = QByteArray::fromRawData(_data.constData() + i * _blockSize, chunkLen);
-            if (chunkLen < _blockSize)
-            {
-                block.append(QByteArray(_blockSize - chunkLen, static_cast<char>(0)));
-            }
-
-            // Compress this block
-            uint32_t len = fc8::Encode(reinterpret_cast<const uint8_t *>(block.constData()), _blockSize,
-                    reinterpret_cast<uint8_t *>(compressedData.data() + pos), compressedData.length() - pos);
-            if (len == 0)
-            {
-                // Error occurred during encoding. Signal with an empty QByteArray to signal an error
-                compressedData.clear();
-                break;
-            }
-
-            // Save the start location of this block in the block table
-            compressedData[blockpos + 0] = (pos >> 24) & 0xFF;
-            compressedData[blockpos + 1] = (pos >> 16) & 0xFF;
-            compressedData[blockpos + 2] = (pos >> 8) & 0xFF;
-            compressedData[blockpos + 3] = (pos >> 0) & 0xFF;
-
-            // Move forward
-            blockpos += 4;
-            pos += len;
+            qWarning() << "Fast FC8 encoder output didn't verify; using the reference encoder for that block";
         }
+        compressed = QByteArray(2 * block.length(), static_cast<char>(0));
+    }
+
+    len = referenceEncode(reinterpret_cast<const uint8_t *>(block.constData()), block.length(),
+            reinterpret_cast<uint8_t *>(compressed.data()), compressed.length());
+    // 0 means an error, which the empty array passes along
+    compressed.truncate(len);
+    return compressed;
+}
 
-        // All done; now truncate the compressed array to where we left off
-        compressedData.truncate(pos);
+uint32_t FC8Compressor::referenceEncode(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen)
+{
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    return fc8::Encode(in, inLen, out, outLen);
+}
+
+bool FC8Compressor::decodesTo(QByteArray const &compressed, QByteArray const &original)
+{
+    QByteArray decoded(original.length(), static_cast<char>(0));
+    const uint32_t len = fc8::Decode(reinterpret_cast<const uint8_t *>(compressed.constData()),
+            reinterpret_cast<uint8_t *>(decoded.data()), decoded.length());
+    return len == static_cast<uint32_t>(original.length()) && decoded == original;
+}
+
+QVector<int> FC8Compressor::blockIndexList(int dataLength, int blockSize)
+{
+    // Even empty data gets one (all padding) block
+    const int numBlocks = (dataLength - 1) / blockSize + 1;
+    QVector<int> blockIndexes(numBlocks);
+    for (int i = 0; i < numBlocks; i++)
+    {
+        blockIndexes[i] = i;
     }
+    return blockIndexes;
+}
+
+QByteArray FC8Compressor::blockModeHeader(uint32_t dataLength, int blockSize)
+{
+    QByteArray header(FC8_BLOCK_HEADER_SIZE, static_cast<char>(0));
+    header.replace(0, 4, "FC8b", 4);
+    header[FC8_DECODED_SIZE_OFFSET + 0] = (dataLength >> 24) & 0xFF;
+    header[FC8_DECODED_SIZE_OFFSET + 1] = (dataLength >> 16) & 0xFF;
+    header[FC8_DECODED_SIZE_OFFSET + 2] = (dataLength >> 8) & 0xFF;
+    header[FC8_DECODED_SIZE_OFFSET + 3] = (dataLength >> 0) & 0xFF;
+    header[FC8_BLOCK_SIZE_OFFSET + 0] = (blockSize >> 24) & 0xFF;
+    header[FC8_BLOCK_SIZE_OFFSET + 1] = (blockSize >> 16) & 0xFF;
+    header[FC8_BLOCK_SIZE_OFFSET + 2] = (blockSize >> 8) & 0xFF;
+    header[FC8_BLOCK_SIZE_OFFSET + 3] = (blockSize >> 0) & 0xFF;
+    return header;
+}
 
-    // Calculate a signature of the original file so we can associate the compressed version
-    // with the original.
-    QByteArray hashOfOriginal = QCryptographicHash::hash(_data, hashAlgorithm());
-    emit compressionFinished(hashOfOriginal, compressedData);
+bool FC8Compressor::isCompressedImage(QByteArray const &image)
+{
+    // Look for start of FC8b or FC8_
+    return image.length() >= 4 && image.at(0) == 'F' &&
+        image.at(1) == 'C' && image.at(2) == '8' &&
+        (image.at(3) == 'b' || image.at(3) == '_');
 }
 
 bool FC8Compressor::hashMatchesFile(const QByteArray &hash, const QByteArray &file)
 {
-    return QCryptographicHash::hash(file, hashAlgorithm()) == hash;
+    return hashOfFile(file) == hash;
+}
+
+QByteArray FC8Compressor::hashOfFile(const QByteArray &file)
+{
+    return QCryptographicHash::hash(file, hashAlgorithm());
 }
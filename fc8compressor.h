@@ -1,25 +1,59 @@
 #ifndef FC8COMPRESSOR_H
 #define FC8COMPRESSOR_H
 
-#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QVector>
 #include <stdint.h>
+#include "fc8blockcache.h"
+#include "fc8fastencoder.h"
 
-class FC8Compressor : public QObject
+// 64 KB is the only block size the ROM disk driver is known to work with; it's
+// the only one this program has ever given it
+#define FC8_ROM_DISK_BLOCK_SIZE     65536
+
+// The building blocks of FC8 compression. Everything here is static; the images
+// themselves are put together by FC8StreamCompressor.
+class FC8Compressor
 {
-    Q_OBJECT
 public:
-    explicit FC8Compressor(QByteArray const &data, int blockSize, QObject *parent = NULL);
-
-public slots:
-    void doCompression();
     static bool hashMatchesFile(QByteArray const &hash, QByteArray const &file);
+    static QByteArray hashOfFile(QByteArray const &file);
+    static bool isCompressedImage(QByteArray const &image);
+
+    // The pieces of block mode compression, for callers that want to run the blocks
+    // through QtConcurrent themselves (to get progress and cancellation):
+    // compress each index in blockIndexList() with a BlockCompressor, then put the
+    // results together with FC8StreamCompressor::assemble().
+    static QVector<int> blockIndexList(int dataLength, int blockSize);
+
+    // The "FC8b" header that goes before the block table
+    static QByteArray blockModeHeader(uint32_t dataLength, int blockSize);
+
+    // Compresses one block into a standalone FC8 stream, or returns an empty array
+    // if it couldn't. decodesTo() checks a stream with the reference decoder.
+    static QByteArray encodeBlock(QByteArray const &block, FC8EncoderEffort effort = FC8EffortNormal);
+    static bool decodesTo(QByteArray const &compressed, QByteArray const &original);
+
+    // fc8::Encode, one caller at a time. Nobody has checked that the reference
+    // encoder is safe to run on more than one thread at once.
+    static uint32_t referenceEncode(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen);
 
-signals:
-    void compressionFinished(QByteArray hashOfOriginal, QByteArray compressedData);
+    // Compresses one block of the data
+    class BlockCompressor
+    {
+    public:
+        typedef QByteArray result_type;
+        BlockCompressor(QByteArray const &data, int blockSize, FC8BlockCache *cache,
+                        FC8EncoderEffort effort = FC8EffortNormal);
+        QByteArray operator()(int index) const;
 
-private:
-    QByteArray _data;
-    int _blockSize;
+    private:
+        QByteArray data;
+        int blockSize;
+        FC8BlockCache *cache;
+        FC8EncoderEffort effort;
+    };
 };
 
 #endif // FC8COMPRESSOR_H
@@ -0,0 +1,254 @@
+#include "fc8decoder.h"
+#include "fc8fastencoder.h"
+#include "fc8format.h"
+#include <QAtomicInt>
+#include <QVector>
+#include <QtConcurrent/QtConcurrentMap>
+#include <string.h>
+namespace fc8 {
+extern "C" {
+#include "3rdparty/fc8-compression/fc8.h"
+}
+}
+
+static uint32_t readBigEndian32(const uint8_t *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+// No real disk image comes anywhere near this once it's decompressed. It keeps a
+// damaged header from asking for an enormous buffer.
+#define FC8_MAX_DECODED_SIZE    (256 * 1024 * 1024)
+
+// Decodes one block of a block mode image into its spot in the output
+class BlockDecoder
+{
+public:
+    BlockDecoder(QByteArray const &compressed, QVector<uint32_t> const &offsets, uint32_t blockSize,
+                 uint8_t *out, QAtomicInt *failed) :
+        compressed(compressed),
+        offsets(offsets),
+        blockSize(blockSize),
+        out(out),
+        failed(failed)
+    {
+    }
+
+    void operator()(int const &index) const
+    {
+        const uint8_t *in = reinterpret_cast<const uint8_t *>(compressed.constData()) + offsets[index];
+        const uint32_t available = offsets[index + 1] - offsets[index];
+
+        // Each block is its own complete FC8 stream, and it had better be for a whole block
+        if (!FC8Decoder::decodeStream(in, available, out + static_cast<size_t>(index) * blockSize, blockSize))
+        {
+            failed->storeRelease(1);
+        }
+    }
+
+private:
+    QByteArray compressed;
+    QVector<uint32_t> offsets;
+    uint32_t blockSize;
+    uint8_t *out;
+    QAtomicInt *failed;
+};
+
+bool FC8Decoder::decodedSize(QByteArray const &compressed, uint32_t &size)
+{
+    if (compressed.length() < FC8_HEADER_SIZE || !compressed.startsWith("FC8") ||
+        (compressed.at(3) != '_' && compressed.at(3) != 'b'))
+    {
+        return false;
+    }
+
+    size = readBigEndian32(reinterpret_cast<const uint8_t *>(compressed.constData()) + FC8_DECODED_SIZE_OFFSET);
+    return true;
+}
+
+// The reference decoder, for when the token layout in fc8format.h can't be trusted.
+// It doesn't know how long its input is, so it gets a copy with enough EOFs on the
+// end that whatever it makes of the last token, it runs into one.
+static bool referenceDecodeStream(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen)
+{
+    QByteArray padded(reinterpret_cast<const char *>(in), inLen);
+    padded.append(QByteArray(FC8_MAX_LITERAL_RUN + 4, static_cast<char>(FC8_TOKEN_EOF)));
+    return fc8::Decode(reinterpret_cast<const uint8_t *>(padded.constData()), out, outLen) == outLen;
+}
+
+bool FC8Decoder::decodeStream(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen)
+{
+    if (inLen < FC8_HEADER_SIZE || in[0] != 'F' || in[1] != 'C' || in[2] != '8' || in[3] != '_' ||
+        readBigEndian32(in + FC8_DECODED_SIZE_OFFSET) != outLen)
+    {
+        return false;
+    }
+
+    if (!FC8FastEncoder::matchesReferenceDecoder())
+    {
+        return referenceDecodeStream(in, inLen, out, outLen);
+    }
+
+    uint32_t inPos = FC8_HEADER_SIZE;
+    uint32_t outPos = 0;
+    while (inPos < inLen)
+    {
+        const uint8_t token = in[inPos++];
+        uint32_t length;
+        uint32_t distance;
+        switch (token & FC8_TOKEN_TYPE_MASK)
+        {
+        case FC8_TOKEN_LIT:
+            length = (token & 0x3F) + 1;
+            if (length > inLen - inPos || length > outLen - outPos)
+            {
+                return false;
+            }
+            memcpy(out + outPos, in + inPos, length);
+            inPos += length;
+            outPos += length;
+            continue;
+        case FC8_TOKEN_BR0:
+            distance = token & 0x1F;
+            if (distance == 0)
+            {
+                // EOF, which had better be right at the end of the output
+                return outPos == outLen;
+            }
+            length = ((token >> 5) & 0x01) + FC8_MIN_MATCH;
+            break;
+        case FC8_TOKEN_BR1:
+            if (inLen - inPos < 1)
+            {
+                return false;
+            }
+            length = ((token >> 3) & 0x07) + FC8_MIN_MATCH;
+            distance = ((token & 0x07) << 8) | in[inPos];
+            inPos += 1;
+            break;
+        default:
+            if (inLen - inPos < 2)
+            {
+                return false;
+            }
+            length = fc8BR2Lengths[(token >> 1) & 0x1F];
+            distance = ((token & 0x01) << 16) | (in[inPos] << 8) | in[inPos + 1];
+            inPos += 2;
+            break;
+        }
+
+        if (distance == 0 || distance > outPos || length > outLen - outPos)
+        {
+            return false;
+        }
+        // A byte at a time, since the copy can run into what it's writing
+        for (uint32_t x = 0; x < length; x++, outPos++)
+        {
+            out[outPos] = out[outPos - distance];
+        }
+    }
+
+    // Ran out of data without an EOF
+    return false;
+}
+
+bool FC8Decoder::decode(QByteArray const &compressed, QByteArray &decoded, QString *errorText)
+{
+    uint32_t size = 0;
+    if (!decodedSize(compressed, size))
+    {
+        if (errorText)
+        {
+            *errorText = "It isn't an FC8 image.";
+        }
+        return false;
+    }
+
+    // Every byte of compressed data can only turn into so much
+    if (size > FC8_MAX_DECODED_SIZE || size / FC8_MAX_MATCH > static_cast<uint32_t>(compressed.length()))
+    {
+        if (errorText)
+        {
+            *errorText = "The FC8 header doesn't make sense.";
+        }
+        return false;
+    }
+
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(compressed.constData());
+    if (compressed.at(3) == '_')
+    {
+        // Whole-file mode has nothing to split up
+        decoded = QByteArray(size, static_cast<char>(0));
+        if (!decodeStream(in, compressed.length(), reinterpret_cast<uint8_t *>(decoded.data()), size))
+        {
+            decoded.clear();
+            if (errorText)
+            {
+                *errorText = "The compressed data is damaged.";
+            }
+            return false;
+        }
+        return true;
+    }
+
+    const uint32_t blockSize = compressed.length() >= FC8_BLOCK_HEADER_SIZE ?
+                readBigEndian32(in + FC8_BLOCK_SIZE_OFFSET) : 0;
+    const uint32_t numBlocks = blockSize ? (static_cast<qint64>(size) + blockSize - 1) / blockSize : 0;
+    if (blockSize == 0 || size == 0 ||
+        FC8_BLOCK_HEADER_SIZE + 4 * static_cast<qint64>(numBlocks) > compressed.length() ||
+        static_cast<qint64>(numBlocks) * blockSize > FC8_MAX_DECODED_SIZE ||
+        static_cast<qint64>(numBlocks) * blockSize / FC8_MAX_MATCH > compressed.length())
+    {
+        if (errorText)
+        {
+            *errorText = "The FC8 block header doesn't make sense.";
+        }
+        return false;
+    }
+
+    // One extra offset marks the end of the last block. Blocks have to be in order
+    // and inside the data, or something's wrong.
+    QVector<uint32_t> offsets(numBlocks + 1);
+    QVector<int> blockIndexes(numBlocks);
+    const uint32_t firstBlock = FC8_BLOCK_HEADER_SIZE + 4 * numBlocks;
+    for (uint32_t i = 0; i < numBlocks; i++)
+    {
+        offsets[i] = readBigEndian32(in + FC8_BLOCK_HEADER_SIZE + 4 * i);
+        blockIndexes[i] = i;
+        if (offsets[i] < (i == 0 ? firstBlock : offsets[i - 1]) ||
+            offsets[i] > static_cast<uint32_t>(compressed.length()))
+        {
+            if (errorText)
+            {
+                *errorText = "The FC8 block table is damaged.";
+            }
+            return false;
+        }
+    }
+    offsets[numBlocks] = compressed.length();
+
+    // The last block decodes to a whole block of padding too
+    decoded = QByteArray(numBlocks * blockSize, static_cast<char>(0));
+    QAtomicInt failed(0);
+    QtConcurrent::blockingMap(blockIndexes, BlockDecoder(compressed, offsets, blockSize,
+                                                         reinterpret_cast<uint8_t *>(decoded.data()), &failed));
+    if (failed.loadAcquire())
+    {
+        decoded.clear();
+        if (errorText)
+        {
+            *errorText = "Some of the compressed blocks are damaged.";
+        }
+        return false;
+    }
+
+    decoded.truncate(size);
+    return true;
+}
+
+bool FC8Decoder::verify(QByteArray const &compressed, QByteArray const &original)
+{
+    QByteArray decoded;
+    return decode(compressed, decoded) && decoded == original;
+}
@@ -0,0 +1,35 @@
+#ifndef FC8DECODER_H
+#define FC8DECODER_H
+
+#include <QByteArray>
+#include <QString>
+#include <stdint.h>
+
+// Decompresses FC8 images, both the whole-file ("FC8_") and block ("FC8b") kinds.
+// Blocks don't depend on each other, so the block table is used to decode them
+// all at once on the thread pool; a typical ROM disk takes a few milliseconds,
+// which is quick enough to check every image before it goes onto a SIMM.
+//
+// These images come from users' files and might be damaged, so the decoding
+// never goes outside the compressed data or the output, and a header that asks
+// for more than the data could possibly hold is turned down before anything is
+// allocated. The reference decoder can't promise any of that, so it's only used
+// if FC8FastEncoder::matchesReferenceDecoder() says the token layout here isn't
+// the same as its own.
+class FC8Decoder
+{
+public:
+    // Straight from the header, without decoding anything
+    static bool decodedSize(QByteArray const &compressed, uint32_t &size);
+
+    static bool decode(QByteArray const &compressed, QByteArray &decoded, QString *errorText = NULL);
+
+    // Whether compressed decodes to exactly original
+    static bool verify(QByteArray const &compressed, QByteArray const &original);
+
+    // Decodes one complete "FC8_" stream of inLen bytes, which has to come out to
+    // exactly outLen bytes
+    static bool decodeStream(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen);
+};
+
+#endif // FC8DECODER_H
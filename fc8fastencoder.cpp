@@ -0,0 +1,461 @@
+#include "fc8fastencoder.h"
+#include "fc8format.h"
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QDebug>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <string.h>
+namespace fc8 {
+extern "C" {
+#include "3rdparty/fc8-compression/fc8.h"
+}
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FC8_MATCH_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FC8_MATCH_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// The window the hash chains cover; a power of 2 a byte bigger than the longest
+// distance a token can have
+#define FC8_WINDOW_SIZE             (FC8_BR2_MAX_DISTANCE + 1)
+#define FC8_WINDOW_MASK             (FC8_WINDOW_SIZE - 1)
+
+#define FC8_HASH_BITS               16
+#define FC8_HASH_SIZE               (1 << FC8_HASH_BITS)
+
+// With lazy matching, a match at least this long is taken without checking
+// whether the next position has something better
+#define FC8_LAZY_GOOD_ENOUGH        32
+
+static inline uint32_t countTrailingZeros(uint32_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// How many bytes starting at a and b are the same, up to max
+static inline uint32_t matchLength(const uint8_t *a, const uint8_t *b, uint32_t max)
+{
+    uint32_t len = 0;
+#if defined(FC8_MATCH_SSE2)
+    while (len + 16 <= max)
+    {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + len));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + len));
+        const uint32_t equal = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+        if (equal != 0xFFFF)
+        {
+            return len + countTrailingZeros(~equal);
+        }
+        len += 16;
+    }
+#elif defined(FC8_MATCH_NEON)
+    while (len + 16 <= max)
+    {
+        const uint8x16_t equal = vceqq_u8(vld1q_u8(a + len), vld1q_u8(b + len));
+        // Squeeze each 16-bit pair of results down to 8 bits so the whole thing
+        // fits in 64 bits, 4 bits per byte
+        const uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(
+                                     vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+        if (nibbles != ~static_cast<uint64_t>(0))
+        {
+            // First zero nibble is the first byte that's different
+            uint32_t i = 0;
+            while ((nibbles >> (i * 4)) & 0xF)
+            {
+                i++;
+            }
+            return len + i;
+        }
+        len += 16;
+    }
+#endif
+    while (len < max && a[len] == b[len])
+    {
+        len++;
+    }
+    return len;
+}
+
+static inline uint32_t hashAt(const uint8_t *p)
+{
+    const uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761U) >> (32 - FC8_HASH_BITS);
+}
+
+// The BR2 length code for the longest BR2 that's no longer than length
+static inline uint32_t br2LengthCode(uint32_t length)
+{
+    uint32_t code = FC8_BR2_LENGTH_CODES - 1;
+    while (fc8BR2Lengths[code] > length)
+    {
+        code--;
+    }
+    return code;
+}
+
+// What the token that starts a match costs in the output, in bytes
+static inline uint32_t matchCost(uint32_t length, uint32_t distance)
+{
+    if (distance <= FC8_BR0_MAX_DISTANCE && length <= FC8_BR0_MAX_LENGTH)
+    {
+        return 1;
+    }
+    if (distance <= FC8_BR1_MAX_DISTANCE && length <= FC8_BR1_MAX_LENGTH)
+    {
+        return 2;
+    }
+    return 3;
+}
+
+static bool emitLiterals(const uint8_t *literals, uint32_t count, uint8_t *out, uint32_t &outPos, uint32_t outLen)
+{
+    while (count > 0)
+    {
+        const uint32_t run = count > FC8_MAX_LITERAL_RUN ? FC8_MAX_LITERAL_RUN : count;
+        if (outPos + 1 + run > outLen)
+        {
+            return false;
+        }
+        out[outPos++] = static_cast<uint8_t>(FC8_TOKEN_LIT | (run - 1));
+        memcpy(out + outPos, literals, run);
+        outPos += run;
+        literals += run;
+        count -= run;
+    }
+    return true;
+}
+
+// Writes the token that starts a match, and returns how much of it that token
+// covers (0 if it didn't fit)
+static uint32_t emitMatch(uint32_t length, uint32_t distance, uint8_t *out, uint32_t &outPos, uint32_t outLen)
+{
+    const uint32_t cost = matchCost(length, distance);
+    if (outPos + cost > outLen)
+    {
+        return 0;
+    }
+
+    if (cost == 1)
+    {
+        out[outPos++] = static_cast<uint8_t>(FC8_TOKEN_BR0 | ((length - FC8_MIN_MATCH) << 5) | distance);
+        return length;
+    }
+    if (cost == 2)
+    {
+        out[outPos++] = static_cast<uint8_t>(FC8_TOKEN_BR1 | ((length - FC8_MIN_MATCH) << 3) | (distance >> 8));
+        out[outPos++] = static_cast<uint8_t>(distance);
+        return length;
+    }
+
+    const uint32_t code = br2LengthCode(length);
+    out[outPos++] = static_cast<uint8_t>(FC8_TOKEN_BR2 | (code << 1) | (distance >> 16));
+    out[outPos++] = static_cast<uint8_t>(distance >> 8);
+    out[outPos++] = static_cast<uint8_t>(distance);
+    return fc8BR2Lengths[code];
+}
+
+FC8FastEncoder::FC8FastEncoder(FC8EncoderEffort effort) :
+    head(FC8_HASH_SIZE),
+    chain(FC8_WINDOW_SIZE)
+{
+    switch (effort)
+    {
+    case FC8EffortFast:
+        maxChainDepth = 4;
+        lazyMatching = false;
+        break;
+    case FC8EffortNormal:
+    default:
+        maxChainDepth = 32;
+        lazyMatching = true;
+        break;
+    case FC8EffortMax:
+        maxChainDepth = 1024;
+        lazyMatching = true;
+        break;
+    }
+}
+
+QString FC8FastEncoder::effortName(FC8EncoderEffort effort)
+{
+    switch (effort)
+    {
+    case FC8EffortFast:
+        return "fast";
+    case FC8EffortNormal:
+    default:
+        return "normal";
+    case FC8EffortMax:
+        return "max";
+    }
+}
+
+void FC8FastEncoder::insert(const uint8_t *in, uint32_t pos)
+{
+    const uint32_t h = hashAt(in + pos);
+    chain[pos & FC8_WINDOW_MASK] = head[h];
+    head[h] = static_cast<int32_t>(pos);
+}
+
+uint32_t FC8FastEncoder::findMatch(const uint8_t *in, uint32_t pos, uint32_t inLen, uint32_t &distance) const
+{
+    if (pos + FC8_MIN_MATCH > inLen)
+    {
+        return 0;
+    }
+
+    const uint32_t maxLen = inLen - pos < FC8_MAX_MATCH ? inLen - pos : FC8_MAX_MATCH;
+    uint32_t best = 0;
+    int32_t candidate = head[hashAt(in + pos)];
+    for (int depth = maxChainDepth; candidate >= 0 && depth > 0; depth--)
+    {
+        const uint32_t d = pos - static_cast<uint32_t>(candidate);
+        if (d > FC8_BR2_MAX_DISTANCE)
+        {
+            // Everything further down the chain is even further away
+            break;
+        }
+
+        // Nearer candidates come first, so only something longer is better. Checking
+        // the byte that would make it longer weeds most of them out right away.
+        if (in[candidate + best] == in[pos + best])
+        {
+            const uint32_t len = matchLength(in + candidate, in + pos, maxLen);
+            if (len > best && (len > FC8_MIN_MATCH || d <= FC8_BR1_MAX_DISTANCE))
+            {
+                best = len;
+                distance = d;
+                if (len == maxLen)
+                {
+                    break;
+                }
+            }
+        }
+
+        candidate = chain[candidate & FC8_WINDOW_MASK];
+    }
+
+    return best >= FC8_MIN_MATCH ? best : 0;
+}
+
+uint32_t FC8FastEncoder::encode(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen)
+{
+    if (outLen < FC8_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    out[0] = 'F';
+    out[1] = 'C';
+    out[2] = '8';
+    out[3] = '_';
+    out[FC8_DECODED_SIZE_OFFSET + 0] = static_cast<uint8_t>(inLen >> 24);
+    out[FC8_DECODED_SIZE_OFFSET + 1] = static_cast<uint8_t>(inLen >> 16);
+    out[FC8_DECODED_SIZE_OFFSET + 2] = static_cast<uint8_t>(inLen >> 8);
+    out[FC8_DECODED_SIZE_OFFSET + 3] = static_cast<uint8_t>(inLen >> 0);
+    uint32_t outPos = FC8_HEADER_SIZE;
+
+    head.fill(-1);
+
+    uint32_t pos = 0;
+    uint32_t literalStart = 0;
+    // Everything before this is in the hash chains
+    uint32_t nextInsert = 0;
+    while (pos + FC8_MIN_MATCH <= inLen)
+    {
+        uint32_t distance = 0;
+        uint32_t length = findMatch(in, pos, inLen, distance);
+        if (length == 0)
+        {
+            insert(in, pos);
+            nextInsert = ++pos;
+            continue;
+        }
+
+        // If starting one byte later gets us a longer match, that's usually a better deal
+        while (lazyMatching && length < FC8_LAZY_GOOD_ENOUGH)
+        {
+            insert(in, pos);
+            nextInsert = pos + 1;
+            uint32_t nextDistance = 0;
+            const uint32_t nextLength = findMatch(in, pos + 1, inLen, nextDistance);
+            if (nextLength <= length ||
+                nextLength - matchCost(nextLength, nextDistance) <= length - matchCost(length, distance))
+            {
+                break;
+            }
+            pos++;
+            length = nextLength;
+            distance = nextDistance;
+        }
+
+        if (!emitLiterals(in + literalStart, pos - literalStart, out, outPos, outLen))
+        {
+            return 0;
+        }
+        const uint32_t covered = emitMatch(length, distance, out, outPos, outLen);
+        if (covered == 0)
+        {
+            return 0;
+        }
+
+        pos += covered;
+        literalStart = pos;
+        const uint32_t insertEnd = pos + FC8_MIN_MATCH <= inLen ? pos : inLen - FC8_MIN_MATCH + 1;
+        while (nextInsert < insertEnd)
+        {
+            insert(in, nextInsert++);
+        }
+    }
+
+    if (!emitLiterals(in + literalStart, inLen - literalStart, out, outPos, outLen) ||
+        outPos + 1 > outLen)
+    {
+        return 0;
+    }
+    out[outPos++] = FC8_TOKEN_EOF;
+
+    return outPos;
+}
+
+static uint8_t nextTestByte(uint32_t &seed)
+{
+    seed = seed * 1103515245U + 12345U;
+    return static_cast<uint8_t>(seed >> 16);
+}
+
+// Puts together a stream by hand with every kind of token in it: literal runs of
+// every length, BR0 and BR1 at all of their lengths, a BR2 with every length
+// code, distances that use every distance bit, and copies that overlap what
+// they're writing. Works out what it should decode to along the way, and checks
+// that the reference decoder gets the same thing.
+static bool tokenLayoutMatchesReference()
+{
+    // Way more than it needs, and anything after EOF is more EOFs, so a decoder
+    // that reads tokens differently still stops before the end
+    QByteArray stream(1024 * 1024, static_cast<char>(FC8_TOKEN_EOF));
+    uint8_t *out = reinterpret_cast<uint8_t *>(stream.data());
+    const uint32_t outLen = stream.length() - FC8_MAX_LITERAL_RUN;
+    uint32_t outPos = FC8_HEADER_SIZE;
+    QByteArray expected;
+    int tokens = 0;
+    uint32_t seed = 1;
+    bool ok = true;
+
+    // Enough random literals for the longest distance to point at
+    for (uint32_t run = 1; expected.length() <= FC8_BR2_MAX_DISTANCE; run = run % FC8_MAX_LITERAL_RUN + 1)
+    {
+        QByteArray literals(run, static_cast<char>(0));
+        for (uint32_t x = 0; x < run; x++)
+        {
+            literals[x] = nextTestByte(seed);
+        }
+        ok = ok && emitLiterals(reinterpret_cast<const uint8_t *>(literals.constData()), run, out, outPos, outLen);
+        expected.append(literals);
+        tokens++;
+    }
+
+    QList<QPair<uint32_t, uint32_t> > matches;
+    for (uint32_t distance = 1; distance <= FC8_BR0_MAX_DISTANCE; distance++)
+    {
+        for (uint32_t length = FC8_MIN_MATCH; length <= FC8_BR1_MAX_LENGTH; length++)
+        {
+            matches.append(qMakePair(length, distance));
+        }
+    }
+    const uint32_t br1Distances[] = {32, 255, 256, 1024, FC8_BR1_MAX_DISTANCE};
+    for (size_t x = 0; x < sizeof(br1Distances) / sizeof(br1Distances[0]); x++)
+    {
+        for (uint32_t length = FC8_MIN_MATCH; length <= FC8_BR1_MAX_LENGTH; length++)
+        {
+            matches.append(qMakePair(length, br1Distances[x]));
+        }
+    }
+    const uint32_t br2Distances[] = {1, FC8_BR1_MAX_DISTANCE + 1, 65535, 65536, FC8_BR2_MAX_DISTANCE};
+    for (size_t x = 0; x < sizeof(br2Distances) / sizeof(br2Distances[0]); x++)
+    {
+        for (int code = 0; code < FC8_BR2_LENGTH_CODES; code++)
+        {
+            matches.append(qMakePair(static_cast<uint32_t>(fc8BR2Lengths[code]), br2Distances[x]));
+        }
+    }
+
+    for (int x = 0; ok && x < matches.count(); x++)
+    {
+        const uint32_t length = matches[x].first;
+        const uint32_t distance = matches[x].second;
+        ok = emitMatch(length, distance, out, outPos, outLen) == length;
+        for (uint32_t y = 0; y < length; y++)
+        {
+            expected.append(expected.at(expected.length() - distance));
+        }
+
+        // A literal in between, so one copy running into the next would show
+        const uint8_t literal = nextTestByte(seed);
+        ok = ok && emitLiterals(&literal, 1, out, outPos, outLen);
+        expected.append(static_cast<char>(literal));
+        tokens += 2;
+    }
+
+    if (!ok || outPos + 1 > outLen)
+    {
+        return false;
+    }
+    out[outPos++] = FC8_TOKEN_EOF;
+
+    const uint32_t decodedSize = expected.length();
+    out[0] = 'F';
+    out[1] = 'C';
+    out[2] = '8';
+    out[3] = '_';
+    out[FC8_DECODED_SIZE_OFFSET + 0] = static_cast<uint8_t>(decodedSize >> 24);
+    out[FC8_DECODED_SIZE_OFFSET + 1] = static_cast<uint8_t>(decodedSize >> 16);
+    out[FC8_DECODED_SIZE_OFFSET + 2] = static_cast<uint8_t>(decodedSize >> 8);
+    out[FC8_DECODED_SIZE_OFFSET + 3] = static_cast<uint8_t>(decodedSize >> 0);
+
+    // Room for every token to come out as long as any token can be, in case the
+    // decoder sees them differently
+    QByteArray decoded(decodedSize + tokens * FC8_MAX_MATCH, static_cast<char>(0));
+    const uint32_t len = fc8::Decode(reinterpret_cast<const uint8_t *>(stream.constData()),
+                                     reinterpret_cast<uint8_t *>(decoded.data()), decodedSize);
+    return len == decodedSize && decoded.left(decodedSize) == expected;
+}
+
+bool FC8FastEncoder::matchesReferenceDecoder()
+{
+    // 0 if it hasn't been checked yet, 1 if it matches, 2 if it doesn't
+    static QAtomicInt result(0);
+    static QMutex mutex;
+
+    if (result.loadAcquire() == 0)
+    {
+        QMutexLocker locker(&mutex);
+        if (result.loadAcquire() == 0)
+        {
+            const bool matches = tokenLayoutMatchesReference();
+            if (!matches)
+            {
+                qWarning() << "Fast FC8 encoder's token layout doesn't match the reference decoder; "
+                              "using the reference encoder instead";
+            }
+            result.storeRelease(matches ? 1 : 2);
+        }
+    }
+    return result.loadAcquire() == 1;
+}
@@ -0,0 +1,57 @@
+#ifndef FC8FASTENCODER_H
+#define FC8FASTENCODER_H
+
+#include <QString>
+#include <QVector>
+#include <stdint.h>
+
+// How hard the encoder looks for matches. More effort means a smaller result,
+// but it takes longer.
+typedef enum FC8EncoderEffort
+{
+    FC8EffortFast,
+    FC8EffortNormal,
+    FC8EffortMax
+} FC8EncoderEffort;
+
+// An FC8 encoder that's a lot quicker than the reference one on big disk images.
+// It keeps hash chains of every 3-byte sequence within reach of a back reference
+// and only walks as far down them as the effort level allows, and match lengths
+// are measured 16 bytes at a time with SSE2/NEON where available.
+//
+// Output is a complete FC8 stream (header included, EOF token on the end), same
+// as fc8::Encode, with the token layout in fc8format.h. Since the 68k decompressor
+// is what ultimately has to read it, FC8Compressor only uses it once
+// matchesReferenceDecoder() says the layout is right, and still decodes every
+// block it produces with the reference decoder before using it. A block that
+// doesn't come back out the same is compressed with the reference encoder, but
+// that should never actually happen.
+//
+// An encoder can be reused for any number of inputs, but only from one thread
+// at a time.
+class FC8FastEncoder
+{
+public:
+    explicit FC8FastEncoder(FC8EncoderEffort effort = FC8EffortNormal);
+
+    // Returns the compressed length, or 0 if it didn't fit in outLen
+    uint32_t encode(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen);
+
+    static QString effortName(FC8EncoderEffort effort);
+
+    // Whether the reference decoder reads a stream with every kind of token in it
+    // the same way this encoder means it. It's only actually checked the first
+    // time.
+    static bool matchesReferenceDecoder();
+
+private:
+    uint32_t findMatch(const uint8_t *in, uint32_t pos, uint32_t inLen, uint32_t &distance) const;
+    void insert(const uint8_t *in, uint32_t pos);
+
+    int maxChainDepth;
+    bool lazyMatching;
+    QVector<int32_t> head;
+    QVector<int32_t> chain;
+};
+
+#endif // FC8FASTENCODER_H
@@ -0,0 +1,44 @@
+#ifndef FC8FORMAT_H
+#define FC8FORMAT_H
+
+#include <stdint.h>
+
+// The FC8 token stream, as fc8-compression writes it and its decoders (including
+// the 68k one the ROM disk driver uses) read it. After the 8 byte header, it's:
+//
+//   00aaaaaa                       LIT: the next a+1 bytes are literals
+//   01baaaaa                       BR0: back reference, distance a, length b+3
+//   01x00000                       EOF: end of the stream
+//   10bbbaaa aaaaaaaa              BR1: distance a, length b+3
+//   11bbbbba aaaaaaaa aaaaaaaa     BR2: distance a, length fc8BR2Lengths[b]
+//
+// Distances count back from the next byte to be written, so 1 is the byte just
+// before it, and a copy can run into what it's writing. A BR0 distance of 0 is
+// what makes it EOF instead. Every stream has to end with EOF, because the
+// decoders don't know how long the compressed data is.
+#define FC8_TOKEN_TYPE_MASK         0xC0
+#define FC8_TOKEN_LIT               0x00
+#define FC8_TOKEN_BR0               0x40
+#define FC8_TOKEN_BR1               0x80
+#define FC8_TOKEN_BR2               0xC0
+#define FC8_TOKEN_EOF               0x40
+
+#define FC8_MIN_MATCH               3
+#define FC8_MAX_MATCH               256
+#define FC8_MAX_LITERAL_RUN         64
+#define FC8_BR0_MAX_DISTANCE        31
+#define FC8_BR0_MAX_LENGTH          4
+#define FC8_BR1_MAX_DISTANCE        2047
+#define FC8_BR1_MAX_LENGTH          10
+#define FC8_BR2_MAX_DISTANCE        131071
+#define FC8_BR2_LENGTH_CODES        32
+
+// The only lengths a BR2 can have. A longer match than one of these takes more
+// than one token.
+static const uint16_t fc8BR2Lengths[FC8_BR2_LENGTH_CODES] =
+{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 35, 48, 72, 128, 256
+};
+
+#endif // FC8FORMAT_H
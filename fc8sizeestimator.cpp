@@ -0,0 +1,212 @@
+#include "fc8sizeestimator.h"
+#include "fc8compressor.h"
+#include "hfsscrubber.h"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <math.h>
+#include <string.h>
+namespace fc8 {
+extern "C" {
+#include "3rdparty/fc8-compression/fc8.h"
+}
+}
+
+// How many blocks that aren't just zeros get compressed. With 64 KB blocks, that's
+// a quarter of an 8 MB image, and it's all done in one pass through the thread pool.
+#define ESTIMATOR_SAMPLE_BLOCKS     32
+
+// How many standard errors either side of the estimate the bounds are
+#define ESTIMATOR_BOUNDS_Z          1.96
+
+static bool isZeroBlock(QByteArray const &data, int index, int blockSize)
+{
+    static const char zeros[4096] = {0};
+    const int start = index * blockSize;
+    const int end = qMin(start + blockSize, data.length());
+    for (int pos = start; pos < end; pos += sizeof(zeros))
+    {
+        const int len = qMin(static_cast<int>(sizeof(zeros)), end - pos);
+        if (memcmp(data.constData() + pos, zeros, len) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+FC8SizeEstimator::FC8SizeEstimator(FC8BlockCache *blockCache, QObject *parent) :
+    QObject(parent),
+    blockCache(blockCache),
+    cancelled(true)
+{
+    connect(&preparationWatcher, SIGNAL(finished()), SLOT(preparationFinished()));
+    connect(&compressionWatcher, SIGNAL(finished()), SLOT(compressionFinished()));
+}
+
+FC8SizeEstimator::~FC8SizeEstimator()
+{
+    cancel();
+}
+
+void FC8SizeEstimator::start(QByteArray const &uncompressedImage, QByteArray const &hash)
+{
+    // Once is enough, even if it didn't work out; the background compressor
+    // will say why
+    if (hash == this->hash && !cancelled)
+    {
+        return;
+    }
+    cancel();
+
+    this->hash = hash;
+    prepared = Prepared();
+    result = Estimate();
+    cancelled = false;
+    cancelRequested.storeRelease(0);
+
+    // Scrubbing and looking for zero blocks means going through the whole image,
+    // so that's done on a worker thread too
+    preparationWatcher.setFuture(QtConcurrent::run(&FC8SizeEstimator::prepare, uncompressedImage, hash, &cancelRequested));
+}
+
+void FC8SizeEstimator::cancel()
+{
+    // Same as the background compressor: the cache has to outlive anything that's
+    // still running, and so does the cancel flag
+    cancelled = true;
+    cancelRequested.storeRelease(1);
+    compressionWatcher.cancel();
+    preparationWatcher.waitForFinished();
+    compressionWatcher.waitForFinished();
+}
+
+// Runs on a worker thread, so it only uses what it's given
+FC8SizeEstimator::Prepared FC8SizeEstimator::prepare(QByteArray uncompressedImage, QByteArray hash, QAtomicInt *cancelFlag)
+{
+    Prepared p;
+
+    // It has to be the same scrubbed image, in the same size blocks, that will
+    // really be compressed
+    const int blockSize = FC8_ROM_DISK_BLOCK_SIZE;
+    p.image = HFSScrubber::scrub(uncompressedImage, &p.reclaimed);
+    if (cancelFlag->loadAcquire())
+    {
+        return p;
+    }
+
+    QVector<int> nonZero;
+    const QVector<int> blockIndexes = FC8Compressor::blockIndexList(p.image.length(), blockSize);
+    foreach (int index, blockIndexes)
+    {
+        if (isZeroBlock(p.image, index, blockSize))
+        {
+            p.zeroBlocks++;
+            p.zeroSampleIndex = index;
+        }
+        else
+        {
+            nonZero.append(index);
+        }
+    }
+    p.nonZeroBlocks = nonZero.count();
+    p.totalBlocks = blockIndexes.count();
+
+    // One block from each stretch. The "random" choice is seeded from the hash, so
+    // the same image always gets the same estimate.
+    const int strata = qMin(p.nonZeroBlocks, ESTIMATOR_SAMPLE_BLOCKS);
+    uint32_t random = 2166136261U;
+    for (int i = 0; i < hash.length(); i++)
+    {
+        random = (random ^ static_cast<uint8_t>(hash[i])) * 16777619U;
+    }
+    for (int i = 0; i < strata; i++)
+    {
+        const int first = static_cast<int>(static_cast<qint64>(p.nonZeroBlocks) * i / strata);
+        const int last = static_cast<int>(static_cast<qint64>(p.nonZeroBlocks) * (i + 1) / strata);
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        p.sample.append(nonZero[first + static_cast<int>(random % static_cast<uint32_t>(last - first))]);
+    }
+    if (p.zeroSampleIndex >= 0)
+    {
+        p.sample.append(p.zeroSampleIndex);
+    }
+
+    return p;
+}
+
+void FC8SizeEstimator::preparationFinished()
+{
+    if (cancelRequested.loadAcquire())
+    {
+        return;
+    }
+
+    prepared = preparationWatcher.result();
+    result.blockSize = FC8_ROM_DISK_BLOCK_SIZE;
+    result.totalBlocks = prepared.totalBlocks;
+    compressionWatcher.setFuture(QtConcurrent::mapped(prepared.sample,
+            FC8Compressor::BlockCompressor(prepared.image, FC8_ROM_DISK_BLOCK_SIZE, blockCache)));
+}
+
+void FC8SizeEstimator::compressionFinished()
+{
+    if (compressionWatcher.isCanceled())
+    {
+        return;
+    }
+
+    const QList<QByteArray> blocks = compressionWatcher.future().results();
+    const int sampled = prepared.zeroSampleIndex >= 0 ? blocks.count() - 1 : blocks.count();
+    for (int i = 0; i < blocks.count(); i++)
+    {
+        if (blocks[i].isEmpty())
+        {
+            // If it can't even compress these, the real thing will say so
+            emit finished();
+            return;
+        }
+    }
+
+    // Mean and variance of the compressed sizes of the blocks that aren't zeros
+    double mean = 0;
+    double variance = 0;
+    for (int i = 0; i < sampled; i++)
+    {
+        mean += blocks[i].length();
+    }
+    if (sampled > 0)
+    {
+        mean /= sampled;
+    }
+    for (int i = 0; i < sampled; i++)
+    {
+        variance += (blocks[i].length() - mean) * (blocks[i].length() - mean);
+    }
+    if (sampled > 1)
+    {
+        variance /= sampled - 1;
+    }
+
+    // Since a sizable part of the image gets sampled, the finite population
+    // correction tightens things up quite a bit (and makes it exact when
+    // everything was sampled)
+    double error = 0;
+    const int nonZeroBlocks = prepared.nonZeroBlocks;
+    if (sampled > 0 && nonZeroBlocks > 1)
+    {
+        error = ESTIMATOR_BOUNDS_Z * nonZeroBlocks * sqrt(variance / sampled) *
+                sqrt(static_cast<double>(nonZeroBlocks - sampled) / (nonZeroBlocks - 1));
+    }
+
+    const qint64 fixed = FC8_BLOCK_HEADER_SIZE + 4 * static_cast<qint64>(result.totalBlocks) +
+            (prepared.zeroSampleIndex >= 0 ? static_cast<qint64>(prepared.zeroBlocks) * blocks.last().length() : 0);
+    const double expectedNonZero = mean * nonZeroBlocks;
+    result.expectedSize = fixed + static_cast<qint64>(expectedNonZero + 0.5);
+    result.lowSize = fixed + static_cast<qint64>(qMax(0.0, expectedNonZero - error));
+    result.highSize = fixed + static_cast<qint64>(ceil(expectedNonZero + error));
+    result.sampledBlocks = blocks.count();
+    result.valid = true;
+    emit finished();
+}
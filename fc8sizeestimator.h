@@ -0,0 +1,89 @@
+#ifndef FC8SIZEESTIMATOR_H
+#define FC8SIZEESTIMATOR_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QVector>
+#include <QAtomicInt>
+#include "fc8blockcache.h"
+
+// Compressing a whole disk image takes a few seconds; this gets a good idea of how
+// big it'll be in a fraction of that. Blocks that are entirely zero all compress
+// the same, so one of them is enough. The rest are split into even stretches of
+// the image and a block is picked at random from each one, and the average of
+// those is scaled up to the whole image, along with bounds that the real size
+// should fall within about 95% of the time.
+//
+// Everything it compresses goes into the block cache, so it's not wasted work
+// when the whole image is compressed. So does the scrubbed copy of the image it
+// makes along the way, for whoever compresses the whole thing.
+class FC8SizeEstimator : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Estimate
+    {
+        Estimate() : valid(false), blockSize(0), expectedSize(0), lowSize(0), highSize(0),
+            sampledBlocks(0), totalBlocks(0) {}
+
+        bool valid;
+        int blockSize;
+        qint64 expectedSize;
+        qint64 lowSize;
+        qint64 highSize;
+        int sampledBlocks;
+        int totalBlocks;
+    };
+
+    explicit FC8SizeEstimator(FC8BlockCache *blockCache, QObject *parent = NULL);
+    ~FC8SizeEstimator();
+
+    // Does nothing if this image has already been (or is being) estimated
+    void start(QByteArray const &uncompressedImage, QByteArray const &hash);
+    void cancel();
+    bool isRunning() const { return preparationWatcher.isRunning() || compressionWatcher.isRunning(); }
+
+    QByteArray hashOfImage() const { return hash; }
+    Estimate estimate() const { return result; }
+
+    // The image with its free space scrubbed, the same as ROMBuilder would do it,
+    // and how much of that free space wasn't zero. Only there once it's finished.
+    QByteArray scrubbedImage() const { return prepared.image; }
+    qint64 reclaimedBytes() const { return prepared.reclaimed; }
+
+signals:
+    void finished();
+
+private slots:
+    void preparationFinished();
+    void compressionFinished();
+
+private:
+    struct Prepared
+    {
+        Prepared() : reclaimed(0), zeroBlocks(0), zeroSampleIndex(-1), nonZeroBlocks(0), totalBlocks(0) {}
+
+        QByteArray image;
+        qint64 reclaimed;
+        QVector<int> sample;
+        int zeroBlocks;
+        int zeroSampleIndex;
+        int nonZeroBlocks;
+        int totalBlocks;
+    };
+
+    static Prepared prepare(QByteArray uncompressedImage, QByteArray hash, QAtomicInt *cancelFlag);
+
+    FC8BlockCache *blockCache;
+    QFutureWatcher<Prepared> preparationWatcher;
+    QFutureWatcher<QByteArray> compressionWatcher;
+    QAtomicInt cancelRequested;
+    QByteArray hash;
+    Prepared prepared;
+    // Whether the last start() was cancelled (or there hasn't been one)
+    bool cancelled;
+    Estimate result;
+};
+
+#endif // FC8SIZEESTIMATOR_H
@@ -0,0 +1,215 @@
+#include "fc8streamcompressor.h"
+#include "fc8compressor.h"
+#include <QBuffer>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+namespace fc8 {
+extern "C" {
+#include "3rdparty/fc8-compression/fc8.h"
+}
+}
+
+// The block is the compressor's whole data, so it's always index 0
+static QByteArray compressBlock(FC8Compressor::BlockCompressor compressor)
+{
+    return compressor(0);
+}
+
+FC8StreamCompressor::FC8StreamCompressor(QIODevice *sink, int blockSize, FC8BlockCache *cache,
+                                         FC8EncoderEffort effort, int maxBlocksInFlight) :
+    sink(sink),
+    blockSize(blockSize),
+    cache(cache),
+    effort(effort),
+    maxInFlight(maxBlocksInFlight),
+    start(0),
+    written(0),
+    numBlocks(0),
+    blocksAdded(0),
+    blocksWritten(0)
+{
+    if (maxInFlight <= 0)
+    {
+        maxInFlight = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    }
+}
+
+FC8StreamCompressor::~FC8StreamCompressor()
+{
+    // The blocks can't be cancelled, but they're not allowed to outlive the cache
+    while (!pending.isEmpty())
+    {
+        pending.dequeue().waitForFinished();
+    }
+}
+
+bool FC8StreamCompressor::fail(QString const &message)
+{
+    if (error.isEmpty())
+    {
+        error = message;
+    }
+    return false;
+}
+
+bool FC8StreamCompressor::begin(uint32_t decodedSize)
+{
+    if (!sink || sink->isSequential())
+    {
+        return fail("The output has to be seekable so the block table can be filled out.");
+    }
+
+    numBlocks = FC8Compressor::blockIndexList(decodedSize, blockSize).count();
+    blocksAdded = 0;
+    blocksWritten = 0;
+    start = sink->pos();
+
+    const QByteArray header = FC8Compressor::blockModeHeader(decodedSize, blockSize);
+    table = QByteArray(4 * numBlocks, static_cast<char>(0));
+    if (sink->write(header) != header.length() || sink->write(table) != table.length())
+    {
+        return fail("Unable to write the compressed image: " + sink->errorString());
+    }
+    written = header.length() + table.length();
+    return true;
+}
+
+bool FC8StreamCompressor::addBlock(QByteArray const &block)
+{
+    if (!error.isEmpty())
+    {
+        return false;
+    }
+    if (blocksAdded >= numBlocks || block.length() > blockSize ||
+        (block.length() < blockSize && blocksAdded != numBlocks - 1))
+    {
+        return fail("The disk image isn't the size it was supposed to be.");
+    }
+
+    pending.enqueue(QtConcurrent::run(compressBlock, FC8Compressor::BlockCompressor(block, blockSize, cache, effort)));
+    blocksAdded++;
+
+    // Only keep so many going at once; the oldest one is next to be written anyway
+    while (pending.count() >= maxInFlight)
+    {
+        if (!writeOldestBlock())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FC8StreamCompressor::addCompressedBlock(QByteArray const &compressed)
+{
+    if (!error.isEmpty())
+    {
+        return false;
+    }
+    if (blocksAdded >= numBlocks)
+    {
+        return fail("The disk image isn't the size it was supposed to be.");
+    }
+
+    // Everything before it has to be written first
+    while (!pending.isEmpty())
+    {
+        if (!writeOldestBlock())
+        {
+            return false;
+        }
+    }
+    blocksAdded++;
+    return writeBlock(compressed);
+}
+
+bool FC8StreamCompressor::writeOldestBlock()
+{
+    return writeBlock(pending.dequeue().result());
+}
+
+bool FC8StreamCompressor::writeBlock(QByteArray const &compressed)
+{
+    if (compressed.isEmpty())
+    {
+        return fail("Unable to compress the disk image.");
+    }
+
+    // Offsets in the table count from the start of the compressed image
+    if (written + compressed.length() > 0xFFFFFFFFLL)
+    {
+        return fail("The compressed disk image is too big.");
+    }
+    table[4 * blocksWritten + 0] = (written >> 24) & 0xFF;
+    table[4 * blocksWritten + 1] = (written >> 16) & 0xFF;
+    table[4 * blocksWritten + 2] = (written >> 8) & 0xFF;
+    table[4 * blocksWritten + 3] = (written >> 0) & 0xFF;
+    blocksWritten++;
+
+    if (sink->write(compressed) != compressed.length())
+    {
+        return fail("Unable to write the compressed image: " + sink->errorString());
+    }
+    written += compressed.length();
+    return true;
+}
+
+bool FC8StreamCompressor::finish()
+{
+    while (!pending.isEmpty())
+    {
+        if (!writeOldestBlock())
+        {
+            return false;
+        }
+    }
+    if (!error.isEmpty())
+    {
+        return false;
+    }
+    if (blocksWritten != numBlocks)
+    {
+        return fail("The disk image isn't the size it was supposed to be.");
+    }
+
+    // Now that every block's position is known, go back and fill out the table
+    const qint64 end = sink->pos();
+    if (!sink->seek(start + FC8_BLOCK_HEADER_SIZE) ||
+        sink->write(table) != table.length() ||
+        !sink->seek(end))
+    {
+        return fail("Unable to write the compressed image: " + sink->errorString());
+    }
+    return true;
+}
+
+QByteArray FC8StreamCompressor::assemble(QList<QByteArray> const &blocks, uint32_t decodedSize, int blockSize)
+{
+    // It's all going into memory, so make room for it all at once
+    qint64 totalLength = FC8_BLOCK_HEADER_SIZE + 4 * static_cast<qint64>(blocks.count());
+    foreach (QByteArray const &block, blocks)
+    {
+        totalLength += block.length();
+    }
+
+    QByteArray compressedData;
+    if (totalLength > 0x7FFFFFFF)
+    {
+        return compressedData;
+    }
+    compressedData.reserve(totalLength);
+
+    QBuffer sink(&compressedData);
+    sink.open(QBuffer::WriteOnly);
+    FC8StreamCompressor stream(&sink, blockSize);
+    bool ok = stream.begin(decodedSize);
+    for (int i = 0; ok && i < blocks.count(); i++)
+    {
+        ok = stream.addCompressedBlock(blocks[i]);
+    }
+    if (!ok || !stream.finish())
+    {
+        compressedData.clear();
+    }
+    return compressedData;
+}
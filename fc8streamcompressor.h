@@ -0,0 +1,72 @@
+#ifndef FC8STREAMCOMPRESSOR_H
+#define FC8STREAMCOMPRESSOR_H
+
+#include <QIODevice>
+#include <QFuture>
+#include <QQueue>
+#include "fc8blockcache.h"
+#include "fc8fastencoder.h"
+
+// Block mode FC8 compression that, fed through addBlock(), never has more than a
+// few blocks in memory. Blocks go in one at a time and are compressed in the thread pool, a handful at
+// once; as each one is done (in order), it's written straight to the sink. The
+// block table goes before all of them, so it's written as zeros to start with and
+// filled out in finish(), which means the sink has to be able to seek.
+//
+// Aside from the blocks in flight, all it keeps is 4 bytes per block for the
+// table, no matter how big the image is.
+//
+// addBlock() waits for the oldest block when too many are in flight, so it's only
+// for callers that are on a worker thread already, like the background compressor.
+// ROMBuilder and CompressedImageStream are driven from the GUI thread, and need to
+// be able to show progress, so they run the blocks through QtConcurrent::mapped()
+// themselves and hand the results to assemble(). That keeps every block in memory
+// along with the finished image, so it's nothing like bounded; they're holding on
+// to the whole image anyway, to write it from.
+class FC8StreamCompressor
+{
+public:
+    // With maxBlocksInFlight = 0, it's one per thread in the pool
+    FC8StreamCompressor(QIODevice *sink, int blockSize, FC8BlockCache *cache = NULL,
+                        FC8EncoderEffort effort = FC8EffortNormal, int maxBlocksInFlight = 0);
+    ~FC8StreamCompressor();
+
+    // Writes the header and a blank block table at the sink's current position
+    bool begin(uint32_t decodedSize);
+    // Every block but the last has to be exactly blockSize; the last one is padded
+    bool addBlock(QByteArray const &block);
+    // A block that's already been compressed (by FC8Compressor::BlockCompressor).
+    // It goes after any that are still being compressed.
+    bool addCompressedBlock(QByteArray const &compressed);
+    // Writes whatever's left and fills out the block table. The sink is left at the end.
+    bool finish();
+
+    // A whole compressed image in memory from blocks that have all been compressed
+    // already, or an empty array if any of them failed
+    static QByteArray assemble(QList<QByteArray> const &blocks, uint32_t decodedSize, int blockSize);
+
+    // What's been written so far, including the header and table
+    qint64 compressedSize() const { return written; }
+    QString errorString() const { return error; }
+
+private:
+    bool writeOldestBlock();
+    bool writeBlock(QByteArray const &compressed);
+    bool fail(QString const &message);
+
+    QIODevice *sink;
+    int blockSize;
+    FC8BlockCache *cache;
+    FC8EncoderEffort effort;
+    int maxInFlight;
+    qint64 start;
+    qint64 written;
+    int numBlocks;
+    int blocksAdded;
+    int blocksWritten;
+    QByteArray table;
+    QQueue<QFuture<QByteArray> > pending;
+    QString error;
+};
+
+#endif // FC8STREAMCOMPRESSOR_H
@@ -0,0 +1,115 @@
+#include "filecontentcache.h"
+#include <QFile>
+#include <QFileInfo>
+
+FileContentCache::FileContentCache(int maxFiles, QObject *parent) :
+    QObject(parent),
+    maxFiles(maxFiles)
+{
+    connect(&watcher, SIGNAL(fileChanged(QString)), SLOT(watchedFileChanged(QString)));
+}
+
+QByteArray FileContentCache::contents(QString const &path, bool *ok)
+{
+    if (ok) *ok = false;
+
+    QFileInfo fi(path);
+    if (path.isEmpty() || !fi.exists() || !fi.isFile())
+    {
+        invalidate(path);
+        return QByteArray();
+    }
+
+    // The watcher should have caught any changes, but it doesn't hurt to double
+    // check; it's just a stat() and not every file system supports watching.
+    const QString key = fi.absoluteFilePath();
+    QHash<QString, Entry>::const_iterator it = entries.constFind(key);
+    if (it != entries.constEnd() && it->size == fi.size() && it->modified == fi.lastModified())
+    {
+        recentlyUsed.removeOne(key);
+        recentlyUsed.prepend(key);
+        if (ok) *ok = true;
+        return it->data;
+    }
+
+    Entry e;
+    e.size = fi.size();
+    e.modified = fi.lastModified();
+    if (!readFile(key, e.size, e.data))
+    {
+        invalidate(key);
+        return QByteArray();
+    }
+
+    entries.insert(key, e);
+    recentlyUsed.removeOne(key);
+    recentlyUsed.prepend(key);
+    while (recentlyUsed.count() > maxFiles)
+    {
+        invalidate(recentlyUsed.last());
+    }
+
+    // Files that get replaced rather than rewritten drop off the watcher, so this
+    // also puts them back.
+    if (!watcher.files().contains(key))
+    {
+        watcher.addPath(key);
+    }
+
+    if (ok) *ok = true;
+    return e.data;
+}
+
+bool FileContentCache::readFile(QString const &path, qint64 size, QByteArray &data)
+{
+    QFile f(path);
+    if (!f.open(QFile::ReadOnly))
+    {
+        return false;
+    }
+
+    // Mapping the file lets it be copied in one go with no intermediate buffering.
+    // The cache keeps its own copy rather than handing out the mapping itself,
+    // because the file might be truncated or rewritten while someone (like a
+    // background compressor) is still looking at the data.
+    if (size > 0)
+    {
+        uchar *mapped = f.map(0, size);
+        if (mapped)
+        {
+            data = QByteArray(reinterpret_cast<const char *>(mapped), static_cast<int>(size));
+            f.unmap(mapped);
+            return true;
+        }
+    }
+
+    data = f.readAll();
+    return data.size() == size;
+}
+
+void FileContentCache::invalidate(QString const &path)
+{
+    const QString key = path.isEmpty() ? path : QFileInfo(path).absoluteFilePath();
+    entries.remove(key);
+    recentlyUsed.removeOne(key);
+    if (watcher.files().contains(key))
+    {
+        watcher.removePath(key);
+    }
+}
+
+void FileContentCache::clear()
+{
+    entries.clear();
+    recentlyUsed.clear();
+    if (!watcher.files().isEmpty())
+    {
+        watcher.removePaths(watcher.files());
+    }
+}
+
+void FileContentCache::watchedFileChanged(QString const &path)
+{
+    invalidate(path);
+    emit fileChanged(path);
+}
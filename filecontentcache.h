@@ -0,0 +1,52 @@
+#ifndef FILECONTENTCACHE_H
+#define FILECONTENTCACHE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QStringList>
+
+// Keeps the contents of recently used files in memory, so code that wants a whole
+// file over and over (like the ROM creation controls, which look at the base ROM and
+// disk image every time anything changes) doesn't keep reading it from disk. An entry
+// is only used while the file's size and modification time still match, and it's
+// thrown out as soon as the file system watcher says the file changed.
+class FileContentCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileContentCache(int maxFiles = 4, QObject *parent = NULL);
+
+    // The whole file, or an empty array (and ok set to false) if it couldn't be read
+    QByteArray contents(QString const &path, bool *ok = NULL);
+
+    void invalidate(QString const &path);
+    void clear();
+
+signals:
+    // A file that's in the cache was changed (or deleted) on disk
+    void fileChanged(QString const &path);
+
+private slots:
+    void watchedFileChanged(QString const &path);
+
+private:
+    struct Entry
+    {
+        qint64 size;
+        QDateTime modified;
+        QByteArray data;
+    };
+
+    static bool readFile(QString const &path, qint64 size, QByteArray &data);
+
+    int maxFiles;
+    QHash<QString, Entry> entries;
+    QStringList recentlyUsed;       // most recent first
+    QFileSystemWatcher watcher;
+};
+
+#endif // FILECONTENTCACHE_H
@@ -0,0 +1,136 @@
+#include "hfsscrubber.h"
+#include <string.h>
+
+// Where things are in the master directory block, which is always 1024 bytes in
+#define HFS_MDB_OFFSET              1024
+#define HFS_SIGNATURE               0x4244
+#define HFS_SECTOR_SIZE             512
+#define MDB_SIGNATURE               0
+#define MDB_BITMAP_START            14
+#define MDB_NUM_ALLOCATION_BLOCKS   18
+#define MDB_ALLOCATION_BLOCK_SIZE   20
+#define MDB_FIRST_ALLOCATION_BLOCK  28
+#define MDB_FREE_BLOCKS             34
+
+static inline uint16_t readBigEndian16(const uint8_t *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t readBigEndian32(const uint8_t *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+static bool isAllZero(const uint8_t *p, uint32_t len)
+{
+    // Allocation blocks are always a multiple of 512 bytes, so whole words it is
+    uint64_t combined = 0;
+    for (uint32_t i = 0; i < len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        combined |= word;
+        if ((i & 0xFFF) == 0 && combined)
+        {
+            return false;
+        }
+    }
+    return combined == 0;
+}
+
+bool HFSScrubber::findDirtyFreeBlocks(QByteArray const &image, QVector<qint64> &offsets, uint32_t &blockSize)
+{
+    if (image.length() < HFS_MDB_OFFSET + HFS_SECTOR_SIZE)
+    {
+        return false;
+    }
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(image.constData());
+    const uint8_t *mdb = data + HFS_MDB_OFFSET;
+    if (readBigEndian16(mdb + MDB_SIGNATURE) != HFS_SIGNATURE)
+    {
+        return false;
+    }
+
+    const qint64 bitmapStart = static_cast<qint64>(readBigEndian16(mdb + MDB_BITMAP_START)) * HFS_SECTOR_SIZE;
+    const uint32_t numBlocks = readBigEndian16(mdb + MDB_NUM_ALLOCATION_BLOCKS);
+    blockSize = readBigEndian32(mdb + MDB_ALLOCATION_BLOCK_SIZE);
+    const qint64 firstBlock = static_cast<qint64>(readBigEndian16(mdb + MDB_FIRST_ALLOCATION_BLOCK)) * HFS_SECTOR_SIZE;
+    const uint32_t freeBlocks = readBigEndian16(mdb + MDB_FREE_BLOCKS);
+
+    // Everything has to be where it could possibly be in a real volume
+    if (numBlocks == 0 || blockSize == 0 || blockSize % HFS_SECTOR_SIZE ||
+        bitmapStart < HFS_MDB_OFFSET + HFS_SECTOR_SIZE ||
+        bitmapStart + (numBlocks + 7) / 8 > firstBlock ||
+        firstBlock + static_cast<qint64>(numBlocks) * blockSize > image.length())
+    {
+        return false;
+    }
+
+    // If the bitmap and the free count disagree, something's off, and it's not worth
+    // the risk of clearing something that's actually in use
+    const uint8_t *bitmap = data + bitmapStart;
+    uint32_t freeInBitmap = 0;
+    for (uint32_t n = 0; n < numBlocks; n++)
+    {
+        if (!(bitmap[n / 8] & (0x80 >> (n % 8))))
+        {
+            freeInBitmap++;
+        }
+    }
+    if (freeInBitmap != freeBlocks)
+    {
+        return false;
+    }
+
+    for (uint32_t n = 0; n < numBlocks; n++)
+    {
+        const qint64 offset = firstBlock + static_cast<qint64>(n) * blockSize;
+        if (!(bitmap[n / 8] & (0x80 >> (n % 8))) && !isAllZero(data + offset, blockSize))
+        {
+            offsets.append(offset);
+        }
+    }
+    return true;
+}
+
+QByteArray HFSScrubber::scrub(QByteArray const &image, qint64 *reclaimedBytes)
+{
+    if (reclaimedBytes)
+    {
+        *reclaimedBytes = 0;
+    }
+
+    QVector<qint64> offsets;
+    uint32_t blockSize = 0;
+    if (!findDirtyFreeBlocks(image, offsets, blockSize) || offsets.isEmpty())
+    {
+        return image;
+    }
+
+    QByteArray scrubbed = image;
+    uint8_t *out = reinterpret_cast<uint8_t *>(scrubbed.data());
+    foreach (qint64 offset, offsets)
+    {
+        memset(out + offset, 0, blockSize);
+    }
+
+    if (reclaimedBytes)
+    {
+        *reclaimedBytes = static_cast<qint64>(offsets.count()) * blockSize;
+    }
+    return scrubbed;
+}
+
+qint64 HFSScrubber::reclaimableBytes(QByteArray const &image)
+{
+    QVector<qint64> offsets;
+    uint32_t blockSize = 0;
+    if (!findDirtyFreeBlocks(image, offsets, blockSize))
+    {
+        return 0;
+    }
+    return static_cast<qint64>(offsets.count()) * blockSize;
+}
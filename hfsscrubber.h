@@ -0,0 +1,31 @@
+#ifndef HFSSCRUBBER_H
+#define HFSSCRUBBER_H
+
+#include <QByteArray>
+#include <QVector>
+#include <stdint.h>
+
+// Disk images tend to have old, deleted data sitting in the allocation blocks HFS
+// considers free. Nothing will ever read it, but it still takes up room once it's
+// compressed and still takes time to write. This finds the free blocks in the
+// volume bitmap and zeros them out, which compresses down to almost nothing.
+//
+// Anything that doesn't look like a sane HFS volume (including one whose free
+// block count doesn't agree with its bitmap) is left alone.
+class HFSScrubber
+{
+public:
+    // Returns the image with its free space zeroed. If there's nothing to clear,
+    // it's the same data as the original, not a copy. reclaimedBytes is how much
+    // of the free space wasn't already zero.
+    static QByteArray scrub(QByteArray const &image, qint64 *reclaimedBytes = NULL);
+
+    // How much scrub() would clear, without making a copy
+    static qint64 reclaimableBytes(QByteArray const &image);
+
+private:
+    // The offsets of the free allocation blocks that aren't zero yet
+    static bool findDirtyFreeBlocks(QByteArray const &image, QVector<qint64> &offsets, uint32_t &blockSize);
+};
+
+#endif // HFSSCRUBBER_H
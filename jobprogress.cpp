@@ -0,0 +1,272 @@
+#include "jobprogress.h"
+#include <QDebug>
+#include <QStringList>
+
+// 10 updates per second is plenty for a progress bar and a rate readout
+#define PROGRESS_UPDATE_INTERVAL_MS     100
+
+// How much weight each new sample gets in the smoothed instantaneous rate.
+// Lower is smoother but slower to react when the rate actually changes.
+#define INSTANTANEOUS_RATE_SMOOTHING    0.3
+
+JobProgress::JobProgress(QObject *parent) :
+    QObject(parent),
+    jobActive(false),
+    dirty(false),
+    phase(PhaseNone),
+    total(0),
+    completed(0),
+    jobTime(0),
+    lastSampleTime(0),
+    lastSampleBytes(0),
+    instRate(0)
+{
+    for (int x = 0; x < NumPhases; x++)
+    {
+        phaseTimes[x] = -1;
+        phaseBytes[x] = 0;
+    }
+
+    updateTimer.setInterval(PROGRESS_UPDATE_INTERVAL_MS);
+    connect(&updateTimer, SIGNAL(timeout()), SLOT(updateTimerFired()));
+}
+
+void JobProgress::startJob()
+{
+    // -1 means the phase never happened during this job, as opposed to
+    // happening very quickly
+    for (int x = 0; x < NumPhases; x++)
+    {
+        phaseTimes[x] = -1;
+        phaseBytes[x] = 0;
+    }
+
+    jobActive = true;
+    phase = PhaseNone;
+    total = 0;
+    completed = 0;
+    instRate = 0;
+    jobTime = 0;
+    dirty = true;
+    jobTimer.start();
+    updateTimer.start();
+}
+
+void JobProgress::startPhase(Phase newPhase, uint32_t totalBytes)
+{
+    if (!jobActive)
+    {
+        startJob();
+    }
+
+    closeCurrentPhase();
+
+    phase = newPhase;
+    total = totalBytes;
+    completed = 0;
+    lastSampleTime = 0;
+    lastSampleBytes = 0;
+    instRate = 0;
+    dirty = true;
+    phaseTimer.start();
+}
+
+void JobProgress::setCompletedBytes(uint32_t bytes)
+{
+    if (bytes != completed)
+    {
+        completed = bytes;
+        dirty = true;
+    }
+}
+
+void JobProgress::finishJob()
+{
+    if (!jobActive)
+    {
+        return;
+    }
+
+    closeCurrentPhase();
+    phase = PhaseNone;
+    jobActive = false;
+    jobTime = jobTimer.elapsed();
+    updateTimer.stop();
+
+    qDebug() << "Job finished:" << summary();
+    emit jobFinished();
+}
+
+double JobProgress::averageRate() const
+{
+    if (phase == PhaseNone || !phaseTimer.isValid())
+    {
+        return 0;
+    }
+
+    qint64 elapsed = phaseTimer.elapsed();
+    if (elapsed <= 0)
+    {
+        return 0;
+    }
+
+    return completed * 1000.0 / elapsed;
+}
+
+int JobProgress::estimatedSecondsRemaining() const
+{
+    if (total == 0 || completed == 0 || completed >= total)
+    {
+        return -1;
+    }
+
+    // The smoothed instantaneous rate follows slowdowns better than the
+    // average does, but it takes a couple of ticks before it's meaningful.
+    double rate = instRate > 0 ? instRate : averageRate();
+    if (rate <= 0)
+    {
+        return -1;
+    }
+
+    return static_cast<int>((total - completed) / rate + 0.5);
+}
+
+qint64 JobProgress::phaseMilliseconds(Phase p) const
+{
+    if (p <= PhaseNone || p >= NumPhases)
+    {
+        return -1;
+    }
+
+    qint64 result = phaseTimes[p];
+    if (jobActive && p == phase)
+    {
+        // Include the time spent so far in the phase that's still running
+        result = qMax(result, static_cast<qint64>(0)) + phaseTimer.elapsed();
+    }
+    return result;
+}
+
+qint64 JobProgress::jobMilliseconds() const
+{
+    if (!jobActive)
+    {
+        return jobTime;
+    }
+    return jobTimer.elapsed();
+}
+
+QString JobProgress::summary() const
+{
+    QStringList parts;
+    for (int x = PhaseNone + 1; x < NumPhases; x++)
+    {
+        qint64 ms = phaseMilliseconds(static_cast<Phase>(x));
+        if (ms < 0)
+        {
+            continue;
+        }
+
+        QString part = QString("%1 %2").arg(phaseName(static_cast<Phase>(x)), formatDuration(ms));
+        if (phaseBytes[x] > 0 && ms > 0)
+        {
+            part += QString(" (%1)").arg(formatRate(phaseBytes[x] * 1000.0 / ms));
+        }
+        parts << part;
+    }
+
+    return QString("%1; total %2").arg(parts.join(", "), formatDuration(jobMilliseconds()));
+}
+
+QString JobProgress::phaseName(Phase p)
+{
+    switch (p)
+    {
+    case PhaseIdentify:
+        return "identify";
+    case PhaseErase:
+        return "erase";
+    case PhaseWrite:
+        return "write";
+    case PhaseVerify:
+        return "verify";
+    case PhaseRead:
+        return "read";
+    case PhaseFirmwareFlash:
+        return "firmware flash";
+    case PhaseNone:
+    case NumPhases:
+        break;
+    }
+    return QString();
+}
+
+QString JobProgress::formatRate(double bytesPerSecond)
+{
+    // The programmer is usually somewhere in the hundreds of KB/s, so
+    // only switch to MB/s once it's actually that fast.
+    if (bytesPerSecond >= 1024.0 * 1024.0)
+    {
+        return QString("%1 MB/s").arg(bytesPerSecond / (1024.0 * 1024.0), 0, 'f', 2);
+    }
+    return QString("%1 KB/s").arg(bytesPerSecond / 1024.0, 0, 'f', 0);
+}
+
+QString JobProgress::formatDuration(qint64 msecs)
+{
+    if (msecs < 60000)
+    {
+        return QString("%1 s").arg(msecs / 1000.0, 0, 'f', 1);
+    }
+
+    qint64 secs = (msecs + 500) / 1000;
+    return QString("%1:%2").arg(secs / 60).arg(secs % 60, 2, 10, QChar('0'));
+}
+
+void JobProgress::updateTimerFired()
+{
+    if (phase != PhaseNone)
+    {
+        qint64 now = phaseTimer.elapsed();
+        qint64 dt = now - lastSampleTime;
+        if (dt > 0)
+        {
+            double sample = (static_cast<double>(completed) - lastSampleBytes) * 1000.0 / dt;
+            if (sample < 0)
+            {
+                sample = 0;
+            }
+
+            if (instRate <= 0)
+            {
+                instRate = sample;
+            }
+            else
+            {
+                instRate += INSTANTANEOUS_RATE_SMOOTHING * (sample - instRate);
+            }
+
+            lastSampleTime = now;
+            lastSampleBytes = completed;
+        }
+    }
+
+    // During a transfer the rate and ETA change even if the byte count
+    // didn't (e.g. the programmer stalled), so keep listeners up to date.
+    if (dirty || (phase != PhaseNone && total > 0))
+    {
+        dirty = false;
+        emit progressUpdated();
+    }
+}
+
+void JobProgress::closeCurrentPhase()
+{
+    if (phase == PhaseNone)
+    {
+        return;
+    }
+
+    phaseTimes[phase] = qMax(phaseTimes[phase], static_cast<qint64>(0)) + phaseTimer.elapsed();
+    phaseBytes[phase] += completed;
+}
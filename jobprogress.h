@@ -0,0 +1,86 @@
+#ifndef JOBPROGRESS_H
+#define JOBPROGRESS_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QString>
+#include <stdint.h>
+
+// Keeps track of how a programmer job (identify + erase + write + verify, a read,
+// a firmware flash...) is progressing: wall-clock time spent in each phase,
+// transfer rates, and an estimate of the time remaining. The programmer feeds it
+// byte counts as often as it likes; listeners only get progressUpdated() at a
+// fixed rate so the UI isn't redrawn for every 1 KB chunk.
+class JobProgress : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Phase
+    {
+        PhaseNone,
+        PhaseIdentify,
+        PhaseErase,
+        PhaseWrite,
+        PhaseVerify,
+        PhaseRead,
+        PhaseFirmwareFlash,
+        NumPhases
+    };
+
+    explicit JobProgress(QObject *parent = NULL);
+
+    void startJob();
+    void startPhase(Phase phase, uint32_t totalBytes = 0);
+    void setCompletedBytes(uint32_t bytes);
+    void finishJob();
+
+    bool isJobActive() const { return jobActive; }
+    Phase currentPhase() const { return phase; }
+    uint32_t completedBytes() const { return completed; }
+    uint32_t totalBytes() const { return total; }
+
+    // Rates are in bytes per second, ETA is in seconds (-1 if unknown)
+    double instantaneousRate() const { return instRate; }
+    double averageRate() const;
+    int estimatedSecondsRemaining() const;
+
+    qint64 phaseMilliseconds(Phase phase) const;
+    qint64 jobMilliseconds() const;
+    QString summary() const;
+
+    static QString phaseName(Phase phase);
+    static QString formatRate(double bytesPerSecond);
+    static QString formatDuration(qint64 msecs);
+
+signals:
+    void progressUpdated();
+    void jobFinished();
+
+private slots:
+    void updateTimerFired();
+
+private:
+    void closeCurrentPhase();
+
+    bool jobActive;
+    bool dirty;
+    Phase phase;
+    uint32_t total;
+    uint32_t completed;
+    QElapsedTimer jobTimer;
+    // The job's length once it's finished, so the summary stops counting
+    qint64 jobTime;
+    QElapsedTimer phaseTimer;
+    qint64 phaseTimes[NumPhases];
+    uint32_t phaseBytes[NumPhases];
+
+    // Instantaneous rate is smoothed across update timer ticks
+    QTimer updateTimer;
+    qint64 lastSampleTime;
+    uint32_t lastSampleBytes;
+    double instRate;
+};
+
+#endif // JOBPROGRESS_H
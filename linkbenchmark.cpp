@@ -0,0 +1,213 @@
+#include "linkbenchmark.h"
+#include <QStringList>
+#include <algorithm>
+
+#define DEFAULT_PING_COUNT      1000
+
+// Read data has to go somewhere, but we don't want the time spent storing
+// megabytes of it to count against the link.
+class NullSink : public QIODevice
+{
+public:
+    explicit NullSink(QObject *parent) : QIODevice(parent) {}
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) { Q_UNUSED(data); Q_UNUSED(maxSize); return -1; }
+    qint64 writeData(const char *data, qint64 len) { Q_UNUSED(data); return len; }
+};
+
+LinkBenchmark::LinkBenchmark(Programmer *programmer, QObject *parent) :
+    QObject(parent),
+    programmer(programmer),
+    sink(new NullSink(this)),
+    pingCount(DEFAULT_PING_COUNT),
+    nextRead(0),
+    currentReadLength(0),
+    running(false),
+    ok(false)
+{
+    // A couple of short reads show the per-transfer overhead; the full SIMM
+    // read shows what the link can sustain.
+    readLengths << 64*1024 << 256*1024 << 1024*1024 << 0;
+}
+
+void LinkBenchmark::start()
+{
+    if (running)
+    {
+        return;
+    }
+
+    running = true;
+    ok = false;
+    errorText.clear();
+    roundTripTimes.clear();
+    readTimes.clear();
+    nextRead = 0;
+    sink->open(QIODevice::WriteOnly);
+
+    connect(programmer, SIGNAL(pingStatusChanged(PingStatus)), SLOT(programmerPingStatusChanged(PingStatus)));
+    connect(programmer, SIGNAL(readStatusChanged(ReadStatus)), SLOT(programmerReadStatusChanged(ReadStatus)));
+
+    emit statusChanged(QString("Measuring round trip time (%1 pings)...").arg(pingCount));
+    programmer->pingProgrammer(pingCount);
+}
+
+void LinkBenchmark::programmerPingStatusChanged(PingStatus status)
+{
+    switch (status)
+    {
+    case PingComplete:
+        roundTripTimes = programmer->pingTimes();
+        std::sort(roundTripTimes.begin(), roundTripTimes.end());
+        startNextRead();
+        break;
+    case PingError:
+        finish(false, "The programmer didn't respond to a ping.");
+        break;
+    case PingCancelled:
+        finish(false, "The benchmark was cancelled.");
+        break;
+    }
+}
+
+void LinkBenchmark::programmerReadStatusChanged(ReadStatus status)
+{
+    switch (status)
+    {
+    case ReadStarting:
+        break;
+    case ReadComplete:
+        readTimes.append(qMakePair(currentReadLength, static_cast<qint64>(readTimer.nsecsElapsed() / 1000)));
+        nextRead++;
+        startNextRead();
+        break;
+    case ReadError:
+    case ReadTimedOut:
+        finish(false, "An error occurred reading from the SIMM.");
+        break;
+    case ReadCancelled:
+        finish(false, "The benchmark was cancelled.");
+        break;
+    }
+}
+
+void LinkBenchmark::startNextRead()
+{
+    if (nextRead >= readLengths.count())
+    {
+        finish(true);
+        return;
+    }
+
+    // 0 means the whole SIMM
+    currentReadLength = readLengths[nextRead];
+    if (currentReadLength == 0 || currentReadLength > programmer->SIMMCapacity())
+    {
+        currentReadLength = programmer->SIMMCapacity();
+    }
+
+    emit statusChanged(QString("Measuring read throughput (%1 KB)...").arg(currentReadLength / 1024));
+
+    // The time includes starting the command, on purpose. The difference between
+    // the short and long reads is what shows the fixed cost of each transfer.
+    readTimer.start();
+    programmer->readSIMM(sink, currentReadLength);
+}
+
+void LinkBenchmark::finish(bool succeeded, QString const &error)
+{
+    disconnect(programmer, 0, this, 0);
+    sink->close();
+    running = false;
+    ok = succeeded;
+    errorText = error;
+    emit finished(succeeded);
+}
+
+QString LinkBenchmark::report() const
+{
+    QStringList lines;
+    lines << QString("Programmer revision: %1").arg(revisionName(programmer->programmerRevision()));
+
+    if (!errorText.isEmpty())
+    {
+        lines << errorText;
+    }
+
+    quint32 p50 = 0;
+    quint32 p99 = 0;
+    if (!roundTripTimes.isEmpty())
+    {
+        // roundTripTimes is sorted by now
+        const int n = roundTripTimes.count();
+        p50 = roundTripTimes[qMax(0, (n * 50 + 99) / 100 - 1)];
+        p99 = roundTripTimes[qMax(0, (n * 99 + 99) / 100 - 1)];
+
+        lines << QString("Round trip latency (%1 pings): min %2 us, p50 %3 us, p99 %4 us, max %5 us")
+                 .arg(n).arg(roundTripTimes.first()).arg(p50).arg(p99).arg(roundTripTimes.last());
+
+        // Histogram with power-of-two buckets, which is enough to see whether the
+        // times are bunched up around the USB frame interval or all over the place.
+        // Everything from the last limit up goes in one final bucket.
+        static const quint32 bucketLimits[] = {250, 500, 1000, 2000, 4000, 8000, 16000};
+        const int numLimits = sizeof(bucketLimits) / sizeof(bucketLimits[0]);
+        int i = 0;
+        for (int bucket = 0; bucket <= numLimits; bucket++)
+        {
+            int count = 0;
+            while (i < n && (bucket == numLimits || roundTripTimes[i] < bucketLimits[bucket]))
+            {
+                count++;
+                i++;
+            }
+
+            if (count > 0)
+            {
+                QString label = (bucket < numLimits) ?
+                            QString("< %1 us").arg(bucketLimits[bucket]) :
+                            QString(">= %1 us").arg(bucketLimits[numLimits - 1]);
+                lines << QString("  %1 %2 %3").arg(label, 11).arg(count, 6)
+                         .arg(QString(qMax(1, count * 40 / n), QChar('#')));
+            }
+        }
+    }
+
+    double bestRate = 0;
+    if (!readTimes.isEmpty())
+    {
+        lines << "Read throughput:";
+        for (int x = 0; x < readTimes.count(); x++)
+        {
+            const double secs = readTimes[x].second / 1000000.0;
+            const double rate = secs > 0 ? readTimes[x].first / (1024.0 * 1024.0) / secs : 0;
+            bestRate = qMax(bestRate, rate);
+            lines << QString("  %1 KB in %2 s: %3 MB/s")
+                     .arg(readTimes[x].first / 1024, 6)
+                     .arg(secs, 0, 'f', 3)
+                     .arg(rate, 0, 'f', 3);
+        }
+    }
+
+    // One line that's easy to grep out of a pile of these from different stations
+    lines << QString("summary: revision=%1 pings=%2 p50_us=%3 p99_us=%4 read_mbps=%5")
+             .arg(revisionName(programmer->programmerRevision()))
+             .arg(roundTripTimes.count()).arg(p50).arg(p99)
+             .arg(bestRate, 0, 'f', 3);
+
+    return lines.join("\n") + "\n";
+}
+
+QString LinkBenchmark::revisionName(ProgrammerRevision revision)
+{
+    switch (revision)
+    {
+    case ProgrammerRevisionAVR:
+        return "AVR";
+    case ProgrammerRevisionM258KE:
+        return "M258KE";
+    case ProgrammerRevisionUnknown:
+        break;
+    }
+    return "unknown";
+}
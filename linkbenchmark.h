@@ -0,0 +1,60 @@
+#ifndef LINKBENCHMARK_H
+#define LINKBENCHMARK_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QPair>
+#include "programmer.h"
+
+// Measures the connection to the programmer board, to help tell a slow USB
+// setup apart from a slow board. First it pings the board many times to get the
+// round trip latency, then it times reads of a few different lengths (thrown
+// away as they arrive) to see the bulk throughput and how much of each
+// transfer is fixed overhead. Nothing is written to the SIMM.
+class LinkBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LinkBenchmark(Programmer *programmer, QObject *parent = NULL);
+
+    void setPingCount(int count) { pingCount = count; }
+    void setReadLengths(QList<uint32_t> const &lengths) { readLengths = lengths; }
+
+    bool isRunning() const { return running; }
+    bool succeeded() const { return ok; }
+    QString report() const;
+
+public slots:
+    void start();
+
+signals:
+    void statusChanged(QString const &status);
+    void finished(bool succeeded);
+
+private slots:
+    void programmerPingStatusChanged(PingStatus status);
+    void programmerReadStatusChanged(ReadStatus status);
+
+private:
+    void startNextRead();
+    void finish(bool succeeded, QString const &error = QString());
+    static QString revisionName(ProgrammerRevision revision);
+
+    Programmer *programmer;
+    QIODevice *sink;
+    int pingCount;
+    QList<uint32_t> readLengths;
+    int nextRead;
+    uint32_t currentReadLength;
+    bool running;
+    bool ok;
+    QString errorText;
+
+    QList<quint32> roundTripTimes;
+    QList<QPair<uint32_t, qint64> > readTimes;
+    QElapsedTimer readTimer;
+};
+
+#endif // LINKBENCHMARK_H
@@ -18,12 +18,71 @@
  */
 
 #include <QApplication>
+#include <QTimer>
+#include <QTextStream>
 #include "mainwindow.h"
+#include "fc8benchmark.h"
+
+// Runs the connection benchmark without showing any UI, printing the report
+// to stdout. Handy for comparing a bunch of programming stations.
+static int runHeadlessLinkBenchmark(QApplication &a)
+{
+    Programmer programmer;
+    // Reading the whole 8 MB address space works no matter what's plugged in
+    programmer.setSIMMType(SIMM_BANK_SIZE, SIMM_PLCC_x8);
+
+    LinkBenchmark benchmark(&programmer);
+    QObject::connect(&benchmark, SIGNAL(finished(bool)), &a, SLOT(quit()));
+
+    if (a.arguments().contains("--simulate"))
+    {
+        SimulatedProgrammer *simulated = new SimulatedProgrammer(SIMM_BANK_SIZE, &a);
+        programmer.setTransport(simulated);
+        QTimer::singleShot(0, &benchmark, SLOT(start()));
+    }
+    else
+    {
+        QObject::connect(&programmer, SIGNAL(programmerBoardConnected()), &benchmark, SLOT(start()));
+        programmer.startCheckingPorts();
+    }
+
+    a.exec();
+    QTextStream(stdout) << benchmark.report();
+    return benchmark.succeeded() ? 0 : 1;
+}
+
+// Compares the FC8 encoders on the disk images listed after the option, e.g.
+// --benchmark-fc8 system7.dsk apps.dsk
+static int runFC8Benchmark(QApplication &a)
+{
+    QStringList images = a.arguments().mid(a.arguments().indexOf("--benchmark-fc8") + 1);
+    if (images.isEmpty())
+    {
+        QTextStream(stderr) << "Usage: --benchmark-fc8 <disk image> [<disk image>...]\n";
+        return 1;
+    }
+
+    QTextStream(stdout) << FC8Benchmark::run(images, 65536);
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+    if (a.arguments().contains("--benchmark-link"))
+    {
+        return runHeadlessLinkBenchmark(a);
+    }
+    if (a.arguments().contains("--benchmark-fc8"))
+    {
+        return runFC8Benchmark(a);
+    }
+
     MainWindow w;
+    if (a.arguments().contains("--simulate"))
+    {
+        w.useSimulatedProgrammer();
+    }
     w.show();
 
     return a.exec();
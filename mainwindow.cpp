@@ -22,16 +22,19 @@
 #include "programmer.h"
 #include "aboutbox.h"
 #include "fc8compressor.h"
+#include "fc8decoder.h"
+#include "hfsscrubber.h"
+#include "bufferpool.h"
 #include "createblankdiskdialog.h"
+#include "romchecksum.h"
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QDebug>
 #include <QSettings>
 #include <QBuffer>
-#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
 #include <algorithm>
 #include <QLocale>
-#include <QCryptographicHash>
 
 static Programmer *p;
 
@@ -41,6 +44,8 @@ static Programmer *p;
 #define selectedEraseSizeKey    "selectedEraseSize"
 #define extendedViewKey         "extendedView"
 
+#define combinedROMSaveChunkSize 65536
+
 struct SIMMDesc {
     uint32_t saveValue;
     const char *text;
@@ -100,6 +105,11 @@ static const struct
     {0x87D3C814UL, "Quadra 660av or 840av"},
 };
 
+// Compressed FC8 blocks from earlier compressions, so that after a small change
+// to a disk image only the blocks that changed have to be compressed again. It's
+// shared with the compression threads, so it lives as long as the app does.
+static FC8BlockCache fc8BlockCache;
+
 static const QByteArray multiFirmwareDelimiter(
         "\xDB\x00\xDB\x01\xDB\x02\xDB\x03\xDB\x04\xDB\x05\xDB\x06\xDB\x07"
         "\xDB\x08\xDB\x09\xDB\x0A\xDB\x0B\xDB\x0C\xDB\x0D\xDB\x0E\xDB\x0F"
@@ -113,7 +123,16 @@ MainWindow::MainWindow(QWidget *parent) :
     writeBuffer(NULL),
     readBuffer(NULL),
     checksumVerifyBuffer(NULL),
-    activeMessageBox(NULL)
+    activeMessageBox(NULL),
+    traceReplay(NULL),
+    simulatedProgrammer(NULL),
+    linkBenchmark(NULL),
+    fileCache(new FileContentCache(4, this)),
+    compressedImageCache(NULL),
+    romBuilder(NULL),
+    backgroundCompressor(NULL),
+    reclaimedBytes(0),
+    sizeEstimator(new FC8SizeEstimator(&fc8BlockCache, this))
 {
     initializing = true;
     // Make default QSettings use these settings
@@ -122,9 +141,20 @@ MainWindow::MainWindow(QWidget *parent) :
     QCoreApplication::setApplicationName("SIMMProgrammer");
     QSettings settings;
 
+    // This has to wait until the app name is set, since it goes in the cache path
+    compressedImageCache = new CompressedImageCache();
+    backgroundCompressor = new FC8BackgroundCompressor(&fc8BlockCache, compressedImageCache, this);
+
     p = new Programmer();
     ui->setupUi(this);
 
+    // If the base ROM or disk image is changed on disk, the ROM creation controls
+    // need to take another look at it
+    connect(fileCache, SIGNAL(fileChanged(QString)), SLOT(updateCreateROMControlStatus()));
+    connect(backgroundCompressor, SIGNAL(finished()), SLOT(backgroundCompressionFinished()));
+    connect(sizeEstimator, SIGNAL(finished()), SLOT(updateCreateROMControlStatus()));
+    connect(&reclaimedBytesWatcher, SIGNAL(finished()), SLOT(reclaimedBytesCounted()));
+
     // On Mac and Linux, make it a little wider due to larger font
 #if defined(Q_OS_MACX) || defined(Q_OS_LINUX)
     resize(width() + 200, height());
@@ -237,23 +267,18 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->createROMGroupBox->setMaxFiles(2);
 
     connect(p, SIGNAL(writeStatusChanged(WriteStatus)), SLOT(programmerWriteStatusChanged(WriteStatus)));
-    connect(p, SIGNAL(writeTotalLengthChanged(uint32_t)), SLOT(programmerWriteTotalLengthChanged(uint32_t)));
-    connect(p, SIGNAL(writeCompletionLengthChanged(uint32_t)), SLOT(programmerWriteCompletionLengthChanged(uint32_t)));
-    connect(p, SIGNAL(writeVerifyTotalLengthChanged(uint32_t)), SLOT(programmerVerifyTotalLengthChanged(uint32_t)));
-    connect(p, SIGNAL(writeVerifyCompletionLengthChanged(uint32_t)), SLOT(programmerVerifyCompletionLengthChanged(uint32_t)));
     connect(p, SIGNAL(electricalTestStatusChanged(ElectricalTestStatus)), SLOT(programmerElectricalTestStatusChanged(ElectricalTestStatus)));
     connect(p, SIGNAL(electricalTestFailLocation(uint8_t,uint8_t)), SLOT(programmerElectricalTestLocation(uint8_t,uint8_t)));
     connect(p, SIGNAL(readStatusChanged(ReadStatus)), SLOT(programmerReadStatusChanged(ReadStatus)));
-    connect(p, SIGNAL(readTotalLengthChanged(uint32_t)), SLOT(programmerReadTotalLengthChanged(uint32_t)));
-    connect(p, SIGNAL(readCompletionLengthChanged(uint32_t)), SLOT(programmerReadCompletionLengthChanged(uint32_t)));
     connect(p, SIGNAL(identificationStatusChanged(IdentificationStatus)), SLOT(programmerIdentifyStatusChanged(IdentificationStatus)));
     connect(p, SIGNAL(firmwareFlashStatusChanged(FirmwareFlashStatus)), SLOT(programmerFirmwareFlashStatusChanged(FirmwareFlashStatus)));
-    connect(p, SIGNAL(firmwareFlashTotalLengthChanged(uint32_t)), SLOT(programmerFirmwareFlashTotalLengthChanged(uint32_t)));
-    connect(p, SIGNAL(firmwareFlashCompletionLengthChanged(uint32_t)), SLOT(programmerFirmwareFlashCompletionLengthChanged(uint32_t)));
     connect(p, SIGNAL(programmerBoardConnected()), SLOT(programmerBoardConnected()));
     connect(p, SIGNAL(programmerBoardDisconnected()), SLOT(programmerBoardDisconnected()));
     connect(p, SIGNAL(programmerBoardDisconnectedDuringOperation()), SLOT(programmerBoardDisconnectedDuringOperation()));
     connect(p, SIGNAL(readFirmwareVersionStatusChanged(ReadFirmwareVersionStatus,uint32_t)), SLOT(programmerFirmwareVersionStatusChanged(ReadFirmwareVersionStatus,uint32_t)));
+    // Progress bar updates come from the programmer's progress tracker at a fixed
+    // rate, rather than once for every chunk of data transferred.
+    connect(&p->progress(), SIGNAL(progressUpdated()), SLOT(programmerProgressUpdated()));
     p->startCheckingPorts();
 
     // Set up the multi chip flasher UI -- connect signals
@@ -292,6 +317,10 @@ MainWindow::MainWindow(QWidget *parent) :
 
 MainWindow::~MainWindow()
 {
+    // These have to stop using the compressed image cache before it's deleted
+    delete romBuilder;
+    delete backgroundCompressor;
+    delete compressedImageCache;
     delete p;
     delete ui;
 }
@@ -418,6 +447,11 @@ void MainWindow::doInternalWrite(QIODevice *device)
     }
 }
 
+qint64 MainWindow::selectedSIMMCapacity() const
+{
+    return simmTable[ui->simmCapacityBox->currentIndex()].size * static_cast<qint64>(1024);
+}
+
 void MainWindow::on_chosenWriteFile_textEdited(const QString &newText)
 {
     QFileInfo fi(newText);
@@ -506,6 +540,7 @@ void MainWindow::programmerWriteStatusChanged(WriteStatus newStatus)
         {
             ui->statusLabel->setText("Erasing SIMM (this may take a few seconds)...");
         }
+        ui->cancelButton->setEnabled(true);
         break;
     case WriteCompleteNoVerify:
         if (writeFile)
@@ -516,7 +551,7 @@ void MainWindow::programmerWriteStatusChanged(WriteStatus newStatus)
         }
 
         returnToControlPage();
-        showMessageBox(QMessageBox::Information, "Write complete", "The write operation finished.");
+        showMessageBox(QMessageBox::Information, "Write complete", "The write operation finished.\n\nTiming: " + p->progress().summary());
         if (writeBuffer)
         {
             writeBuffer->close();
@@ -533,7 +568,7 @@ void MainWindow::programmerWriteStatusChanged(WriteStatus newStatus)
         }
 
         returnToControlPage();
-        showMessageBox(QMessageBox::Information, "Write complete", "The write operation finished, and the contents were verified successfully.");
+        showMessageBox(QMessageBox::Information, "Write complete", "The write operation finished, and the contents were verified successfully.\n\nTiming: " + p->progress().summary());
         if (writeBuffer)
         {
             writeBuffer->close();
@@ -546,6 +581,7 @@ void MainWindow::programmerWriteStatusChanged(WriteStatus newStatus)
         break;
     case WriteVerifyStarting:
         ui->statusLabel->setText("Verifying SIMM contents...");
+        ui->cancelButton->setEnabled(true);
         break;
     case WriteVerifyError:
         if (writeFile)
@@ -792,24 +828,32 @@ void MainWindow::programmerWriteStatusChanged(WriteStatus newStatus)
     }
 }
 
-void MainWindow::programmerWriteTotalLengthChanged(uint32_t totalLen)
+void MainWindow::programmerProgressUpdated()
 {
-    ui->progressBar->setMaximum((int)totalLen);
-}
+    JobProgress const &progress = p->progress();
 
-void MainWindow::programmerWriteCompletionLengthChanged(uint32_t len)
-{
-    ui->progressBar->setValue((int)len);
-}
+    // Phases without a known length (identifying, erasing) get the busy indicator
+    if (progress.totalBytes() == 0)
+    {
+        ui->progressBar->setRange(0, 0);
+        ui->progressBar->setFormat("%p%");
+        return;
+    }
 
-void MainWindow::programmerVerifyTotalLengthChanged(uint32_t totalLen)
-{
-    ui->progressBar->setMaximum((int)totalLen);
-}
+    ui->progressBar->setRange(0, (int)progress.totalBytes());
+    ui->progressBar->setValue((int)progress.completedBytes());
 
-void MainWindow::programmerVerifyCompletionLengthChanged(uint32_t len)
-{
-    ui->progressBar->setValue((int)len);
+    QString format = "%p%";
+    if (progress.instantaneousRate() > 0)
+    {
+        format += " - " + JobProgress::formatRate(progress.instantaneousRate());
+        int eta = progress.estimatedSecondsRemaining();
+        if (eta >= 0)
+        {
+            format += QString(", %1 remaining").arg(JobProgress::formatDuration(eta * 1000LL));
+        }
+    }
+    ui->progressBar->setFormat(format);
 }
 
 void MainWindow::on_electricalTestButton_clicked()
@@ -861,10 +905,17 @@ void MainWindow::programmerElectricalTestLocation(uint8_t loc1, uint8_t loc2)
 
 void MainWindow::programmerReadStatusChanged(ReadStatus newStatus)
 {
+    // The link benchmark does its own reads and handles their results itself
+    if (linkBenchmark && linkBenchmark->isRunning())
+    {
+        return;
+    }
+
     switch (newStatus)
     {
     case ReadStarting:
         ui->statusLabel->setText("Reading SIMM contents...");
+        ui->cancelButton->setEnabled(true);
         break;
     case ReadComplete:
         if (readFile)
@@ -873,9 +924,11 @@ void MainWindow::programmerReadStatusChanged(ReadStatus newStatus)
             delete readFile;
             readFile = NULL;
         }
-        if (readBuffer)
+        if (readBuffer && !finishMultiRead())
         {
-            finishMultiRead();
+            // Couldn't save the individual chip files
+            programmerReadStatusChanged(ReadError);
+            break;
         }
 
         returnToControlPage();
@@ -888,7 +941,7 @@ void MainWindow::programmerReadStatusChanged(ReadStatus newStatus)
         else
         {
             // Normal reads just show a message box
-            showMessageBox(QMessageBox::Information, "Read complete", "The read operation finished.");
+            showMessageBox(QMessageBox::Information, "Read complete", "The read operation finished.\n\nTiming: " + p->progress().summary());
         }
         if (readBuffer)
         {
@@ -967,16 +1020,6 @@ void MainWindow::programmerReadStatusChanged(ReadStatus newStatus)
     }
 }
 
-void MainWindow::programmerReadTotalLengthChanged(uint32_t totalLen)
-{
-    ui->progressBar->setMaximum((int)totalLen);
-}
-
-void MainWindow::programmerReadCompletionLengthChanged(uint32_t len)
-{
-    ui->progressBar->setValue((int)len);
-}
-
 void MainWindow::programmerIdentifyStatusChanged(IdentificationStatus newStatus)
 {
     switch (newStatus)
@@ -1218,10 +1261,11 @@ void MainWindow::programmerFirmwareFlashStatusChanged(FirmwareFlashStatus newSta
     {
     case FirmwareFlashStarting:
         ui->statusLabel->setText("Flashing new firmware...");
+        ui->cancelButton->setEnabled(true);
         break;
     case FirmwareFlashComplete:
         returnToControlPage();
-        showMessageBox(QMessageBox::Information, "Firmware update complete", "The firmware update operation finished.");
+        showMessageBox(QMessageBox::Information, "Firmware update complete", "The firmware update operation finished.\n\nTiming: " + p->progress().summary());
         break;
     case FirmwareFlashError:
         returnToControlPage();
@@ -1238,16 +1282,6 @@ void MainWindow::programmerFirmwareFlashStatusChanged(FirmwareFlashStatus newSta
     }
 }
 
-void MainWindow::programmerFirmwareFlashTotalLengthChanged(uint32_t totalLen)
-{
-    ui->progressBar->setMaximum((int)totalLen);
-}
-
-void MainWindow::programmerFirmwareFlashCompletionLengthChanged(uint32_t len)
-{
-    ui->progressBar->setValue((int)len);
-}
-
 void MainWindow::on_actionUpdate_firmware_triggered()
 {
     QString filename = QFileDialog::getOpenFileName(this, "Select a firmware image:");
@@ -1323,7 +1357,9 @@ void MainWindow::resetAndShowStatusPage()
 {
     // Show indeterminate progress bar until communication succeeds/fails
     ui->progressBar->setRange(0, 0);
+    ui->progressBar->setFormat("%p%");
     ui->statusLabel->setText("Communicating with programmer (this may take a few seconds)...");
+    ui->cancelButton->setEnabled(false);
     ui->pages->setCurrentWidget(ui->statusPage);
     ui->actionUpdate_firmware->setEnabled(false);
     ui->actionCheck_Firmware_Version->setEnabled(false);
@@ -1342,6 +1378,9 @@ void MainWindow::on_simmCapacityBox_currentIndexChanged(int index)
 
         // This can affect the error status of the ROM creation section
         updateCreateROMControlStatus();
+
+        // ...and how many chips can be flashed individually
+        updateFlashIndividualControlsEnabled();
     }
 }
 
@@ -1575,9 +1614,15 @@ void MainWindow::updateFlashIndividualControlsEnabled()
                                                ui->chosenReadIC3File,
                                                ui->chosenReadIC4File};
 
-    for (size_t x = 0; x < sizeof(flashBoxes)/sizeof(flashBoxes[0]); x++)
+    // 2x16 SIMMs only have IC1 and IC2
+    const int chipCount = SIMMInterleaver(simmLaneLayout()).chipCount();
+
+    for (int x = 0; x < static_cast<int>(sizeof(flashBoxes)/sizeof(flashBoxes[0])); x++)
     {
-        bool isChecked = flashBoxes[x]->isChecked();
+        flashBoxes[x]->setEnabled(x < chipCount);
+        readBoxes[x]->setEnabled(x < chipCount);
+
+        bool isChecked = flashBoxes[x]->isChecked() && x < chipCount;
 
         flashChosenFileEdits[x]->setEnabled(isChecked);
         flashSelectButtons[x]->setEnabled(isChecked);
@@ -1591,7 +1636,7 @@ void MainWindow::updateFlashIndividualControlsEnabled()
             }
         }
 
-        isChecked = readBoxes[x]->isChecked();
+        isChecked = readBoxes[x]->isChecked() && x < chipCount;
 
         readChosenFileEdits[x]->setEnabled(isChecked);
         readSelectButtons[x]->setEnabled(isChecked);
@@ -1695,75 +1740,34 @@ void MainWindow::on_multiFlashChipsButton_clicked()
     {
         delete writeBuffer;
     }
-    writeBuffer = new QBuffer();
-    qint64 maxSize = 0;
-    bool hadError = false;
-    uint8_t chipsMask = 0;
+    writeBuffer = new PooledBuffer(p->SIMMCapacity());
 
-    // Read each file and ensure it exists. Oh, and create the mask of which
-    // chips we're flashing.
-    QFile *files[sizeof(flashBoxes)/sizeof(flashBoxes[0])] = {NULL, NULL, NULL, NULL};
-    for (size_t x = 0; x < sizeof(files)/sizeof(files[0]); x++)
+    // Figure out which chips we're flashing, and create the mask of which
+    // byte lanes that means.
+    SIMMInterleaver interleaver(simmLaneLayout());
+    QStringList paths;
+    uint8_t chipsMask = 0;
+    for (int x = 0; x < interleaver.chipCount(); x++)
     {
         if (flashBoxes[x]->isChecked())
         {
-            files[x] = new QFile(flashChosenFileEdits[x]->text());
-            if (!files[x]->exists())
-            {
-                hadError = true;
-            }
-            if (files[x]->size() > maxSize)
-            {
-                maxSize = files[x]->size();
-            }
-            files[x]->open(QFile::ReadOnly);
-            // Create our chip mask. chip mask is backward from IC numbering
-            // (bit 0 = IC4, bit 1 = IC3, ...)
-            chipsMask |= (1 << (3-x));
-        }
-    }
-
-    // If there was an error or one of the files picked was too big,
-    // error out.
-    if (hadError || (maxSize > (p->SIMMCapacity() / 4)))
-    {
-        for (size_t x = 0; x < sizeof(files)/sizeof(files[0]); x++)
-        {
-            if (files[x]) delete files[x];
+            paths << flashChosenFileEdits[x]->text();
+            chipsMask |= interleaver.chipMask(x);
         }
-
-        programmerWriteStatusChanged(WriteError);
-        return;
-    }
-
-    // Combine the (up to four) files into a single
-    // interleaved file to send to the SIMM
-    writeBuffer->open(QFile::ReadWrite);
-    for (int x = 0; x < maxSize; x++)
-    {
-        // Go in reverse order through the files so the data is saved to
-        // the SIMM in the correct order
-        for (int y = (int)(sizeof(files)/sizeof(files[0])) - 1; y >= 0; y--)
+        else
         {
-            char c = 0xFF;
-            if (files[y] && !files[y]->atEnd())
-            {
-                files[y]->getChar(&c);
-
-            }
-            writeBuffer->putChar(c);
+            paths << QString();
         }
     }
 
-    // Discard the temporary files
-    for (size_t x = 0; x < sizeof(files)/sizeof(files[0]); x++)
+    // Combine the files into a single interleaved image to send to the SIMM.
+    // This fails if a file is missing or one of them is too big.
+    if (!interleaver.interleaveFiles(paths, p->SIMMCapacity() / interleaver.chipCount(), writeBuffer->buffer()))
     {
-        if (files[x])
-        {
-            files[x]->close();
-            delete files[x];
-        }
+        programmerWriteStatusChanged(WriteError);
+        return;
     }
+    writeBuffer->open(QFile::ReadOnly);
 
     // Now go back to the beginning of the file...
     // and write it!
@@ -1790,7 +1794,7 @@ void MainWindow::on_multiReadChipsButton_clicked()
     {
         delete readBuffer;
     }
-    readBuffer = new QBuffer();
+    readBuffer = new PooledBuffer(p->SIMMCapacity());
     if (checksumVerifyBuffer)
     {
         delete checksumVerifyBuffer;
@@ -1830,7 +1834,7 @@ void MainWindow::on_multiReadChipsButton_clicked()
     p->readSIMM(readBuffer);
 }
 
-void MainWindow::finishMultiRead()
+bool MainWindow::finishMultiRead()
 {
     QCheckBox * const readBoxes[] = {ui->readIC1CheckBox,
                                      ui->readIC2CheckBox,
@@ -1842,69 +1846,20 @@ void MainWindow::finishMultiRead()
                                                ui->chosenReadIC3File,
                                                ui->chosenReadIC4File};
 
-    bool hadError = false;
-
-    QFile *files[sizeof(readBoxes)/sizeof(readBoxes[0])] = {NULL, NULL, NULL, NULL};
-    for (size_t x = 0; x < sizeof(files)/sizeof(files[0]); x++)
+    SIMMInterleaver interleaver(simmLaneLayout());
+    QStringList paths;
+    for (int x = 0; x < interleaver.chipCount(); x++)
     {
-        if (readBoxes[x]->isChecked())
-        {
-            files[x] = new QFile(readChosenFileEdits[x]->text());
-            if (!files[x]->open(QFile::WriteOnly))
-            {
-                hadError = true;
-            }
-        }
-    }
-
-    if (hadError)
-    {
-        for (size_t x = 0; x < sizeof(files)/sizeof(files[0]); x++)
-        {
-            if (files[x]) delete files[x];
-        }
-
-        programmerReadStatusChanged(ReadError);
-        return;
+        paths << (readBoxes[x]->isChecked() ? readChosenFileEdits[x]->text() : QString());
     }
 
     // Take the final read file and de-interleave it into separate chip files
-    readBuffer->seek(0);
-    while (!readBuffer->atEnd())
-    {
-        // Go in reverse order through the files so the data is saved to the
-        // files in the correct order
-        for (int y = (int)(sizeof(files)/sizeof(files[0])) - 1; y >= 0; y--)
-        {
-            char c = 0xFF;
-            if (readBuffer->getChar(&c)) // grab a character...
-            {
-                // and as long as it was a success, stick it into the appropriate file
-                // (IF we have one), or discard it if we didn't care about the chip
-                // it went with.
-                if (files[y])
-                {
-                    files[y]->putChar(c);
-                }
-            }
-            else // no success? we're probably near end of SIMM. just discard it and close the file
-            {
-                files[y]->close();
-                delete files[y];
-                files[y] = NULL;
-            }
-        }
-    }
+    return interleaver.deinterleaveToFiles(readBuffer->buffer(), paths);
+}
 
-    // Close the individual files that are remaining
-    for (size_t x = 0; x < sizeof(files)/sizeof(files[0]); x++)
-    {
-        if (files[x])
-        {
-            files[x]->close();
-            delete files[x];
-        }
-    }
+SIMMLaneLayout MainWindow::simmLaneLayout() const
+{
+    return (p->SIMMChip() == SIMM_TSOP_x16) ? SIMMLayout2x16 : SIMMLayout4x8;
 }
 
 void MainWindow::on_verifyROMChecksumButton_clicked()
@@ -1932,7 +1887,7 @@ void MainWindow::on_verifyROMChecksumButton_clicked()
     {
         delete checksumVerifyBuffer;
     }
-    checksumVerifyBuffer = new QBuffer();
+    checksumVerifyBuffer = new PooledBuffer(p->SIMMCapacity());
 
     // Open up the buffer to read into
     checksumVerifyBuffer->open(QFile::ReadWrite);
@@ -1952,19 +1907,9 @@ void MainWindow::finishChecksumVerify()
         return;
     }
 
-    // Pull out the checksum
-    uint32_t checksumInROM = 0;
-    checksumInROM |= static_cast<uint8_t>(bufferBytes.at(0x0)) << 24;
-    checksumInROM |= static_cast<uint8_t>(bufferBytes.at(0x1)) << 16;
-    checksumInROM |= static_cast<uint8_t>(bufferBytes.at(0x2)) << 8;
-    checksumInROM |= static_cast<uint8_t>(bufferBytes.at(0x3)) << 0;
-
-    // Pull out the length
-    uint32_t romLength = 0;
-    romLength |= static_cast<uint8_t>(bufferBytes.at(0x40)) << 24;
-    romLength |= static_cast<uint8_t>(bufferBytes.at(0x41)) << 16;
-    romLength |= static_cast<uint8_t>(bufferBytes.at(0x42)) << 8;
-    romLength |= static_cast<uint8_t>(bufferBytes.at(0x43)) << 0;
+    // Pull out the checksum and length
+    const uint32_t checksumInROM = ROMChecksum::checksumInHeader(bufferBytes);
+    uint32_t romLength = ROMChecksum::lengthInHeader(bufferBytes);
 
     uint8_t romVersion = static_cast<uint8_t>(bufferBytes.at(0x09));
 
@@ -1972,19 +1917,9 @@ void MainWindow::finishChecksumVerify()
     // It's unclear whether ROM 0x79 has the ROM length embedded or not.
     if (romVersion < 0x7A)
     {
-        romLength = 0;
-
-        // Check the checksum based on a few random possible checksum lengths
-        // in order to determine the ROM length
-        uint32_t tmpChecksum;
-        for (uint32_t tmpLen = 64*1024; tmpLen <= 512*1024; tmpLen *= 2)
-        {
-            if (calculateROMChecksum(bufferBytes, tmpLen, tmpChecksum) && (tmpChecksum == checksumInROM))
-            {
-                romLength = tmpLen;
-                break;
-            }
-        }
+        // Check the checksum based on a few possible lengths in order to determine
+        // the ROM length. They're all calculated together in one pass.
+        romLength = ROMChecksum::findMatchingLength(bufferBytes, checksumInROM, 64*1024, 512*1024);
 
         if (romLength == 0)
         {
@@ -2010,7 +1945,7 @@ void MainWindow::finishChecksumVerify()
     }
 
     uint32_t actualChecksum = 0;
-    if (calculateROMChecksum(bufferBytes, romLength, actualChecksum) && (actualChecksum == checksumInROM))
+    if (ROMChecksum::calculate(bufferBytes, romLength, actualChecksum) && (actualChecksum == checksumInROM))
     {
         QString checksumInROMString = QString("%1").arg(checksumInROM, 8, 16, QChar('0')).toUpper();
         QString finalMessage = QString("The checksum of this ROM image comes out correct. The checksum is %1.\n\n")
@@ -2044,7 +1979,7 @@ void MainWindow::finishChecksumVerify()
     else
     {
         // This *might* not be an error. The ROM might be patched.
-        if (identifyBaseROM(&bufferBytes) != BaseROMUnknown)
+        if (identifyBaseROM(&bufferBytes).family)
         {
             QString finalMessage = QString("The checksum in this ROM does not match. However, it appears to be a patched ROM, so it's normal for the checksum to not match.\n\nAccording to the ROM header, it is a %1 ROM.")
                     .arg(displayableFileSize(romLength));
@@ -2065,26 +2000,6 @@ void MainWindow::finishChecksumVerify()
     }
 }
 
-bool MainWindow::calculateROMChecksum(const QByteArray &rom, uint32_t len, uint32_t &checksum)
-{
-    if (static_cast<uint32_t>(rom.length()) < len)
-    {
-        return false;
-    }
-
-    // Now calculate the checksum
-    checksum = 0;
-    for (uint32_t i = 4; i < len; i += 2)
-    {
-        uint16_t thisWord = 0;
-        thisWord |= static_cast<uint8_t>(rom.at(i + 0)) << 8;
-        thisWord |= static_cast<uint8_t>(rom.at(i + 1)) << 0;
-        checksum += thisWord;
-    }
-
-    return true;
-}
-
 void MainWindow::returnToControlPage()
 {
     // Depending on what we were doing, return to the correct page
@@ -2097,6 +2012,7 @@ void MainWindow::returnToControlPage()
         ui->pages->setCurrentWidget(ui->controlPage);
     }
 
+    ui->cancelButton->setEnabled(false);
     ui->actionUpdate_firmware->setEnabled(true);
     ui->actionCheck_Firmware_Version->setEnabled(true);
 }
@@ -2144,6 +2060,7 @@ void MainWindow::updateCreateROMControlStatus()
     bool alreadyCompressed = false;
     bool diskImageValid = checkDiskImageValidity(diskImageError, alreadyCompressed);
     bool error = true;
+    ui->createROMErrorText->setToolTip("");
 
     ui->writeCombinedFileToSIMMButton->setEnabled(baseROMValid && diskImageValid);
     ui->saveCombinedFileButton->setEnabled(baseROMValid && diskImageValid);
@@ -2159,19 +2076,52 @@ void MainWindow::updateCreateROMControlStatus()
     else if (baseROMValid && diskImageValid)
     {
         QByteArray uncompressedImage = uncompressedDiskImage();
-        bool supportsCompression = checkBaseROMCompressionSupport();
+        const ROMScanResult baseROMInfo = identifyBaseROM();
+        bool supportsCompression = baseROMInfo.supportsCompression;
         bool shouldCompress = supportsCompression && !alreadyCompressed;
         error = false;
+        QByteArray hash;
         if (shouldCompress &&
-            !FC8Compressor::hashMatchesFile(compressedImageFileHash, uncompressedImage))
+            !findCompressedImage(uncompressedImage, hash))
         {
             ui->createROMErrorText->setText("Compressing...");
 
             // Run the compression in the background. When it completes, this will re-run.
-            compressImageInBackground(uncompressedImage, false);
+            compressImageInBackground(uncompressedImage, hash);
 
-            // While it's compressing, we can't allow writing/saving
-            ui->writeCombinedFileToSIMMButton->setEnabled(false);
+            // It won't be long before there's a good guess at whether it'll fit, though
+            const FC8SizeEstimator::Estimate estimate = sizeEstimator->estimate();
+            if (sizeEstimator->hashOfImage() == hash && estimate.valid)
+            {
+                const qint64 baseROMSize = QFileInfo(ui->chosenBaseROMFile->text()).size();
+                const qint64 maxSize = maxCompressedImageSize();
+                QString verdict;
+                if (estimate.highSize <= maxSize)
+                {
+                    verdict = "it will fit";
+                }
+                else if (estimate.lowSize > maxSize)
+                {
+                    verdict = "it won't fit";
+                    error = true;
+                }
+                else
+                {
+                    verdict = "it might not fit";
+                }
+                ui->createROMErrorText->setText(QString("Compressing... Total ROM Size will be about %1 (%2 to %3), so %4.")
+                                                .arg(displayableFileSize(baseROMSize + estimate.expectedSize))
+                                                .arg(displayableFileSize(baseROMSize + estimate.lowSize))
+                                                .arg(displayableFileSize(baseROMSize + estimate.highSize))
+                                                .arg(verdict));
+                ui->createROMErrorText->setToolTip(QString("Estimated by compressing %1 of %2 blocks")
+                                                   .arg(estimate.sampledBlocks).arg(estimate.totalBlocks));
+            }
+
+            // Saving has to wait until it's compressed, but once it's pretty clear
+            // it'll fit, it can be compressed while it's being written to the SIMM
+            ui->writeCombinedFileToSIMMButton->setEnabled(sizeEstimator->hashOfImage() == hash && estimate.valid &&
+                                                          estimate.highSize <= maxCompressedImageSize());
             ui->saveCombinedFileButton->setEnabled(false);
         }
         else if (!supportsCompression && alreadyCompressed)
@@ -2183,9 +2133,10 @@ void MainWindow::updateCreateROMControlStatus()
             ui->writeCombinedFileToSIMMButton->setEnabled(false);
             ui->saveCombinedFileButton->setEnabled(false);
         }
-        else if (identifyBaseROM() == BaseROMbbraun2MB && uncompressedImage.length() > 1572864)
+        else if (baseROMInfo.family && baseROMInfo.family->maxDiskImageSize &&
+                 diskImageDecodedSize(uncompressedImage) > baseROMInfo.family->maxDiskImageSize)
         {
-            ui->createROMErrorText->setText("This base ROM only supports disk images " + QLocale(QLocale::English).toString(1572864) + " bytes or less in size.");
+            ui->createROMErrorText->setText("This base ROM only supports disk images " + QLocale(QLocale::English).toString(baseROMInfo.family->maxDiskImageSize) + " bytes or less in size.");
             error = true;
             ui->writeCombinedFileToSIMMButton->setEnabled(false);
             ui->saveCombinedFileButton->setEnabled(false);
@@ -2205,12 +2156,30 @@ void MainWindow::updateCreateROMControlStatus()
             }
 
             QString prettySize = displayableFileSize(size);
-            if (shouldCompress || alreadyCompressed)
+            if (shouldCompress)
+            {
+                prettySize += QString(" (FC8-compressed, %1 KB blocks)").arg(FC8_ROM_DISK_BLOCK_SIZE / 1024);
+
+                // Leftovers in the volume's free space don't make it into the ROM. The
+                // size estimator counts them when it scrubs, and the background
+                // compressor passes that along; if the compressed image came from
+                // somewhere else, the volume has to be looked at once in the thread
+                // pool, and this gets called again when that's done.
+                if (reclaimedBytesHash != hash)
+                {
+                    countReclaimedBytesInBackground(uncompressedImage, hash);
+                }
+                else if (reclaimedBytes > 0)
+                {
+                    prettySize += QString(", %1 of unused space cleared").arg(displayableFileSize(reclaimedBytes));
+                }
+            }
+            else if (alreadyCompressed)
             {
                 prettySize += " (FC8-compressed)";
             }
 
-            const qint64 simmSize = simmTable[ui->simmCapacityBox->currentIndex()].size * 1024;
+            const qint64 simmSize = selectedSIMMCapacity();
             if (size > simmSize)
             {
                 // If the image is too big, it's an error
@@ -2266,18 +2235,9 @@ bool MainWindow::checkBaseROMValidity(QString &errorText)
     }
 
     // Load the entire base ROM
-    QFile f(baseROMFileName);
-    if (!f.open(QFile::ReadOnly))
-    {
-        errorText = "Unable to open the base ROM.";
-        return false;
-    }
-
-    QByteArray romData = f.readAll();
-    f.close();
-
-    // Make sure we read it all
-    if (fi.size() != romData.length())
+    bool readOK = false;
+    QByteArray romData = fileCache->contents(baseROMFileName, &readOK);
+    if (!readOK)
     {
         errorText = "Unable to read from base ROM.";
         return false;
@@ -2313,7 +2273,7 @@ bool MainWindow::checkBaseROMValidity(QString &errorText)
         bool foundDiskImage = false;
 
         QByteArray extraData = romData.mid(romLength);
-        if (isCompressedDiskImage(extraData))
+        if (FC8Compressor::isCompressedImage(extraData))
         {
             foundDiskImage = true;
         }
@@ -2353,70 +2313,10 @@ bool MainWindow::checkBaseROMValidity(QString &errorText)
     return true;
 }
 
-bool MainWindow::checkBaseROMCompressionSupport()
-{
-    // This string shows up in custom ROMs that support compression
-    return unpatchedBaseROM().contains(" block-compressed disk image");
-}
-
-MainWindow::KnownBaseROM MainWindow::identifyBaseROM(QByteArray const *baseROMToCheck)
-{
-    QByteArray baseROM = !baseROMToCheck ? unpatchedBaseROM() : *baseROMToCheck;
-    if (baseROM.length() < 0x51DC4)
-    {
-        return BaseROMUnknown;
-    }
-
-    if (baseROM.contains("Garrett's Workshop ROM Disk"))
-    {
-        return BaseROMGarrettsWorkshop;
-    }
-    else if (baseROM.contains(" block-compressed disk image"))
-    {
-        return BaseROMBMOW;
-    }
-    // Look for a known pattern in bbraun's ROM disk driver when inserted into a Quadra ROM
-    else if (offsetToQuadraROMDiskSize(baseROM) >= 0)
-    {
-        return BaseROMbbraunInQuadra;
-    }
-    // Look for a known byte pattern in bbraun's ROM disk driver
-    else if (baseROM.at(0x51DC0) == static_cast<char>(0x4E) &&
-             baseROM.at(0x51DC1) == static_cast<char>(0xBA) &&
-             baseROM.at(0x51DC2) == static_cast<char>(0x04) &&
-             baseROM.at(0x51DC3) == static_cast<char>(0xDC))
-    {
-        return BaseROMbbraun8MB;
-    }
-    // The pattern is slightly different in the 2 MB version
-    else if (baseROM.at(0x51DC0) == static_cast<char>(0x4E) &&
-             baseROM.at(0x51DC1) == static_cast<char>(0xBA) &&
-             baseROM.at(0x51DC2) == static_cast<char>(0x03) &&
-             baseROM.at(0x51DC3) == static_cast<char>(0x02))
-    {
-        return BaseROMbbraun2MB;
-    }
-
-    return BaseROMUnknown;
-}
-
-int MainWindow::offsetToQuadraROMDiskSize(const QByteArray &baseROM)
+ROMScanResult MainWindow::identifyBaseROM(QByteArray const *baseROMToCheck)
 {
-    int offset = -1;
-
-    // Look for the offset of a sequence of bytes in bbraun's ROM disk driver patched by CayMac,
-    // that indicates we've found the offset where the ROM disk size should be stored in the image
-    if (baseROM.length() >= 0x100000)
-    {
-        const QByteArray quadraPattern("\x3F\xFF\xFF\xF8\x00\x00\x00\x00\x01\x08\x00\x00\x01\x0C\x40\x90\x00\x00", 18);
-        offset = baseROM.indexOf(quadraPattern);
-        if (offset >= 0)
-        {
-            offset += 18;
-        }
-    }
-
-    return offset;
+    // The results are remembered, so it's fine to call this a lot
+    return ROMSignatures::scan(!baseROMToCheck ? unpatchedBaseROM() : *baseROMToCheck);
 }
 
 bool MainWindow::checkDiskImageValidity(QString &errorText, bool &alreadyCompressed)
@@ -2439,38 +2339,55 @@ bool MainWindow::checkDiskImageValidity(QString &errorText, bool &alreadyCompres
         return false;
     }
 
-    QFile f(diskImageFileName);
-    if (!f.open(QFile::ReadOnly))
-    {
-        errorText = "Unable to open the disk image.";
-        return false;
-    }
-
-    QByteArray diskImageData = f.read(1026);
-    f.close();
-
-    if (diskImageData.length() != 1026)
+    bool readOK = false;
+    QByteArray diskImageData = fileCache->contents(diskImageFileName, &readOK);
+    if (!readOK || diskImageData.length() < 1026)
     {
         errorText = "Unable to read from disk image.";
         return false;
     }
 
-    // This image is already compressed (FC8 block mode or whole mode)
-    if (isCompressedDiskImage(diskImageData))
+    // This image is already compressed (FC8 block mode or whole mode). Make sure
+    // what's inside is just as good as an uncompressed image would have to be.
+    if (FC8Compressor::isCompressedImage(diskImageData))
     {
         alreadyCompressed = true;
-        // Assume compressed images are usable. We don't want to decompress
-        // just to find out. Not worth the effort.
-        return true;
+
+        // This gets called a lot, so only decompress it when it's different. We hang
+        // on to the data, so its buffer can't be reused for anything else while we're
+        // still comparing against it.
+        if (diskImageData.constData() != checkedCompressedImage.constData() ||
+            diskImageData.length() != checkedCompressedImage.length())
+        {
+            checkedCompressedImage = diskImageData;
+            QByteArray decoded;
+            QString decodeError;
+            if (!FC8Decoder::decode(diskImageData, decoded, &decodeError))
+            {
+                checkedCompressedImageError = "The chosen compressed disk image can't be decompressed. " + decodeError;
+            }
+            else if (checkHFSVolume(decoded, checkedCompressedImageError))
+            {
+                checkedCompressedImageError.clear();
+            }
+        }
+
+        errorText = checkedCompressedImageError;
+        return errorText.isEmpty();
     }
 
-    if (diskImageData.at(1024) != 'B' || diskImageData.at(1025) != 'D')
+    return checkHFSVolume(diskImageData, errorText);
+}
+
+bool MainWindow::checkHFSVolume(QByteArray const &image, QString &errorText)
+{
+    if (image.length() < 1026 || image.at(1024) != 'B' || image.at(1025) != 'D')
     {
         errorText = "The chosen disk image is not an HFS disk image.";
         return false;
     }
 
-    if (diskImageData.at(0) != 'L' || diskImageData.at(1) != 'K')
+    if (image.at(0) != 'L' || image.at(1) != 'K')
     {
         errorText = "The chosen disk image doesn't have boot blocks.";
         return false;
@@ -2479,198 +2396,87 @@ bool MainWindow::checkDiskImageValidity(QString &errorText, bool &alreadyCompres
     return true;
 }
 
-bool MainWindow::isCompressedDiskImage(const QByteArray &image)
-{
-    // Look for start of FC8b or FC8_
-    return image.length() >= 4 && image.at(0) == 'F' &&
-        image.at(1) == 'C' && image.at(2) == '8' &&
-        (image.at(3) == 'b' || image.at(3) == '_');
-}
-
-void MainWindow::compressImageInBackground(QByteArray uncompressedImage, bool blockUntilCompletion)
+void MainWindow::compressImageInBackground(QByteArray uncompressedImage, QByteArray hash)
 {
-    // Set up a thread to do the compression in the background. It can take a few seconds.
-    QThread *compressionThread = new QThread();
-    FC8Compressor *compressor = new FC8Compressor(uncompressedImage, 65536);
-    compressor->moveToThread(compressionThread);
-    // When the compression finishes, save it in this object. Just doing this to make use of
-    // cross-thread signal functionality.
-    connect(compressor, SIGNAL(compressionFinished(QByteArray,QByteArray)), this, SLOT(compressorThreadFinished(QByteArray,QByteArray)));
-    // When the compression finishes, delete the compressor
-    connect(compressor, SIGNAL(compressionFinished(QByteArray,QByteArray)), compressor, SLOT(deleteLater()));
-    // When the compressor is destroyed, stop the thread
-    connect(compressor, SIGNAL(destroyed()), compressionThread, SLOT(quit()));
-    // When the thread starts, start the compressor
-    connect(compressionThread, SIGNAL(started()), compressor, SLOT(doCompression()));
-    // When the thread stops, it should destroy itself
-    connect(compressionThread, SIGNAL(finished()), compressionThread, SLOT(deleteLater()));
-
-    compressionThread->start();
-
-    if (blockUntilCompletion)
+    // A write that's compressing it as it goes will hand it over when it's done
+    if (romBuilder && romBuilder->isStreaming() && romBuilder->compressedImageHash() == hash)
     {
-        QWidget *prevPage = ui->pages->currentWidget();
-        ui->progressBar->setRange(0, 0);
-        ui->statusLabel->setText("Compressing disk image...");
-        ui->pages->setCurrentWidget(ui->statusPage);
-
-        // Block until the compression is complete, showing a progress bar
-        while (!compressionThread->isFinished() ||
-               !FC8Compressor::hashMatchesFile(compressedImageFileHash, uncompressedImage))
-        {
-            qApp->processEvents();
-        }
+        return;
+    }
 
-        // Restore the page we were on before
-        ui->pages->setCurrentWidget(prevPage);
+    // Compress it in the background. It can take a few seconds, so a sample of the
+    // blocks goes first to get a rough idea of the size sooner. The rest waits
+    // until the estimate is in (this gets called again when it is), so it doesn't
+    // crowd the sample out of the thread pool; the sampled blocks come out of the
+    // block cache when it gets to them, and the estimator's scrubbed copy of the
+    // image is the one that gets compressed.
+    sizeEstimator->start(uncompressedImage, hash);
+    if (sizeEstimator->hashOfImage() == hash && !sizeEstimator->isRunning())
+    {
+        backgroundCompressor->start(sizeEstimator->scrubbedImage(), sizeEstimator->reclaimedBytes(), hash);
     }
 }
 
-QByteArray MainWindow::uncompressedDiskImage()
+void MainWindow::countReclaimedBytesInBackground(QByteArray uncompressedImage, QByteArray hash)
 {
-    const QString diskImageFileName = ui->chosenDiskImageFile->text();
-    QFile f(diskImageFileName);
-    if (!f.open(QFile::ReadOnly))
+    // Already on it
+    if (hash == reclaimedBytesWatcherHash && reclaimedBytesWatcher.isRunning())
     {
-        return QByteArray();
+        return;
     }
-    QByteArray data = f.readAll();
-    f.close();
 
-    return data;
+    reclaimedBytesWatcherHash = hash;
+    reclaimedBytesWatcher.setFuture(QtConcurrent::run(&HFSScrubber::reclaimableBytes, uncompressedImage));
 }
 
-QByteArray MainWindow::diskImageToWrite()
+bool MainWindow::findCompressedImage(QByteArray const &uncompressedImage, QByteArray &hash)
 {
-    QByteArray uncompressedImage = uncompressedDiskImage();
+    hash = FC8Compressor::hashOfFile(uncompressedImage);
 
-    // If the selected ROM doesn't support compression, return it uncompressed.
-    // Also, if it's a compressed disk image, return it as is (earlier checks
-    // will have already ensured we are using a supported ROM in that case)
-    if (!checkBaseROMCompressionSupport() || isCompressedDiskImage(uncompressedImage))
+    // If we've compressed it before, even in an earlier session, it's in the cache.
+    // No need to look more than once, though.
+    if (hash != compressedImageFileHash && hash != uncachedImageHash)
     {
-        return uncompressedImage;
-    }
-
-    // Otherwise, return the compressed image which we should have already
-    // verified is good to go. Double check though...it's possible that the file
-    // changed underneath us, in which case we need to compress it again.
-    if (FC8Compressor::hashMatchesFile(compressedImageFileHash, uncompressedImage))
-    {
-        return compressedImage;
-    }
-    else
-    {
-        // It doesn't match, which means the filename hasn't changed but the
-        // content has changed since we last compressed it. Recompress it.
-        compressImageInBackground(uncompressedImage, true);
-
-        // Make sure it matches now
-        if (FC8Compressor::hashMatchesFile(compressedImageFileHash, uncompressedImage))
+        QByteArray compressed;
+        if (compressedImageCache->lookup(hash, FC8_ROM_DISK_BLOCK_SIZE, compressed))
         {
-            return compressedImage;
+            compressedImageFileHash = hash;
+            compressedImage = compressed;
         }
         else
         {
-            // Somehow we failed to recompress it; cause an error to be returned.
-            // Should never happen; just for safeguarding.
-            return QByteArray();
+            uncachedImageHash = hash;
         }
     }
+
+    return hash == compressedImageFileHash;
 }
 
-QByteArray MainWindow::unpatchedBaseROM()
+uint32_t MainWindow::diskImageDecodedSize(QByteArray const &diskImage)
 {
-    QByteArray finalImage;
-    QFile f(ui->chosenBaseROMFile->text());
-    if (!f.open(QFile::ReadOnly))
+    // Compressed images say how big they'll be once they're decompressed
+    uint32_t size = 0;
+    if (FC8Decoder::decodedSize(diskImage, size))
     {
-        return QByteArray();
+        return size;
     }
-    finalImage = f.readAll();
-    f.close();
-    return finalImage;
+    return diskImage.length();
 }
 
-QByteArray MainWindow::patchedBaseROM()
+qint64 MainWindow::maxCompressedImageSize()
 {
-    QByteArray rom = unpatchedBaseROM();
-    uint32_t imageSize = uncompressedDiskImage().length();
-
-    // If we find a base ROM that we know how to modify for the correct disk image size,
-    // perform the modification here.
-    switch (identifyBaseROM())
-    {
-    case BaseROMbbraun8MB:
-        rom[0x52500] = (imageSize >> 24) & 0xFF;
-        rom[0x52501] = (imageSize >> 16) & 0xFF;
-        rom[0x52502] = (imageSize >> 8) & 0xFF;
-        rom[0x52503] = (imageSize >> 0) & 0xFF;
-
-        // bbraun's 8 MB 0.9.6 base image has a bug that can cause a bus error when booting with R+A
-        // if a write is attempted before the ROM disk has been copied to RAM. Work around this
-        // bug if the driver exactly matches the known broken driver. The fix is, when deciding if
-        // a write operation is allowed or not, to look at origdisk instead of drvsts.writeProt.
-        // writeProt can say the drive is writable even though it hasn't been copied to RAM yet.
-        // When origdisk is non-null, we're guaranteed it's in RAM, so it's a safer check.
-        if (QCryptographicHash::hash(rom.mid(0x51D40, 0x7BC), QCryptographicHash::Md5) ==
-            QByteArray("\x0E\x12\x43\x36\x03\x48\x5C\xDE\x2E\x4C\x04\xE3\x30\xF9\xD2\x0B", 16))
-        {
-            // Change opcode from tst.b to tst.l
-            rom[0x521F1] = 0xAA;
-            // Change tested data from drvsts.writeProt to origdisk
-            rom[0x521F3] = 0x22;
-            // Change bne to beq
-            rom[0x521F4] = 0x67;
-        }
-        break;
-    case BaseROMGarrettsWorkshop:
-        rom[0x51DAC] = (imageSize >> 24) & 0xFF;
-        rom[0x51DAD] = (imageSize >> 16) & 0xFF;
-        rom[0x51DAE] = (imageSize >> 8) & 0xFF;
-        rom[0x51DAF] = (imageSize >> 0) & 0xFF;
-        break;
-    case BaseROMbbraunInQuadra:
-    {
-        int offset = offsetToQuadraROMDiskSize(rom);
-        if (offset >= 0)
-        {
-            rom[offset + 0] = (imageSize >> 24) & 0xFF;
-            rom[offset + 1] = (imageSize >> 16) & 0xFF;
-            rom[offset + 2] = (imageSize >> 8) & 0xFF;
-            rom[offset + 3] = (imageSize >> 0) & 0xFF;
-        }
-        break;
-    }
-    case BaseROMUnknown:
-    case BaseROMbbraun2MB:
-    case BaseROMBMOW:
-    default:
-        break;
-    }
-
-    return rom;
+    const qint64 simmSize = selectedSIMMCapacity();
+    return simmSize - QFileInfo(ui->chosenBaseROMFile->text()).size();
 }
 
-QByteArray MainWindow::createROM()
+QByteArray MainWindow::uncompressedDiskImage()
 {
-    QByteArray finalImage;
-    QByteArray baseROM = patchedBaseROM();
-    if (baseROM.isEmpty())
-    {
-        return QByteArray();
-    }
-
-    finalImage = baseROM;
-
-    QByteArray diskImage = diskImageToWrite();
-    if (diskImage.isEmpty())
-    {
-        return QByteArray();
-    }
-    finalImage += diskImage;
+    return fileCache->contents(ui->chosenDiskImageFile->text());
+}
 
-    return finalImage;
+QByteArray MainWindow::unpatchedBaseROM()
+{
+    return fileCache->contents(ui->chosenBaseROMFile->text());
 }
 
 QString MainWindow::displayableFileSize(qint64 size)
@@ -2703,55 +2509,155 @@ QString MainWindow::displayableFileSize(qint64 size)
 
 void MainWindow::on_writeCombinedFileToSIMMButton_clicked()
 {
-    QByteArray dataToWrite = createROM();
-    if (dataToWrite.isEmpty())
+    // If it's still being compressed, the ROM builder takes over and compresses it
+    // while it's written. Whatever the background compressor already got through is
+    // in the block cache, so none of that is wasted.
+    if (backgroundCompressor->isRunning())
     {
-        showMessageBox(QMessageBox::Warning, "Error combining files", "The ROM and disk image were unable to be combined. Make sure you chose the correct files.");
-        return;
+        backgroundCompressor->cancel();
     }
 
-    QBuffer *combinedFile = new QBuffer();
-    combinedFile->setData(dataToWrite);
-    doInternalWrite(combinedFile);
+    // It gets written once it's been put together
+    startROMBuild(QString());
 }
 
 void MainWindow::on_saveCombinedFileButton_clicked()
 {
-    QByteArray dataToWrite = createROM();
-    if (dataToWrite.isEmpty())
+    // Ask first, so there's nothing to wait for after the ROM is put together
+    QString filename = QFileDialog::getSaveFileName(this, "Save combined ROM and disk image as:");
+    if (!filename.isNull())
     {
-        showMessageBox(QMessageBox::Warning, "Error combining files", "The ROM and disk image were unable to be combined. Make sure you chose the correct files.");
-        return;
+        startROMBuild(filename);
     }
+}
 
-    QString filename = QFileDialog::getSaveFileName(this, "Save combined ROM and disk image as:");
-    if (!filename.isNull())
+void MainWindow::startROMBuild(QString const &saveFileName)
+{
+    if (!romBuilder)
     {
-        QFile f(filename);
-        if (!f.open(QFile::WriteOnly))
-        {
-            showMessageBox(QMessageBox::Warning, "Error opening output file", "Unable to open file for writing. Make sure you have correct file permissions.");
-            return;
-        }
+        romBuilder = new ROMBuilder(&fc8BlockCache, compressedImageCache, this);
+        connect(romBuilder, SIGNAL(progressChanged(QString,int,int)), SLOT(romBuildProgressChanged(QString,int,int)));
+        connect(romBuilder, SIGNAL(finished(bool)), SLOT(romBuildFinished(bool)));
+        connect(romBuilder, SIGNAL(compressedImageReady()), SLOT(romBuildCompressedImageReady()));
+    }
 
-        bool success = f.write(dataToWrite) == dataToWrite.length();
-        f.close();
+    romBuildSaveFileName = saveFileName;
 
-        if (success)
-        {
-            showMessageBox(QMessageBox::Information, "Save complete", "The combined ROM image was saved successfully.");
-        }
-        else
+    ROMBuilder::Inputs inputs;
+    inputs.baseROM = unpatchedBaseROM();
+    inputs.diskImage = uncompressedDiskImage();
+    inputs.blockSize = FC8_ROM_DISK_BLOCK_SIZE;
+    inputs.compressedImageHash = compressedImageFileHash;
+    inputs.compressedImage = compressedImage;
+    if (saveFileName.isEmpty())
+    {
+        // Going straight to the SIMM, so the write can get started while the
+        // disk image is still being compressed. It can't be any bigger than
+        // what's going to be written.
+        const uint howMuchToErase = ui->howMuchToWriteBox->itemData(ui->howMuchToWriteBox->currentIndex()).toUInt();
+        inputs.streamLimit = howMuchToErase ? qMin(static_cast<qint64>(howMuchToErase), selectedSIMMCapacity()) : selectedSIMMCapacity();
+    }
+
+    resetAndShowStatusPage();
+    ui->cancelButton->setEnabled(true);
+    romBuilder->start(inputs);
+}
+
+void MainWindow::romBuildProgressChanged(QString const &stage, int value, int max)
+{
+    ui->statusLabel->setText(stage);
+    ui->progressBar->setRange(0, max);
+    ui->progressBar->setValue(value);
+}
+
+void MainWindow::romBuildCompressedImageReady()
+{
+    // If the disk image had to be compressed, hang on to it for next time
+    if (!romBuilder->compressedImage().isEmpty() &&
+        romBuilder->compressedImageHash() != compressedImageFileHash)
+    {
+        compressedImageFileHash = romBuilder->compressedImageHash();
+        compressedImage = romBuilder->compressedImage();
+        updateCreateROMControlStatus();
+    }
+}
+
+void MainWindow::romBuildFinished(bool succeeded)
+{
+    romBuildCompressedImageReady();
+
+    if (!succeeded)
+    {
+        returnToControlPage();
+        if (!romBuilder->wasCancelled())
         {
-            showMessageBox(QMessageBox::Warning, "Error writing output file", "Unable to save combined ROM image.");
+            QString message = "The ROM and disk image were unable to be combined. Make sure you chose the correct files.";
+            if (!romBuilder->errorString().isEmpty())
+            {
+                message += "\n\n" + romBuilder->errorString();
+            }
+            showMessageBox(QMessageBox::Warning, "Error combining files", message);
         }
+        return;
+    }
+
+    // The base ROM and disk image are read from where they are as they're
+    // written, whichever way they're going
+    CombinedROMDevice *combinedFile = romBuilder->takeResult();
+    if (romBuildSaveFileName.isEmpty())
+    {
+        doInternalWrite(combinedFile);
+        return;
+    }
+
+    returnToControlPage();
+
+    QFile f(romBuildSaveFileName);
+    if (!f.open(QFile::WriteOnly))
+    {
+        delete combinedFile;
+        showMessageBox(QMessageBox::Warning, "Error opening output file", "Unable to open file for writing. Make sure you have correct file permissions.");
+        return;
+    }
+
+    bool success = combinedFile && combinedFile->open(QIODevice::ReadOnly);
+    while (success && !combinedFile->atEnd())
+    {
+        const QByteArray chunk = combinedFile->read(combinedROMSaveChunkSize);
+        success = !chunk.isEmpty() && f.write(chunk) == chunk.length();
+    }
+    f.close();
+    delete combinedFile;
+
+    if (success)
+    {
+        showMessageBox(QMessageBox::Information, "Save complete", "The combined ROM image was saved successfully.");
+    }
+    else
+    {
+        showMessageBox(QMessageBox::Warning, "Error writing output file", "Unable to save combined ROM image.");
+    }
+}
+
+void MainWindow::backgroundCompressionFinished()
+{
+    reclaimedBytesHash = backgroundCompressor->hashOfImage();
+    reclaimedBytes = backgroundCompressor->reclaimedBytes();
+
+    // If it didn't work, the ROM builder will say why when it tries it for real.
+    // It's already been saved in the cache for next time.
+    if (!backgroundCompressor->compressedImage().isEmpty())
+    {
+        compressedImageFileHash = backgroundCompressor->hashOfImage();
+        compressedImage = backgroundCompressor->compressedImage();
     }
+    updateCreateROMControlStatus();
 }
 
-void MainWindow::compressorThreadFinished(QByteArray hashOfOriginal, QByteArray compressedData)
+void MainWindow::reclaimedBytesCounted()
 {
-    compressedImageFileHash = hashOfOriginal;
-    compressedImage = compressedData;
+    reclaimedBytesHash = reclaimedBytesWatcherHash;
+    reclaimedBytes = reclaimedBytesWatcher.result();
     updateCreateROMControlStatus();
 }
 
@@ -3018,3 +2924,126 @@ void MainWindow::programmerFirmwareVersionStatusChanged(ReadFirmwareVersionStatu
         break;
     }
 }
+
+void MainWindow::on_cancelButton_clicked()
+{
+    // Putting together a ROM to write doesn't involve the programmer yet
+    if (romBuilder && romBuilder->isRunning())
+    {
+        ui->cancelButton->setEnabled(false);
+        ui->statusLabel->setText("Cancelling...");
+        romBuilder->cancel();
+        return;
+    }
+
+    // The programmer will finish up at the next safe point and report back
+    // through the usual "cancelled" status, which returns us to the control page.
+    ui->cancelButton->setEnabled(false);
+    ui->statusLabel->setText("Cancelling...");
+    p->cancel();
+}
+
+// Talks to a simulated programmer board instead of a real one, for trying things
+// out without hardware. There's no going back to a real board after this.
+void MainWindow::useSimulatedProgrammer()
+{
+    if (simulatedProgrammer)
+    {
+        return;
+    }
+
+    simulatedProgrammer = new SimulatedProgrammer(SIMM_BANK_SIZE, this);
+    p->setTransport(simulatedProgrammer);
+    setWindowTitle(windowTitle() + " (simulated programmer)");
+    programmerBoardConnected();
+}
+
+void MainWindow::on_actionRecord_protocol_trace_triggered(bool checked)
+{
+    if (!checked)
+    {
+        p->stopTrace();
+        return;
+    }
+
+    QString filename = QFileDialog::getSaveFileName(this, "Save protocol trace as:", QString(), "Protocol traces (*.simmtrace)");
+    if (filename.isNull() || !p->startTrace(filename))
+    {
+        ui->actionRecord_protocol_trace->setChecked(false);
+        if (!filename.isNull())
+        {
+            showMessageBox(QMessageBox::Warning, "Unable to record trace", "Unable to create the trace file.");
+        }
+    }
+}
+
+void MainWindow::on_actionReplay_protocol_trace_triggered(bool checked)
+{
+    if (!checked)
+    {
+        // Back to the real thing (or the simulated one, if that's what we were using)
+        p->setTransport(simulatedProgrammer);
+        delete traceReplay;
+        traceReplay = NULL;
+        if (simulatedProgrammer || p->isBoardConnected())
+        {
+            programmerBoardConnected();
+        }
+        else
+        {
+            programmerBoardDisconnected();
+        }
+        return;
+    }
+
+    QString filename = QFileDialog::getOpenFileName(this, "Select a protocol trace to replay:", QString(), "Protocol traces (*.simmtrace)");
+    if (filename.isNull())
+    {
+        ui->actionReplay_protocol_trace->setChecked(false);
+        return;
+    }
+
+    traceReplay = new ProtocolTraceReplay(this);
+    if (!traceReplay->load(filename))
+    {
+        delete traceReplay;
+        traceReplay = NULL;
+        ui->actionReplay_protocol_trace->setChecked(false);
+        showMessageBox(QMessageBox::Warning, "Unable to replay trace", "The file you chose is not a valid protocol trace.");
+        return;
+    }
+
+    // The trace stands in for the programmer board until replay is turned off.
+    // Perform the same operation that was recorded to play it back.
+    connect(traceReplay, SIGNAL(diverged(int)), SLOT(traceReplayDiverged(int)));
+    p->setTransport(traceReplay);
+    programmerBoardConnected();
+}
+
+void MainWindow::traceReplayDiverged(int eventIndex)
+{
+    showMessageBox(QMessageBox::Warning, "Replay diverged",
+                   QString("The programmer sent something different from what was recorded (at event %1 of the trace). "
+                           "Make sure you are repeating the same operation with the same settings that were used when it was recorded.").arg(eventIndex));
+}
+
+void MainWindow::on_actionBenchmark_link_triggered()
+{
+    if (!linkBenchmark)
+    {
+        linkBenchmark = new LinkBenchmark(p, this);
+        connect(linkBenchmark, SIGNAL(statusChanged(QString)), ui->statusLabel, SLOT(setText(QString)));
+        connect(linkBenchmark, SIGNAL(finished(bool)), SLOT(linkBenchmarkFinished(bool)));
+    }
+
+    resetAndShowStatusPage();
+    ui->cancelButton->setEnabled(true);
+    linkBenchmark->start();
+}
+
+void MainWindow::linkBenchmarkFinished(bool succeeded)
+{
+    returnToControlPage();
+    showMessageBox(succeeded ? QMessageBox::Information : QMessageBox::Warning,
+                   "Connection benchmark", linkBenchmark->report());
+}
@@ -23,7 +23,17 @@
 #include <QMainWindow>
 #include <QFile>
 #include <QMessageBox>
+#include <QFutureWatcher>
 #include "programmer.h"
+#include "simulatedprogrammer.h"
+#include "linkbenchmark.h"
+#include "simminterleaver.h"
+#include "romsignatures.h"
+#include "filecontentcache.h"
+#include "compressedimagecache.h"
+#include "rombuilder.h"
+#include "fc8backgroundcompressor.h"
+#include "fc8sizeestimator.h"
 
 namespace Ui {
 class MainWindow;
@@ -37,6 +47,8 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
+    void useSimulatedProgrammer();
+
 private slots:
     void on_selectWriteFileButton_clicked();
     void on_selectReadFileButton_clicked();
@@ -53,24 +65,16 @@ private slots:
     void on_createROMGroupBox_fileDropped(const QString &filePath);
 
     void programmerWriteStatusChanged(WriteStatus newStatus);
-    void programmerWriteTotalLengthChanged(uint32_t totalLen);
-    void programmerWriteCompletionLengthChanged(uint32_t len);
-
-    void programmerVerifyTotalLengthChanged(uint32_t totalLen);
-    void programmerVerifyCompletionLengthChanged(uint32_t len);
+    void programmerProgressUpdated();
 
     void programmerElectricalTestStatusChanged(ElectricalTestStatus newStatus);
     void programmerElectricalTestLocation(uint8_t loc1, uint8_t loc2);
 
     void programmerReadStatusChanged(ReadStatus newStatus);
-    void programmerReadTotalLengthChanged(uint32_t totalLen);
-    void programmerReadCompletionLengthChanged(uint32_t len);
 
     void programmerIdentifyStatusChanged(IdentificationStatus newStatus);
 
     void programmerFirmwareFlashStatusChanged(FirmwareFlashStatus newStatus);
-    void programmerFirmwareFlashTotalLengthChanged(uint32_t totalLen);
-    void programmerFirmwareFlashCompletionLengthChanged(uint32_t len);
 
     void programmerFirmwareVersionStatusChanged(ReadFirmwareVersionStatus status, uint32_t version);
 
@@ -105,11 +109,10 @@ private slots:
 
     void on_multiFlashChipsButton_clicked();
     void on_multiReadChipsButton_clicked();
-    void finishMultiRead();
+    bool finishMultiRead();
 
     void on_verifyROMChecksumButton_clicked();
     void finishChecksumVerify();
-    bool calculateROMChecksum(QByteArray const &rom, uint32_t len, uint32_t &checksum);
 
     void on_selectBaseROMButton_clicked();
     void on_selectDiskImageButton_clicked();
@@ -118,8 +121,12 @@ private slots:
     void updateCreateROMControlStatus();
     void on_writeCombinedFileToSIMMButton_clicked();
     void on_saveCombinedFileButton_clicked();
+    void romBuildProgressChanged(QString const &stage, int value, int max);
+    void romBuildFinished(bool succeeded);
+    void romBuildCompressedImageReady();
 
-    void compressorThreadFinished(QByteArray hashOfOriginal, QByteArray compressedData);
+    void backgroundCompressionFinished();
+    void reclaimedBytesCounted();
 
     void messageBoxFinished();
 
@@ -127,6 +134,15 @@ private slots:
 
     void on_actionCreate_blank_disk_image_triggered();
 
+    void on_cancelButton_clicked();
+
+    void on_actionRecord_protocol_trace_triggered(bool checked);
+    void on_actionReplay_protocol_trace_triggered(bool checked);
+    void traceReplayDiverged(int eventIndex);
+
+    void on_actionBenchmark_link_triggered();
+    void linkBenchmarkFinished(bool succeeded);
+
 private:
     Ui::MainWindow *ui;
     bool initializing;
@@ -139,16 +155,25 @@ private:
     QByteArray compressedImageFileHash;
     QByteArray compressedImage;
     QMessageBox *activeMessageBox;
-
-    enum KnownBaseROM
-    {
-        BaseROMUnknown,
-        BaseROMbbraun2MB,
-        BaseROMbbraun8MB,
-        BaseROMBMOW,
-        BaseROMGarrettsWorkshop,
-        BaseROMbbraunInQuadra,
-    };
+    ProtocolTraceReplay *traceReplay;
+    SimulatedProgrammer *simulatedProgrammer;
+    LinkBenchmark *linkBenchmark;
+    FileContentCache *fileCache;
+    CompressedImageCache *compressedImageCache;
+    ROMBuilder *romBuilder;
+    QString romBuildSaveFileName;
+    FC8BackgroundCompressor *backgroundCompressor;
+    // The last image the compressed image cache didn't have
+    QByteArray uncachedImageHash;
+    // How much of the last image's free space scrubbing clears
+    QByteArray reclaimedBytesHash;
+    qint64 reclaimedBytes;
+    // Counting it when the compressed image came from somewhere else
+    QFutureWatcher<qint64> reclaimedBytesWatcher;
+    QByteArray reclaimedBytesWatcherHash;
+    FC8SizeEstimator *sizeEstimator;
+    QByteArray checkedCompressedImage;
+    QString checkedCompressedImageError;
 
     void resetAndShowStatusPage();
     void handleVerifyFailureReply();
@@ -157,19 +182,22 @@ private:
     void showFlashIndividualControls();
 
     void returnToControlPage();
+    SIMMLaneLayout simmLaneLayout() const;
+
+    qint64 selectedSIMMCapacity() const;
 
     bool checkBaseROMValidity(QString &errorText);
-    bool checkBaseROMCompressionSupport();
-    KnownBaseROM identifyBaseROM(QByteArray const *baseROMToCheck = NULL);
-    int offsetToQuadraROMDiskSize(QByteArray const &baseROM);
+    ROMScanResult identifyBaseROM(QByteArray const *baseROMToCheck = NULL);
     bool checkDiskImageValidity(QString &errorText, bool &alreadyCompressed);
-    bool isCompressedDiskImage(QByteArray const &image);
-    void compressImageInBackground(QByteArray uncompressedImage, bool blockUntilCompletion);
+    bool checkHFSVolume(QByteArray const &image, QString &errorText);
+    uint32_t diskImageDecodedSize(QByteArray const &diskImage);
+    void compressImageInBackground(QByteArray uncompressedImage, QByteArray hash);
+    void countReclaimedBytesInBackground(QByteArray uncompressedImage, QByteArray hash);
+    bool findCompressedImage(QByteArray const &uncompressedImage, QByteArray &hash);
+    qint64 maxCompressedImageSize();
     QByteArray uncompressedDiskImage();
-    QByteArray diskImageToWrite();
     QByteArray unpatchedBaseROM();
-    QByteArray patchedBaseROM();
-    QByteArray createROM();
+    void startROMBuild(QString const &saveFileName);
     QString displayableFileSize(qint64 size);
 
     static QList<QByteArray> separateFirmwareIntoVersions(QByteArray totalFirmware);
@@ -18,6 +18,7 @@
  */
 
 #include "programmer.h"
+#include "programmerprotocol.h"
 #include <QDebug>
 #include <QWaitCondition>
 #include <QMutex>
@@ -37,6 +38,8 @@ typedef enum ProgrammerCommandState
     WriteSIMMWaitingWriteReply,
     WriteSIMMWaitingFinishReply,
     WriteSIMMWaitingWriteMoreReply,
+    WriteSIMMWaitingForData,
+    WriteSIMMWaitingCancelReply,
 
     ElectricalTestWaitingStartReply,
     ElectricalTestWaitingNextStatus,
@@ -67,6 +70,7 @@ typedef enum ProgrammerCommandState
     BootloaderEraseProgramWaitingFinishReply,
     BootloaderEraseProgramWaitingWriteMoreReply,
     BootloaderEraseProgramWaitingWriteReply,
+    BootloaderEraseProgramWaitingCancelReply,
 
     WritePortionWaitingSetSectorLayoutReply,
     WritePortionWaitingSectorLayoutDataReply,
@@ -81,7 +85,10 @@ typedef enum ProgrammerCommandState
 
     ReadFWVersionAwaitingOKReply,
     ReadFWVersionWaitingData,
-    ReadFWVersionAwaitingDoneReply
+    ReadFWVersionAwaitingDoneReply,
+
+    PingAwaitingOKReply,
+    PingAwaitingStateReply
 } ProgrammerCommandState;
 
 typedef enum ProgrammerBoardFoundState
@@ -90,121 +97,9 @@ typedef enum ProgrammerBoardFoundState
     ProgrammerBoardFound
 } ProgrammerBoardFoundState;
 
-typedef enum ProgrammerCommand
-{
-    EnterWaitingMode = 0,
-    DoElectricalTest,
-    IdentifyChips,
-    ReadByte,
-    ReadChips,
-    EraseChips,
-    WriteChips,
-    GetBootloaderState,
-    EnterBootloader,
-    EnterProgrammer,
-    BootloaderEraseAndWriteProgram,
-    SetSIMMLayout_AddressStraight,
-    SetSIMMLayout_AddressShifted,
-    SetVerifyWhileWriting,
-    SetNoVerifyWhileWriting,
-    ErasePortion,
-    WriteChipsAt,
-    ReadChipsAt,
-    SetChipsMask,
-    SetSectorLayout,
-    GetFirmwareVersion
-} ProgrammerCommand;
-
-typedef enum ProgrammerReply
-{
-    CommandReplyOK,
-    CommandReplyError,
-    CommandReplyInvalid
-} ProgrammerReply;
-
-typedef enum ComputerReadReply
-{
-    ComputerReadOK,
-    ComputerReadCancel
-} ComputerReadReply;
-
-typedef enum ProgrammerReadReply
-{
-    ProgrammerReadOK,
-    ProgrammerReadError,
-    ProgrammerReadMoreData,
-    ProgrammerReadFinished,
-    ProgrammerReadConfirmCancel
-} ProgrammerReadReply;
-
-typedef enum ComputerWriteReply
-{
-    ComputerWriteMore,
-    ComputerWriteFinish,
-    ComputerWriteCancel
-} ComputerWriteReply;
-
-typedef enum ProgrammerWriteReply
-{
-    ProgrammerWriteOK,
-    ProgrammerWriteError,
-    ProgrammerWriteConfirmCancel,
-    ProgrammerWriteVerificationError = 0x80 /* high bit */
-} ProgrammerWriteReply;
-
-typedef enum ProgrammerIdentifyReply
-{
-    ProgrammerIdentifyDone
-} ProgrammerIdentifyReply;
-
-typedef enum ProgrammerElectricalTestReply
-{
-    ProgrammerElectricalTestFail,
-    ProgrammerElectricalTestDone
-} ProgrammerElectricalTestReply;
-
-typedef enum BootloaderStateReply
-{
-    BootloaderStateInBootloader,
-    BootloaderStateInProgrammer
-} BootloaderStateReply;
-
-typedef enum ProgrammerBootloaderEraseWriteReply
-{
-    BootloaderWriteOK,
-    BootloaderWriteError,
-    BootloaderWriteConfirmCancel
-} ProgrammerBootloaderEraseWriteReply;
-
-typedef enum ComputerBootloaderEraseWriteRequest
-{
-    ComputerBootloaderWriteMore = 0,
-    ComputerBootloaderFinish,
-    ComputerBootloaderCancel
-} ComputerBootloaderEraseWriteRequest;
-
-typedef enum ProgrammerErasePortionOfChipReply
-{
-    ProgrammerErasePortionOK = 0,
-    ProgrammerErasePortionError,
-    ProgrammerErasePortionFinished
-} ProgrammerErasePortionOfChipReply;
-
-typedef enum ProgrammerGetFWVersionReply
-{
-    ProgrammerGetFWVersionDone
-} ProgrammerGetFWVersionReply;
-
 #define PROGRAMMER_USB_VENDOR_ID            0x16D0
 #define PROGRAMMER_USB_DEVICE_ID            0x06AA
 
-
-#define WRITE_CHUNK_SIZE    1024
-#define READ_CHUNK_SIZE     1024
-#define FIRMWARE_CHUNK_SIZE 1024
-
-#define BLOCK_ERASE_SIZE    (256*1024UL)
-
 static ProgrammerCommandState curState = WaitingForNextCommand;
 
 // After identifying that we're in the main program, what will be the command
@@ -216,34 +111,41 @@ static ProgrammerBoardFoundState foundState = ProgrammerBoardNotFound;
 static QString programmerBoardPortName;
 
 Programmer::Programmer(QObject *parent) :
-    QObject(parent),
-    _chipID(":/chipid/chipid.txt")
+    QObject(parent)
 {
     detectedDeviceRevision = 0;
     identifyIsForWriteAttempt = false;
     identifyWriteIsEntireSIMM = false;
     _verifyMode = VerifyAfterWrite;
     _verifyBadChipMask = 0;
-    verifyArray = new QByteArray();
-    verifyBuffer = new QBuffer(verifyArray);
+    cancelRequested = false;
+    pingCount = 0;
+    pingWarmedUp = false;
+    // The array to verify into comes from the buffer pool, only while verifying
+    verifyArray = NULL;
+    verifyBuffer = new QBuffer();
     verifyBuffer->open(QBuffer::ReadWrite);
     serialPort = new QextSerialPort(QextSerialPort::EventDriven);
-    connect(serialPort, SIGNAL(readyRead()), SLOT(dataReady()));
+    transport = serialPort;
+    connect(transport, SIGNAL(readyRead()), SLOT(dataReady()));
+    connect(&writeSource, SIGNAL(pieceReady()), SLOT(writeSourceReady()));
 }
 
 Programmer::~Programmer()
 {
     closePort();
     delete serialPort;
+    finishVerifyBuffer();
     verifyBuffer->close();
     delete verifyBuffer;
-    delete verifyArray;
 }
 
 void Programmer::readSIMM(QIODevice *device, uint32_t len)
 {
     // We're not verifying in this case
     isReadVerifying = false;
+    cancelRequested = false;
+    _progress.startJob();
     internalReadSIMM(device, len);
 }
 
@@ -288,6 +190,7 @@ void Programmer::writeToSIMM(QIODevice *device, uint8_t chipsMask)
 {
     writeDevice = device;
     writeChipMask = chipsMask;
+    cancelRequested = false;
     if (writeDevice->size() > SIMMCapacity())
     {
         curState = WaitingForNextCommand;
@@ -300,6 +203,9 @@ void Programmer::writeToSIMM(QIODevice *device, uint8_t chipsMask)
         writeLenRemaining = writeDevice->size();
         writeOffset = 0;
 
+        // Get the data coming while the chips are identified and erased
+        writeSource.start(writeDevice, writeLenRemaining);
+
         // Start out by identifying the chips so that we can send the correct
         // erase sector layout. We have to save some flags to indicate that the
         // identification is the start of a write. This isn't strictly necessary
@@ -307,6 +213,8 @@ void Programmer::writeToSIMM(QIODevice *device, uint8_t chipsMask)
         identifyIsForWriteAttempt = true;
         identifyWriteIsEntireSIMM = true;
         identificationShiftCounter = 0;
+        _progress.startJob();
+        _progress.startPhase(JobProgress::PhaseIdentify);
         startProgrammerCommand(SetSIMMLayout_AddressStraight, IdentificationWaitingSetSizeReply);
     }
 }
@@ -315,6 +223,7 @@ void Programmer::writeToSIMM(QIODevice *device, uint32_t startOffset, uint32_t l
 {
     writeDevice = device;
     writeChipMask = chipsMask;
+    cancelRequested = false;
     if ((writeDevice->size() > SIMMCapacity()) ||
          (startOffset + length > SIMMCapacity()))
     {
@@ -339,6 +248,7 @@ void Programmer::writeToSIMM(QIODevice *device, uint32_t startOffset, uint32_t l
         device->seek(startOffset);
         writeOffset = startOffset;
         writeLength = length;
+        writeSource.start(writeDevice, writeLenRemaining);
 
         // Start out by identifying the chips so that we can send the correct
         // erase sector layout. We have to save some flags to indicate that the
@@ -346,13 +256,16 @@ void Programmer::writeToSIMM(QIODevice *device, uint32_t startOffset, uint32_t l
         identifyIsForWriteAttempt = true;
         identifyWriteIsEntireSIMM = false;
         identificationShiftCounter = 0;
+        _progress.startJob();
+        _progress.startPhase(JobProgress::PhaseIdentify);
         startProgrammerCommand(SetSIMMLayout_AddressStraight, IdentificationWaitingSetSizeReply);
     }
 }
 
 void Programmer::sendByte(uint8_t b)
 {
-    serialPort->write((const char *)&b, 1);
+    traceRecorder.record(ProtocolTraceEvent::Transmit, (const char *)&b, 1);
+    transport->write((const char *)&b, 1);
 }
 
 void Programmer::sendWord(uint32_t w)
@@ -363,19 +276,28 @@ void Programmer::sendWord(uint32_t w)
     sendByte((w >> 24) & 0xFF);
 }
 
-uint8_t Programmer::readByte()
+void Programmer::sendData(QByteArray const &data)
 {
-    uint8_t returnVal;
-    serialPort->read((char *)&returnVal, 1);
-    // TODO: Error checking if read fails?
-    return returnVal;
+    traceRecorder.record(ProtocolTraceEvent::Transmit, data);
+    transport->write(data);
 }
 
 void Programmer::dataReady()
 {
-    while (!serialPort->atEnd())
+    // Grab everything that has arrived at once rather than a byte at a time
+    QByteArray data = transport->readAll();
+    traceRecorder.record(ProtocolTraceEvent::Receive, data);
+    for (int x = 0; x < data.size(); x++)
     {
-        handleChar(readByte());
+        handleChar(static_cast<uint8_t>(data.at(x)));
+
+        // If that finished (or gave up on) whatever was going on, the port is
+        // closed and anything else that came in with it is left over from a job
+        // that's over now
+        if (!transport->isOpen())
+        {
+            break;
+        }
     }
 }
 
@@ -611,6 +533,7 @@ void Programmer::handleChar(uint8_t c)
                 // Special case: Send out notification we are starting an erase command.
                 // I don't have any hooks into the process between now and the erase reply.
                 emit writeStatusChanged(WriteErasing);
+                _progress.startPhase(JobProgress::PhaseErase);
                 if (curState == WriteSIMMWaitingSetChipMaskReply)
                 {
                     sendByte(EraseChips);
@@ -646,6 +569,7 @@ void Programmer::handleChar(uint8_t c)
             // Special case: Send out notification we are starting an erase command.
             // I don't have any hooks into the process between now and the erase reply.
             emit writeStatusChanged(WriteErasing);
+            _progress.startPhase(JobProgress::PhaseErase);
             if (curState == WriteSIMMWaitingSetChipMaskValueReply)
             {
                 sendByte(EraseChips);
@@ -675,12 +599,18 @@ void Programmer::handleChar(uint8_t c)
         switch (c)
         {
         case CommandReplyOK:
+            // The erase can't be interrupted, but we can stop before writing anything
+            if (handlePendingCancel(curState))
+            {
+                break;
+            }
             sendByte(WriteChips);
             curState = WriteSIMMWaitingWriteReply;
             qDebug() << "Chips erased. Now asking to start writing...";
             emit writeStatusChanged(WriteEraseComplete);
             emit writeTotalLengthChanged(writeLenRemaining);
             emit writeCompletionLengthChanged(lenWritten);
+            _progress.startPhase(JobProgress::PhaseWrite, writeLenRemaining);
             break;
         case CommandReplyError:
             qDebug() << "Error erasing chips.";
@@ -742,6 +672,10 @@ void Programmer::handleChar(uint8_t c)
         case ProgrammerErasePortionFinished:
             // we're done erasing, now it's time to write the data
             // starting at where we wanted to flash to
+            if (handlePendingCancel(curState))
+            {
+                break;
+            }
             sendByte(WriteChipsAt);
             curState = WritePortionWaitingWriteAtReply;
             qDebug() << "Chips partially erased. Now asking to start writing...";
@@ -769,6 +703,7 @@ void Programmer::handleChar(uint8_t c)
             curState = WriteSIMMWaitingWriteReply;
             emit writeTotalLengthChanged(writeLenRemaining);
             emit writeCompletionLengthChanged(lenWritten);
+            _progress.startPhase(JobProgress::PhaseWrite, writeLenRemaining);
             qDebug() << "Partial write command accepted, sending offset...";
             break;
         case CommandReplyError:
@@ -803,19 +738,7 @@ void Programmer::handleChar(uint8_t c)
             switch (c)
             {
             case CommandReplyOK:
-                // We're in write SIMM mode. Now ask to start writing
-                if (writeLenRemaining > 0)
-                {
-                    sendByte(ComputerWriteMore);
-                    curState = WriteSIMMWaitingWriteMoreReply;
-                    qDebug() << "Write more..." << writeLenRemaining << "remaining.";
-                }
-                else
-                {
-                    sendByte(ComputerWriteFinish);
-                    curState = WriteSIMMWaitingFinishReply;
-                    qDebug() << "Finished writing. Sending write finish command...";
-                }
+                continueWrite();
                 break;
             case CommandReplyError:
                 qDebug() << "Error entering write mode.";
@@ -845,18 +768,22 @@ void Programmer::handleChar(uint8_t c)
                 chunkSize = writeLenRemaining;
             }
 
-            // Read the chunk from the file!
-            QByteArray thisChunk = writeDevice->read(chunkSize);
-
-            // If it isn't a WRITE_CHUNK_SIZE chunk, pad the rest of it with 0xFFs (unprogrammed bytes)
-            // so the total chunk size is WRITE_CHUNK_SIZE, since that's what the programmer board expects.
-            for (int x = writeLenRemaining; x < WRITE_CHUNK_SIZE; x++)
+            // Grab the chunk; it's already been read (or mapped). If it isn't a WRITE_CHUNK_SIZE
+            // chunk, the rest of it is padded with 0xFFs (unprogrammed bytes) so the total chunk
+            // size is WRITE_CHUNK_SIZE, since that's what the programmer board expects.
+            const QByteArray thisChunk = writeSource.take(chunkSize, WRITE_CHUNK_SIZE, static_cast<char>(0xFF));
+            if (thisChunk.length() != WRITE_CHUNK_SIZE)
             {
-                thisChunk.append(0xFF);
+                // It's too late to go back and shrink the write, so this is as far as we get
+                qDebug() << "Unable to read data to write:" << writeSource.errorString();
+                curState = WaitingForNextCommand;
+                closePort();
+                emit writeStatusChanged(WriteError);
+                break;
             }
 
             // Write the chunk out (it's asynchronous so will return immediately)
-            serialPort->write(thisChunk);
+            sendData(thisChunk);
 
             // OK, now we're waiting to hear back from the programmer on the result
             qDebug() << "Waiting for status reply...";
@@ -864,6 +791,7 @@ void Programmer::handleChar(uint8_t c)
             writeLenRemaining -= chunkSize;
             lenWritten += chunkSize;
             emit writeCompletionLengthChanged(lenWritten);
+            _progress.setCompletedBytes(lenWritten);
             break;
         }
         case ProgrammerWriteError:
@@ -877,6 +805,23 @@ void Programmer::handleChar(uint8_t c)
         break;
     }
 
+    // Expecting reply from programmer after we told it to cancel the write
+    case WriteSIMMWaitingCancelReply:
+        cancelRequested = false;
+        curState = WaitingForNextCommand;
+        closePort();
+        if (c == ProgrammerWriteConfirmCancel)
+        {
+            qDebug() << "Write cancelled.";
+            emit writeStatusChanged(WriteCancelled);
+        }
+        else
+        {
+            qDebug() << "Unexpected reply to write cancel:" << c;
+            emit writeStatusChanged(WriteError);
+        }
+        break;
+
     // Expecting reply from programmer after we told it we're done writing
     case WriteSIMMWaitingFinishReply:
         switch (c)
@@ -886,9 +831,11 @@ void Programmer::handleChar(uint8_t c)
             {
                 isReadVerifying = true;
 
+                // Everything has been written, so the device is ours again
+                writeSource.stop();
+
                 // Ensure the verify buffer is empty
-                verifyArray->clear();
-                verifyBuffer->seek(0);
+                startVerifyBuffer();
                 verifyLength = lenWritten;
 
                 // Start reading from the SIMM now!
@@ -1019,8 +966,7 @@ void Programmer::handleChar(uint8_t c)
             else
             {
                 // Ensure the verify buffer is empty if we were verifying
-                verifyArray->clear();
-                verifyBuffer->seek(0);
+                finishVerifyBuffer();
                 emit writeStatusChanged(WriteVerifyError);
             }
             break;
@@ -1043,6 +989,7 @@ void Programmer::handleChar(uint8_t c)
                 emit writeVerifyTotalLengthChanged(lenRemaining);
                 emit writeVerifyCompletionLengthChanged(0);
             }
+            _progress.startPhase(isReadVerifying ? JobProgress::PhaseVerify : JobProgress::PhaseRead, lenRemaining);
             readChunkLenRemaining = READ_CHUNK_SIZE;
             break;
         case ProgrammerReadError:
@@ -1056,8 +1003,7 @@ void Programmer::handleChar(uint8_t c)
             else
             {
                 // Ensure the verify buffer is empty if we were verifying
-                verifyArray->clear();
-                verifyBuffer->seek(0);
+                finishVerifyBuffer();
                 emit writeStatusChanged(WriteVerifyError);
             }
             break;
@@ -1083,8 +1029,11 @@ void Programmer::handleChar(uint8_t c)
             {
                 emit writeVerifyCompletionLengthChanged(lenRead);
             }
+            _progress.setCompletedBytes(lenRead);
             qDebug() << "Received a chunk of data";
-            sendByte(ComputerReadOK);
+            // If a cancel is pending, tell the programmer to stop instead of asking
+            // for more. It will confirm the cancel in its status reply.
+            sendByte(cancelRequested ? ComputerReadCancel : ComputerReadOK);
             curState = ReadSIMMWaitingStatusReply;
         }
         break;
@@ -1095,6 +1044,7 @@ void Programmer::handleChar(uint8_t c)
         switch (c)
         {
         case ProgrammerReadFinished:
+            cancelRequested = false;
             curState = WaitingForNextCommand;
             closePort();
             if (!isReadVerifying)
@@ -1107,6 +1057,7 @@ void Programmer::handleChar(uint8_t c)
             }
             break;
         case ProgrammerReadConfirmCancel:
+            cancelRequested = false;
             curState = WaitingForNextCommand;
             closePort();
             if (!isReadVerifying)
@@ -1116,8 +1067,7 @@ void Programmer::handleChar(uint8_t c)
             else
             {
                 // Ensure the verify buffer is empty if we were verifying
-                verifyArray->clear();
-                verifyBuffer->seek(0);
+                finishVerifyBuffer();
                 emit writeStatusChanged(WriteVerifyCancelled);
             }
             break;
@@ -1157,7 +1107,10 @@ void Programmer::handleChar(uint8_t c)
             qDebug() << "We're in the bootloader, so sending an \"enter programmer\" request.";
             emit startStatusChanged(ProgrammerInitializing);
             sendByte(EnterProgrammer);
-            serialPort->flush();
+            if (transport == serialPort)
+            {
+                serialPort->flush();
+            }
             closePort();
 
             // Now wait for it to reconnect
@@ -1169,6 +1122,10 @@ void Programmer::handleChar(uint8_t c)
             // to begin whatever sequence of events we expected.
             qDebug() << "Already in programmer. Good! Do the command now...";
             emit startStatusChanged(ProgrammerInitialized);
+            if (handlePendingCancel(nextState))
+            {
+                break;
+            }
             curState = nextState;
             sendByte(nextSendByte);
             break;
@@ -1202,7 +1159,10 @@ void Programmer::handleChar(uint8_t c)
             qDebug() << "We're in the programmer, so sending an \"enter bootloader\" request.";
             emit startStatusChanged(ProgrammerInitializing);
             sendByte(EnterBootloader);
-            serialPort->flush();
+            if (transport == serialPort)
+            {
+                serialPort->flush();
+            }
             closePort();
 
             // Now wait for it to reconnect
@@ -1214,6 +1174,10 @@ void Programmer::handleChar(uint8_t c)
             // to begin whatever sequence of events we expected.
             qDebug() << "Already in bootloader. Good! Do the command now...";
             emit startStatusChanged(ProgrammerInitialized);
+            if (handlePendingCancel(nextState))
+            {
+                break;
+            }
             curState = nextState;
             sendByte(nextSendByte);
             break;
@@ -1292,6 +1256,7 @@ void Programmer::handleChar(uint8_t c)
         else
         {
             // Error -- close the port, we're done!
+            curState = WaitingForNextCommand;
             closePort();
             if (!identifyIsForWriteAttempt)
             {
@@ -1301,7 +1266,6 @@ void Programmer::handleChar(uint8_t c)
             {
                 emit writeStatusChanged(WriteError);
             }
-            curState = WaitingForNextCommand;
         }
         break;
 
@@ -1463,7 +1427,7 @@ void Programmer::handleChar(uint8_t c)
             }
 
             // Write the chunk out (it's asynchronous so will return immediately)
-            serialPort->write(thisChunk);
+            sendData(thisChunk);
 
             // OK, now we're waiting to hear back from the programmer on the result
             qDebug() << "Waiting for status reply...";
@@ -1471,6 +1435,7 @@ void Programmer::handleChar(uint8_t c)
             firmwareLenRemaining -= chunkSize;
             firmwareLenWritten += chunkSize;
             emit firmwareFlashCompletionLengthChanged(firmwareLenWritten);
+            _progress.setCompletedBytes(firmwareLenWritten);
         }
         else
         {
@@ -1487,8 +1452,14 @@ void Programmer::handleChar(uint8_t c)
     case BootloaderEraseProgramWaitingWriteReply:
         if (c == CommandReplyOK)
         {
-            // Either ask to send the next chunk, or send a "finish" response
-            if (firmwareLenRemaining > 0)
+            // Either ask to send the next chunk, or send a "finish" response.
+            // This is also the point where we can cancel if we've been asked to.
+            if (cancelRequested)
+            {
+                sendByte(ComputerBootloaderCancel);
+                curState = BootloaderEraseProgramWaitingCancelReply;
+            }
+            else if (firmwareLenRemaining > 0)
             {
                 sendByte(ComputerBootloaderWriteMore);
                 curState = BootloaderEraseProgramWaitingWriteMoreReply;
@@ -1510,6 +1481,24 @@ void Programmer::handleChar(uint8_t c)
         }
         break;
 
+    // Expecting reply after we told the bootloader to cancel the firmware flash
+    case BootloaderEraseProgramWaitingCancelReply:
+        cancelRequested = false;
+        curState = WaitingForNextCommand;
+        closePort();
+        firmwareFile->close();
+        delete firmwareFile;
+        firmwareFile = NULL;
+        if (c == BootloaderWriteConfirmCancel)
+        {
+            emit firmwareFlashStatusChanged(FirmwareFlashCancelled);
+        }
+        else
+        {
+            emit firmwareFlashStatusChanged(FirmwareFlashError);
+        }
+        break;
+
     // READ FIRMWARE VERSION STATE HANDLERS
 
     // Expecting reply after we asked for the firmware to report its version
@@ -1562,6 +1551,54 @@ void Programmer::handleChar(uint8_t c)
         }
         break;
 
+    // PING STATE HANDLERS
+
+    // Expecting the OK after asking for the bootloader state, which we're only
+    // using as a cheap command to measure the round trip time
+    case PingAwaitingOKReply:
+        if (c == CommandReplyOK)
+        {
+            curState = PingAwaitingStateReply;
+        }
+        else
+        {
+            curState = WaitingForNextCommand;
+            closePort();
+            emit pingStatusChanged(PingError);
+        }
+        break;
+
+    // Expecting the bootloader state itself, which completes one round trip
+    case PingAwaitingStateReply:
+        // The first ping also includes getting into programmer mode, so it
+        // doesn't count. Its job is just to start the timer for the next one.
+        if (pingWarmedUp)
+        {
+            _pingTimes.append(static_cast<quint32>(pingTimer.nsecsElapsed() / 1000));
+        }
+        pingWarmedUp = true;
+
+        if (cancelRequested)
+        {
+            cancelRequested = false;
+            curState = WaitingForNextCommand;
+            closePort();
+            emit pingStatusChanged(PingCancelled);
+        }
+        else if (_pingTimes.count() >= pingCount)
+        {
+            curState = WaitingForNextCommand;
+            closePort();
+            emit pingStatusChanged(PingComplete);
+        }
+        else
+        {
+            curState = PingAwaitingOKReply;
+            pingTimer.start();
+            sendByte(GetBootloaderState);
+        }
+        break;
+
     // UNUSED STATE HANDLERS (They are handled elsewhere)
     case BootloaderStateAwaitingPlug:
     case BootloaderStateAwaitingUnplug:
@@ -1573,6 +1610,7 @@ void Programmer::handleChar(uint8_t c)
 
 void Programmer::runElectricalTest()
 {
+    cancelRequested = false;
     startProgrammerCommand(DoElectricalTest, ElectricalTestWaitingStartReply);
 }
 
@@ -1635,8 +1673,11 @@ QString Programmer::electricalTestPinName(uint8_t index)
 void Programmer::identifySIMMChips()
 {
     // Start with straight addresses
+    cancelRequested = false;
     identifyIsForWriteAttempt = false;
     identificationShiftCounter = 0;
+    _progress.startJob();
+    _progress.startPhase(JobProgress::PhaseIdentify);
     startProgrammerCommand(SetSIMMLayout_AddressStraight, IdentificationWaitingSetSizeReply);
 }
 
@@ -1656,11 +1697,13 @@ void Programmer::getChipIdentity(int chipIndex, uint8_t *manufacturer, uint8_t *
 
 void Programmer::requestFirmwareVersion()
 {
+    cancelRequested = false;
     startProgrammerCommand(GetFirmwareVersion, ReadFWVersionAwaitingOKReply);
 }
 
 void Programmer::flashFirmware(QByteArray firmware)
 {
+    cancelRequested = false;
     firmwareFile = new QBuffer();
     firmwareFile->setData(firmware);
     if (!firmwareFile->open(QFile::ReadOnly))
@@ -1674,10 +1717,106 @@ void Programmer::flashFirmware(QByteArray firmware)
     firmwareLenRemaining = firmwareFile->size();
     emit firmwareFlashTotalLengthChanged(firmwareLenRemaining);
     emit firmwareFlashCompletionLengthChanged(firmwareLenWritten);
+    _progress.startJob();
+    _progress.startPhase(JobProgress::PhaseFirmwareFlash, firmwareLenRemaining);
 
     startBootloaderCommand(BootloaderEraseAndWriteProgram, BootloaderEraseProgramAwaitingStartOKReply);
 }
 
+// Measures the round trip time to the programmer by sending it a trivial command
+// over and over. The times (in microseconds) are available from pingTimes() once
+// pingStatusChanged(PingComplete) is emitted.
+void Programmer::pingProgrammer(int count)
+{
+    cancelRequested = false;
+    pingCount = count;
+    pingWarmedUp = false;
+    _pingTimes.clear();
+    _pingTimes.reserve(count);
+    startProgrammerCommand(GetBootloaderState, PingAwaitingOKReply);
+}
+
+// Called between chunks of a write, once the programmer has accepted the last
+// one. If the next chunk isn't ready yet (say, it's still being compressed), this
+// parks the write in WriteSIMMWaitingForData instead of waiting for it, and
+// writeSourceReady() picks it back up.
+void Programmer::continueWrite()
+{
+    if (!cancelRequested && !writeSource.isReady())
+    {
+        qDebug() << "Waiting for data to write...";
+        curState = WriteSIMMWaitingForData;
+        return;
+    }
+
+    // A device that's still being produced only knows the most it could
+    // be, so by now it might have turned out to be shorter than that
+    const qint64 available = writeSource.available();
+    if (writeLenRemaining > available)
+    {
+        writeLenRemaining = qMax(available, static_cast<qint64>(0));
+    }
+
+    // The programmer is between chunks, so this is where we can bail out
+    // of the write if we've been asked to.
+    if (available < 0 && !cancelRequested)
+    {
+        // It's too late to go back and shrink the write, so this is as far as we get
+        qDebug() << "Unable to read data to write:" << writeSource.errorString();
+        curState = WaitingForNextCommand;
+        closePort();
+        emit writeStatusChanged(WriteError);
+    }
+    else if (cancelRequested)
+    {
+        sendByte(ComputerWriteCancel);
+        curState = WriteSIMMWaitingCancelReply;
+        qDebug() << "Cancelling write...";
+    }
+    // We're in write SIMM mode. Now ask to start writing
+    else if (writeLenRemaining > 0)
+    {
+        sendByte(ComputerWriteMore);
+        curState = WriteSIMMWaitingWriteMoreReply;
+        qDebug() << "Write more..." << writeLenRemaining << "remaining.";
+    }
+    else
+    {
+        sendByte(ComputerWriteFinish);
+        curState = WriteSIMMWaitingFinishReply;
+        qDebug() << "Finished writing. Sending write finish command...";
+    }
+}
+
+void Programmer::writeSourceReady()
+{
+    if (curState == WriteSIMMWaitingForData)
+    {
+        continueWrite();
+    }
+}
+
+// Requests cancellation of the read, write, firmware flash, or ping in progress. The cancel
+// doesn't happen immediately; it's injected at the next point in the protocol where
+// the programmer is able to accept it (between chunks, or between commands). When it
+// takes effect, the usual "cancelled" status is emitted and we're back to waiting for
+// the next command. Erasing can't be interrupted, so a cancel during an erase takes
+// effect as soon as the erase finishes. Other operations are quick and ignore this.
+void Programmer::cancel()
+{
+    if (curState != WaitingForNextCommand)
+    {
+        qDebug() << "Cancel requested";
+        cancelRequested = true;
+
+        // The programmer is already between chunks, waiting on us
+        if (curState == WriteSIMMWaitingForData)
+        {
+            continueWrite();
+        }
+    }
+}
+
 // Begins a command by opening the serial port, making sure we're in the PROGRAMMER
 // rather than the bootloader, then sending a command and setting a new command state.
 // TODO: When it fails, this needs to carry errors over somehow.
@@ -1749,22 +1888,30 @@ void Programmer::portDiscovered_internal()
     // Don't show the "control" screen if we intentionally
     // reconnected the USB port because we are changing from bootloader
     // to programmer mode or vice-versa.
-    if (curState == BootloaderStateAwaitingPlug)
+    if (!resumeAfterReplug())
     {
-        openPort();
-        curState = nextState;
-        sendByte(nextSendByte);
+        emit programmerBoardConnected();
+    }
+}
+
+// If the board came back after we deliberately had it switch between bootloader
+// and programmer mode, carries on with what we were doing. Returns false if we
+// weren't waiting for that.
+bool Programmer::resumeAfterReplug()
+{
+    if (curState != BootloaderStateAwaitingPlug &&
+        curState != BootloaderStateAwaitingPlugToBootloader)
+    {
+        return false;
     }
-    else if (curState == BootloaderStateAwaitingPlugToBootloader)
+
+    openPort();
+    if (!handlePendingCancel(nextState))
     {
-        openPort();
         curState = nextState;
         sendByte(nextSendByte);
     }
-    else
-    {
-        emit programmerBoardConnected();
-    }
+    return true;
 }
 
 void Programmer::portRemoved(const QextPortInfo &info)
@@ -1798,6 +1945,8 @@ void Programmer::portRemoved(const QextPortInfo &info)
                 // This means they unplugged while we were in the middle
                 // of an operation. Reset state, and let them know.
                 curState = WaitingForNextCommand;
+                writeSource.stop();
+                _progress.finishJob();
                 emit programmerBoardDisconnectedDuringOperation();
             }
             else
@@ -1818,12 +1967,91 @@ void Programmer::startCheckingPorts()
 
 void Programmer::openPort()
 {
-    serialPort->open(QextSerialPort::ReadWrite);
+    transport->open(QIODevice::ReadWrite);
+    traceRecorder.record(ProtocolTraceEvent::PortOpened);
 }
 
 void Programmer::closePort()
 {
-    serialPort->close();
+    transport->close();
+    traceRecorder.record(ProtocolTraceEvent::PortClosed);
+
+    // Closing the port with nothing left to do means whatever job was running
+    // is over, one way or another. (It also gets closed temporarily while
+    // switching between bootloader and programmer mode; that doesn't count.)
+    if (curState == WaitingForNextCommand)
+    {
+        _progress.finishJob();
+
+        // Whoever gave us the device to write is about to get rid of it
+        writeSource.stop();
+    }
+}
+
+// Replaces the serial port with another device that speaks the programmer's protocol,
+// such as a trace being replayed. Passing NULL switches back to the serial port.
+// Only do this while the programmer is idle.
+void Programmer::setTransport(QIODevice *device)
+{
+    if (device == NULL)
+    {
+        device = serialPort;
+    }
+
+    if (device == transport)
+    {
+        return;
+    }
+
+    transport->close();
+    disconnect(transport, 0, this, 0);
+    transport = device;
+    connect(transport, SIGNAL(readyRead()), SLOT(dataReady()));
+
+    // Simulated boards can't come and go on USB, so they tell us directly when
+    // they've switched between programmer and bootloader mode.
+    if (transport->metaObject()->indexOfSignal("replugged()") >= 0)
+    {
+        connect(transport, SIGNAL(replugged()), SLOT(transportReplugged()));
+    }
+}
+
+// Equivalent of the board disconnecting and reconnecting for transports that
+// aren't a real serial port
+void Programmer::transportReplugged()
+{
+    // Same as portRemoved() followed by portDiscovered_internal()
+    if (curState == BootloaderStateAwaitingUnplug)
+    {
+        curState = BootloaderStateAwaitingPlug;
+    }
+    else if (curState == BootloaderStateAwaitingUnplugToBootloader)
+    {
+        curState = BootloaderStateAwaitingPlugToBootloader;
+    }
+    else
+    {
+        return;
+    }
+
+    resumeAfterReplug();
+}
+
+// Starts recording everything sent to and received from the programmer into a
+// trace file, which can be played back later with ProtocolTraceReplay.
+bool Programmer::startTrace(QString const &path)
+{
+    return traceRecorder.start(path);
+}
+
+void Programmer::stopTrace()
+{
+    traceRecorder.stop();
+}
+
+bool Programmer::isBoardConnected() const
+{
+    return foundState == ProgrammerBoardFound;
 }
 
 void Programmer::setSIMMType(uint32_t bytes, uint32_t chip_type)
@@ -1862,32 +2090,68 @@ bool Programmer::selectedSIMMTypeUsesShiftedUnlock() const
     return SIMMChip() == SIMM_TSOP_x8;
 }
 
+void Programmer::startVerifyBuffer()
+{
+    // Room for the whole SIMM up front, so reading back into it never reallocates
+    finishVerifyBuffer();
+    verifyBuffer->close();
+    verifyArray = BufferPool::shared().lease(_simmCapacity);
+    verifyBuffer->setBuffer(verifyArray);
+    verifyBuffer->open(QBuffer::ReadWrite);
+}
+
+void Programmer::finishVerifyBuffer()
+{
+    if (!verifyArray)
+    {
+        return;
+    }
+
+    verifyBuffer->close();
+    verifyBuffer->setBuffer(NULL);
+    BufferPool::shared().release(verifyArray);
+    verifyArray = NULL;
+    verifyBuffer->open(QBuffer::ReadWrite);
+}
+
 void Programmer::doVerifyAfterWriteCompare()
 {
     // Do the comparison, emit the correct signal
 
-    // Read the entire file we just wrote into a QByteArray
+    // Read the entire file we just wrote into a buffer from the pool
     writeDevice->seek(readOffset);
-    QByteArray originalFileContents = writeDevice->read(verifyLength);
-    qDebug() << "Read" << originalFileContents.length() << "bytes, asked for" << verifyLength;
+    QByteArray *originalFileContents = BufferPool::shared().lease(verifyLength);
+    originalFileContents->resize(verifyLength);
+    qint64 lenReadBack = 0;
+    while (lenReadBack < verifyLength)
+    {
+        const qint64 n = writeDevice->read(originalFileContents->data() + lenReadBack, verifyLength - lenReadBack);
+        if (n <= 0)
+        {
+            break;
+        }
+        lenReadBack += n;
+    }
+    originalFileContents->truncate(lenReadBack);
+    qDebug() << "Read" << originalFileContents->length() << "bytes, asked for" << verifyLength;
 
     WriteStatus emitStatus;
 
     // Now, compare the readback (but only for the length of originalFileContents
     // (because the readback might be longer since it has to be a multiple of
     // READ_CHUNK_SIZE)
-    if (originalFileContents.size() <= verifyArray->size())
+    if (originalFileContents->size() <= verifyArray->size())
     {
-        const char *fileBytesPtr = originalFileContents.constData();
+        const char *fileBytesPtr = originalFileContents->constData();
         const char *readBytesPtr = verifyArray->constData();
 
-        if (memcmp(fileBytesPtr, readBytesPtr, originalFileContents.size()) != 0)
+        if (memcmp(fileBytesPtr, readBytesPtr, originalFileContents->size()) != 0)
         {
             // Now let's do some trickery and figure out which chip is acting up (or chips)
             _verifyBadChipMask = 0;
 
             // Keep a list of which chips are reading bad data back
-            for (int x = 0; (x < originalFileContents.size()) && (_verifyBadChipMask != 0xF); x++)
+            for (int x = 0; (x < originalFileContents->size()) && (_verifyBadChipMask != 0xF); x++)
             {
                 if (fileBytesPtr[x] != readBytesPtr[x])
                 {
@@ -1932,10 +2196,68 @@ void Programmer::doVerifyAfterWriteCompare()
         emitStatus = WriteVerificationFailure;
     }
 
-    // Reset verification buffer to emptiness
-    verifyArray->clear();
-    verifyBuffer->seek(0);
+    // Both buffers go back to the pool for next time
+    BufferPool::shared().release(originalFileContents);
+    finishVerifyBuffer();
 
     // Finally, emit the final status signal
     emit writeStatusChanged(emitStatus);
 }
+
+// Called at points in the protocol where the programmer is idle, waiting for us to
+// send the next command. If a cancel is pending and the operation that state belongs
+// to can be cancelled, this wraps the operation up as cancelled and returns true.
+// The caller must not send anything else to the programmer in that case.
+// state is really just a ProgrammerCommandState, same as startProgrammerCommand().
+bool Programmer::handlePendingCancel(uint32_t state)
+{
+    if (!cancelRequested)
+    {
+        return false;
+    }
+
+    const ProgrammerCommandState s = static_cast<ProgrammerCommandState>(state);
+    const bool isWrite = (s >= WriteSIMMWaitingSetSectorLayoutReply && s <= WriteSIMMWaitingCancelReply) ||
+                         (s >= WritePortionWaitingSetSectorLayoutReply && s <= WritePortionWaitingWriteAtReply) ||
+                         (s >= IdentificationWaitingSetSizeReply && s <= IdentificationAwaitingDoneReply && identifyIsForWriteAttempt);
+    const bool isRead = s >= ReadSIMMWaitingStartReply && s <= ReadSIMMWaitingStatusReply;
+    const bool isFirmwareFlash = s >= BootloaderEraseProgramAwaitingStartOKReply && s <= BootloaderEraseProgramWaitingCancelReply;
+
+    if (!isWrite && !isRead && !isFirmwareFlash)
+    {
+        // Nothing we know how to cancel; just let it finish normally
+        return false;
+    }
+
+    qDebug() << "Cancelling between commands";
+    cancelRequested = false;
+    curState = WaitingForNextCommand;
+    closePort();
+
+    if (isWrite)
+    {
+        emit writeStatusChanged(WriteCancelled);
+    }
+    else if (isRead)
+    {
+        if (!isReadVerifying)
+        {
+            emit readStatusChanged(ReadCancelled);
+        }
+        else
+        {
+            // Ensure the verify buffer is empty if we were verifying
+            finishVerifyBuffer();
+            emit writeStatusChanged(WriteVerifyCancelled);
+        }
+    }
+    else
+    {
+        firmwareFile->close();
+        delete firmwareFile;
+        firmwareFile = NULL;
+        emit firmwareFlashStatusChanged(FirmwareFlashCancelled);
+    }
+
+    return true;
+}
@@ -26,8 +26,13 @@
 #include <qextserialport.h>
 #include <qextserialenumerator.h>
 #include "chipid.h"
+#include "jobprogress.h"
+#include "protocoltrace.h"
+#include "writesource.h"
+#include "bufferpool.h"
 #include <stdint.h>
 #include <QBuffer>
+#include <QElapsedTimer>
 
 typedef enum StartStatus
 {
@@ -110,6 +115,13 @@ typedef enum ProgrammerRevision
     ProgrammerRevisionM258KE = 2
 } ProgrammerRevision;
 
+typedef enum PingStatus
+{
+    PingComplete,
+    PingError,
+    PingCancelled
+} PingStatus;
+
 typedef enum ReadFirmwareVersionStatus
 {
     ReadFirmwareVersionCommandNotSupported,
@@ -148,6 +160,9 @@ public:
     void getChipIdentity(int chipIndex, uint8_t *manufacturer, uint8_t *device, bool shiftedUnlock);
     void requestFirmwareVersion();
     void flashFirmware(QByteArray firmware);
+    void pingProgrammer(int count);
+    QList<quint32> pingTimes() const { return _pingTimes; }
+    void cancel();
     void startCheckingPorts();
     void setSIMMType(uint32_t bytes, uint32_t chip_type);
     uint32_t SIMMCapacity() const;
@@ -158,6 +173,13 @@ public:
     ProgrammerRevision programmerRevision() const;
     bool selectedSIMMTypeUsesShiftedUnlock() const;
     ChipID &chipID() { return _chipID; }
+    JobProgress &progress() { return _progress; }
+    bool isBoardConnected() const;
+
+    void setTransport(QIODevice *device);
+    bool startTrace(QString const &path);
+    void stopTrace();
+    bool isTracing() const { return traceRecorder.isRecording(); }
 signals:
     void startStatusChanged(StartStatus status);
 
@@ -182,6 +204,8 @@ signals:
 
     void readFirmwareVersionStatusChanged(ReadFirmwareVersionStatus status, uint32_t version);
 
+    void pingStatusChanged(PingStatus status);
+
     void programmerBoardConnected();
     void programmerBoardDisconnected();
     void programmerBoardDisconnectedDuringOperation();
@@ -192,12 +216,15 @@ private:
     //QFile *writeFile;
     QIODevice *readDevice;
     QIODevice *writeDevice;
+    WriteSource writeSource;
     QBuffer *firmwareFile;
 
     QextSerialPort *serialPort;
+    QIODevice *transport;
+    ProtocolTraceRecorder traceRecorder;
     void sendByte(uint8_t b);
     void sendWord(uint32_t w);
-    uint8_t readByte();
+    void sendData(QByteArray const &data);
     void handleChar(uint8_t c);
     uint32_t _simmCapacity;
     uint32_t _simmChip;
@@ -231,6 +258,8 @@ private:
     QBuffer *verifyBuffer;
     QByteArray *verifyArray;
     uint32_t verifyLength;
+    void startVerifyBuffer();
+    void finishVerifyBuffer();
 
     uint32_t writeOffset;
     uint32_t writeLength;
@@ -239,7 +268,15 @@ private:
     uint32_t firmwareVersionBeingAssembled;
     uint8_t firmwareVersionNextExpectedByte;
 
+    bool cancelRequested;
+
+    int pingCount;
+    bool pingWarmedUp;
+    QElapsedTimer pingTimer;
+    QList<quint32> _pingTimes;
+
     ChipID _chipID;
+    JobProgress _progress;
 
     void openPort();
     void closePort();
@@ -248,6 +285,9 @@ private:
     void startProgrammerCommand(uint8_t commandByte, uint32_t newState);
     void startBootloaderCommand(uint8_t commandByte, uint32_t newState);
     void doVerifyAfterWriteCompare();
+    bool handlePendingCancel(uint32_t state);
+    bool resumeAfterReplug();
+    void continueWrite();
 
 private slots:
     void dataReady();
@@ -255,6 +295,8 @@ private slots:
     void portDiscovered(const QextPortInfo &info);
     void portDiscovered_internal();
     void portRemoved(const QextPortInfo &info);
+    void transportReplugged();
+    void writeSourceReady();
 };
 
 #endif // PROGRAMMER_H
@@ -0,0 +1,123 @@
+#ifndef PROGRAMMERPROTOCOL_H
+#define PROGRAMMERPROTOCOL_H
+
+// Command and reply bytes understood by the programmer board's firmware. These are
+// shared between Programmer and anything else that needs to speak the protocol
+// (like SimulatedProgrammer), so they have to stay in sync with the firmware.
+
+typedef enum ProgrammerCommand
+{
+    EnterWaitingMode = 0,
+    DoElectricalTest,
+    IdentifyChips,
+    ReadByte,
+    ReadChips,
+    EraseChips,
+    WriteChips,
+    GetBootloaderState,
+    EnterBootloader,
+    EnterProgrammer,
+    BootloaderEraseAndWriteProgram,
+    SetSIMMLayout_AddressStraight,
+    SetSIMMLayout_AddressShifted,
+    SetVerifyWhileWriting,
+    SetNoVerifyWhileWriting,
+    ErasePortion,
+    WriteChipsAt,
+    ReadChipsAt,
+    SetChipsMask,
+    SetSectorLayout,
+    GetFirmwareVersion
+} ProgrammerCommand;
+
+typedef enum ProgrammerReply
+{
+    CommandReplyOK,
+    CommandReplyError,
+    CommandReplyInvalid
+} ProgrammerReply;
+
+typedef enum ComputerReadReply
+{
+    ComputerReadOK,
+    ComputerReadCancel
+} ComputerReadReply;
+
+typedef enum ProgrammerReadReply
+{
+    ProgrammerReadOK,
+    ProgrammerReadError,
+    ProgrammerReadMoreData,
+    ProgrammerReadFinished,
+    ProgrammerReadConfirmCancel
+} ProgrammerReadReply;
+
+typedef enum ComputerWriteReply
+{
+    ComputerWriteMore,
+    ComputerWriteFinish,
+    ComputerWriteCancel
+} ComputerWriteReply;
+
+typedef enum ProgrammerWriteReply
+{
+    ProgrammerWriteOK,
+    ProgrammerWriteError,
+    ProgrammerWriteConfirmCancel,
+    ProgrammerWriteVerificationError = 0x80 /* high bit */
+} ProgrammerWriteReply;
+
+typedef enum ProgrammerIdentifyReply
+{
+    ProgrammerIdentifyDone
+} ProgrammerIdentifyReply;
+
+typedef enum ProgrammerElectricalTestReply
+{
+    ProgrammerElectricalTestFail,
+    ProgrammerElectricalTestDone
+} ProgrammerElectricalTestReply;
+
+typedef enum BootloaderStateReply
+{
+    BootloaderStateInBootloader,
+    BootloaderStateInProgrammer
+} BootloaderStateReply;
+
+typedef enum ProgrammerBootloaderEraseWriteReply
+{
+    BootloaderWriteOK,
+    BootloaderWriteError,
+    BootloaderWriteConfirmCancel
+} ProgrammerBootloaderEraseWriteReply;
+
+typedef enum ComputerBootloaderEraseWriteRequest
+{
+    ComputerBootloaderWriteMore = 0,
+    ComputerBootloaderFinish,
+    ComputerBootloaderCancel
+} ComputerBootloaderEraseWriteRequest;
+
+typedef enum ProgrammerErasePortionOfChipReply
+{
+    ProgrammerErasePortionOK = 0,
+    ProgrammerErasePortionError,
+    ProgrammerErasePortionFinished
+} ProgrammerErasePortionOfChipReply;
+
+typedef enum ProgrammerGetFWVersionReply
+{
+    ProgrammerGetFWVersionDone
+} ProgrammerGetFWVersionReply;
+
+#define WRITE_CHUNK_SIZE    1024
+#define READ_CHUNK_SIZE     1024
+#define FIRMWARE_CHUNK_SIZE 1024
+
+#define BLOCK_ERASE_SIZE    (256*1024UL)
+
+// The programmer only has enough address lines for 8 MB, and neither it nor the
+// firmware protocol has any way to pick a different 8 MB of a bigger SIMM.
+#define SIMM_BANK_SIZE      (8*1024*1024UL)
+
+#endif // PROGRAMMERPROTOCOL_H
@@ -0,0 +1,261 @@
+#include "protocoltrace.h"
+#include <QDebug>
+
+#define PROTOCOL_TRACE_MAGIC        0x53505452 // 'SPTR'
+#define PROTOCOL_TRACE_VERSION      1
+
+ProtocolTraceRecorder::ProtocolTraceRecorder()
+{
+}
+
+ProtocolTraceRecorder::~ProtocolTraceRecorder()
+{
+    stop();
+}
+
+bool ProtocolTraceRecorder::start(QString const &path)
+{
+    stop();
+
+    file.setFileName(path);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        qWarning() << "Unable to create protocol trace" << path << file.errorString();
+        return false;
+    }
+
+    stream.setDevice(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint32>(PROTOCOL_TRACE_MAGIC) << static_cast<quint16>(PROTOCOL_TRACE_VERSION);
+    timer.start();
+    return true;
+}
+
+void ProtocolTraceRecorder::stop()
+{
+    if (file.isOpen())
+    {
+        stream.setDevice(NULL);
+        file.close();
+    }
+}
+
+void ProtocolTraceRecorder::record(ProtocolTraceEvent::Type type, QByteArray const &data)
+{
+    if (!file.isOpen())
+    {
+        return;
+    }
+
+    stream << static_cast<quint8>(type) << static_cast<quint64>(timer.nsecsElapsed() / 1000) << data;
+}
+
+void ProtocolTraceRecorder::record(ProtocolTraceEvent::Type type, const char *data, qint64 len)
+{
+    if (!file.isOpen())
+    {
+        return;
+    }
+
+    // fromRawData() avoids a copy; the stream only needs it for the duration of this call
+    record(type, QByteArray::fromRawData(data, static_cast<int>(len)));
+}
+
+ProtocolTraceReplay::ProtocolTraceReplay(QObject *parent) :
+    QIODevice(parent),
+    nextEvent(0),
+    transmitOffset(0),
+    divergedAt(-1),
+    realTime(false),
+    lastTransmitTimestamp(0)
+{
+    replyTimer.setSingleShot(true);
+    connect(&replyTimer, SIGNAL(timeout()), SLOT(deliverNextReply()));
+}
+
+bool ProtocolTraceReplay::load(QString const &path)
+{
+    events.clear();
+    nextEvent = 0;
+    transmitOffset = 0;
+    divergedAt = -1;
+    lastTransmitTimestamp = 0;
+    pendingReplies.clear();
+    replyBuffer.clear();
+    replyTimer.stop();
+
+    if (!readTrace(path, events))
+    {
+        return false;
+    }
+
+    // A trace could conceivably start with something from the board that was
+    // sitting in the buffer when recording began.
+    queueReplies();
+    return true;
+}
+
+bool ProtocolTraceReplay::readTrace(QString const &path, QList<ProtocolTraceEvent> &events)
+{
+    QFile f(path);
+    if (!f.open(QFile::ReadOnly))
+    {
+        qWarning() << "Unable to open protocol trace" << path << f.errorString();
+        return false;
+    }
+
+    QDataStream stream(&f);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic;
+    quint16 version;
+    stream >> magic >> version;
+    if (magic != PROTOCOL_TRACE_MAGIC || version != PROTOCOL_TRACE_VERSION)
+    {
+        qWarning() << "Not a protocol trace (or an unsupported version):" << path;
+        return false;
+    }
+
+    events.clear();
+    while (!stream.atEnd())
+    {
+        quint8 type;
+        ProtocolTraceEvent e;
+        stream >> type >> e.timestamp >> e.data;
+        if (stream.status() != QDataStream::Ok || type > ProtocolTraceEvent::PortClosed)
+        {
+            // A trace that was cut short (e.g. the app crashed) is still useful
+            // up to the point where it stops making sense.
+            qWarning() << "Protocol trace is truncated after" << events.count() << "events";
+            break;
+        }
+        e.type = static_cast<ProtocolTraceEvent::Type>(type);
+        events.append(e);
+    }
+
+    return true;
+}
+
+bool ProtocolTraceReplay::isSequential() const
+{
+    return true;
+}
+
+qint64 ProtocolTraceReplay::bytesAvailable() const
+{
+    return replyBuffer.size() + QIODevice::bytesAvailable();
+}
+
+qint64 ProtocolTraceReplay::readData(char *data, qint64 maxSize)
+{
+    qint64 len = qMin(maxSize, static_cast<qint64>(replyBuffer.size()));
+    memcpy(data, replyBuffer.constData(), len);
+    replyBuffer.remove(0, static_cast<int>(len));
+    return len;
+}
+
+qint64 ProtocolTraceReplay::writeData(const char *data, qint64 len)
+{
+    if (hasDiverged())
+    {
+        // Swallow it; there's no sensible reply to give anymore
+        return len;
+    }
+
+    for (qint64 x = 0; x < len; x++)
+    {
+        skipPortEvents();
+
+        if (nextEvent >= events.count() ||
+            events[nextEvent].type != ProtocolTraceEvent::Transmit ||
+            events[nextEvent].data.at(transmitOffset) != data[x])
+        {
+            divergedAt = nextEvent;
+            qWarning() << "Protocol replay diverged from the trace at event" << nextEvent;
+            emit diverged(nextEvent);
+            return len;
+        }
+
+        if (++transmitOffset >= events[nextEvent].data.size())
+        {
+            lastTransmitTimestamp = events[nextEvent].timestamp;
+            transmitOffset = 0;
+            nextEvent++;
+        }
+    }
+
+    // If that finished off a transmission, the board's replies are up next
+    if (transmitOffset == 0)
+    {
+        queueReplies();
+    }
+
+    return len;
+}
+
+void ProtocolTraceReplay::queueReplies()
+{
+    bool wasIdle = pendingReplies.isEmpty();
+
+    skipPortEvents();
+    while (nextEvent < events.count() && events[nextEvent].type == ProtocolTraceEvent::Receive)
+    {
+        pendingReplies.append(events[nextEvent++]);
+        skipPortEvents();
+    }
+
+    if (wasIdle && !pendingReplies.isEmpty())
+    {
+        qint64 delay = 0;
+        if (realTime && pendingReplies.first().timestamp > lastTransmitTimestamp)
+        {
+            delay = (pendingReplies.first().timestamp - lastTransmitTimestamp) / 1000;
+        }
+        replyTimer.start(static_cast<int>(delay));
+    }
+    else if (pendingReplies.isEmpty() && nextEvent >= events.count())
+    {
+        emit finished();
+    }
+}
+
+void ProtocolTraceReplay::skipPortEvents()
+{
+    // Opening and closing the port is recorded to make traces easier to read,
+    // but there's nothing to do about it on playback.
+    while (nextEvent < events.count() &&
+           (events[nextEvent].type == ProtocolTraceEvent::PortOpened ||
+            events[nextEvent].type == ProtocolTraceEvent::PortClosed))
+    {
+        nextEvent++;
+    }
+}
+
+void ProtocolTraceReplay::deliverNextReply()
+{
+    if (pendingReplies.isEmpty())
+    {
+        return;
+    }
+
+    ProtocolTraceEvent reply = pendingReplies.takeFirst();
+    replyBuffer.append(reply.data);
+
+    if (!pendingReplies.isEmpty())
+    {
+        qint64 delay = 0;
+        if (realTime && pendingReplies.first().timestamp > reply.timestamp)
+        {
+            delay = (pendingReplies.first().timestamp - reply.timestamp) / 1000;
+        }
+        replyTimer.start(static_cast<int>(delay));
+    }
+
+    // The reader may well write something in response, which queues up more replies
+    emit readyRead();
+
+    if (pendingReplies.isEmpty() && nextEvent >= events.count() && replyBuffer.isEmpty())
+    {
+        emit finished();
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef PROTOCOLTRACE_H
+#define PROTOCOLTRACE_H
+
+#include <QIODevice>
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QList>
+#include <stdint.h>
+
+// A trace is a record of every byte exchanged with the programmer board, in order,
+// with timestamps. The file format is a QDataStream: a magic number and version,
+// followed by events that each consist of a type, a timestamp in microseconds since
+// the trace started, and a QByteArray of data (empty for open/close events).
+
+struct ProtocolTraceEvent
+{
+    enum Type
+    {
+        Transmit = 0,
+        Receive = 1,
+        PortOpened = 2,
+        PortClosed = 3
+    };
+
+    Type type;
+    quint64 timestamp;
+    QByteArray data;
+};
+
+class ProtocolTraceRecorder
+{
+public:
+    ProtocolTraceRecorder();
+    ~ProtocolTraceRecorder();
+
+    bool start(QString const &path);
+    void stop();
+    bool isRecording() const { return file.isOpen(); }
+
+    void record(ProtocolTraceEvent::Type type, QByteArray const &data = QByteArray());
+    void record(ProtocolTraceEvent::Type type, const char *data, qint64 len);
+
+private:
+    QFile file;
+    QDataStream stream;
+    QElapsedTimer timer;
+};
+
+// Stands in for the serial port and plays a recorded trace back to the programmer.
+// Whatever the programmer writes is checked against the recorded transmissions, and
+// once it has sent everything it sent during the recording, the bytes the board
+// replied with are handed back. By default replies are delivered as fast as the
+// event loop allows (which is what you want for timing the host side); real time
+// mode reproduces the original delays between each transmission and its reply.
+class ProtocolTraceReplay : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    explicit ProtocolTraceReplay(QObject *parent = NULL);
+
+    bool load(QString const &path);
+    void setRealTime(bool realTime) { this->realTime = realTime; }
+    bool hasDiverged() const { return divergedAt >= 0; }
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+    static bool readTrace(QString const &path, QList<ProtocolTraceEvent> &events);
+
+signals:
+    // The programmer sent something that isn't in the trace. Nothing else will be
+    // replayed after this happens.
+    void diverged(int eventIndex);
+    // Everything in the trace has been replayed
+    void finished();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 len);
+
+private slots:
+    void deliverNextReply();
+
+private:
+    void queueReplies();
+    void skipPortEvents();
+
+    QList<ProtocolTraceEvent> events;
+    int nextEvent;
+    int transmitOffset;
+    int divergedAt;
+    bool realTime;
+    quint64 lastTransmitTimestamp;
+
+    QList<ProtocolTraceEvent> pendingReplies;
+    QByteArray replyBuffer;
+    QTimer replyTimer;
+};
+
+#endif // PROTOCOLTRACE_H
@@ -0,0 +1,329 @@
+#include "rombuilder.h"
+#include "fc8compressor.h"
+#include "fc8streamcompressor.h"
+#include "fc8decoder.h"
+#include "hfsscrubber.h"
+#include "romsignatures.h"
+#include <QDebug>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+
+ROMBuilder::ROMBuilder(FC8BlockCache *blockCache, CompressedImageCache *imageCache, QObject *parent) :
+    QObject(parent),
+    blockCache(blockCache),
+    imageCache(imageCache),
+    cancelRequested(0),
+    combinedROM(NULL),
+    compressing(false),
+    streaming(false),
+    running(false),
+    cancelled(false)
+{
+    connect(&preparationWatcher, SIGNAL(finished()), SLOT(preparationFinished()));
+    connect(&compressionWatcher, SIGNAL(progressValueChanged(int)), SLOT(compressionProgressChanged(int)));
+    connect(&compressionWatcher, SIGNAL(finished()), SLOT(compressionFinished()));
+}
+
+ROMBuilder::~ROMBuilder()
+{
+    // The worker threads use the caches, so they have to be done before anything
+    // goes away
+    cancel();
+    preparationWatcher.waitForFinished();
+    delete combinedROM;
+    compressionWatcher.waitForFinished();
+}
+
+void ROMBuilder::start(Inputs const &inputs)
+{
+    if (running)
+    {
+        return;
+    }
+
+    this->inputs = inputs;
+    prepared = Prepared();
+    delete combinedROM;
+    combinedROM = NULL;
+    errorText.clear();
+    stream = NULL;
+    // If the last one was streamed, the stream can finish compressing on its own;
+    // whatever the watcher says about it from here on is ignored. (Giving the
+    // watcher an empty future instead would have it report that as cancelled.)
+    compressing = false;
+    streaming = false;
+    cancelled = false;
+    cancelRequested.storeRelease(0);
+    running = true;
+
+    emit progressChanged("Preparing ROM...", 0, 0);
+    preparationWatcher.setFuture(QtConcurrent::run(&ROMBuilder::prepare, inputs, &cancelRequested, imageCache));
+}
+
+void ROMBuilder::cancel()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    // Whichever stage is going will notice and wrap up; blocks that are already
+    // being compressed have to finish first, but nothing new gets started.
+    cancelRequested.storeRelease(1);
+    compressionWatcher.cancel();
+}
+
+// Runs on a worker thread, so it only uses what it's given
+ROMBuilder::Prepared ROMBuilder::prepare(Inputs inputs, QAtomicInt *cancelFlag, CompressedImageCache *imageCache)
+{
+    Prepared p;
+
+    const QByteArray rom = inputs.baseROM;
+    p.romLength = rom.length();
+    if (rom.isEmpty())
+    {
+        p.error = "Unable to read the base ROM.";
+        return p;
+    }
+    if (cancelFlag->loadAcquire())
+    {
+        return p;
+    }
+
+    p.diskImage = inputs.diskImage;
+    if (p.diskImage.isEmpty())
+    {
+        p.error = "Unable to read the disk image.";
+        return p;
+    }
+    if (cancelFlag->loadAcquire())
+    {
+        return p;
+    }
+
+    // Already compressed images go in as is, as long as they really do decompress.
+    // The ROM needs to know how big they are once they're decompressed.
+    const bool alreadyCompressed = FC8Compressor::isCompressedImage(p.diskImage);
+    uint32_t diskSize = p.diskImage.length();
+    if (alreadyCompressed)
+    {
+        QByteArray decoded;
+        if (!FC8Decoder::decode(p.diskImage, decoded, &p.error))
+        {
+            p.error = "The compressed disk image can't be decompressed. " + p.error;
+            return p;
+        }
+        diskSize = decoded.length();
+    }
+
+    // If we know how to modify this ROM for the disk image size, figure out how
+    const ROMScanResult romInfo = ROMSignatures::scan(rom);
+    p.romPatches = ROMSignatures::patches(rom, romInfo, diskSize);
+
+    // Uncompressed images go in as is too when the ROM can't decompress
+    p.needsCompression = romInfo.supportsCompression && !alreadyCompressed;
+    if (!p.needsCompression || cancelFlag->loadAcquire())
+    {
+        return p;
+    }
+
+    // This is the only time the image gets hashed. Maybe we've already compressed it...
+    p.hash = FC8Compressor::hashOfFile(p.diskImage);
+
+    // The free space on the volume is going to compress to nothing, so whatever's
+    // compressed (or was, earlier) is the scrubbed version, not what's in the file
+    p.diskImage = HFSScrubber::scrub(p.diskImage);
+    if (p.hash == inputs.compressedImageHash && !inputs.compressedImage.isEmpty())
+    {
+        p.compressedImage = inputs.compressedImage;
+    }
+    else if (imageCache)
+    {
+        imageCache->lookup(p.hash, inputs.blockSize, p.compressedImage);
+    }
+
+    // Whichever one it was, it's been sitting around for a while. If it doesn't
+    // decompress to exactly this disk image anymore, compress it over again.
+    if (!p.compressedImage.isEmpty() && !FC8Decoder::verify(p.compressedImage, p.diskImage))
+    {
+        qWarning() << "Compressed disk image didn't verify; compressing it again";
+        p.compressedImage.clear();
+    }
+
+    return p;
+}
+
+void ROMBuilder::preparationFinished()
+{
+    prepared = preparationWatcher.result();
+
+    if (cancelRequested.loadAcquire())
+    {
+        finish(false);
+    }
+    else if (!prepared.error.isEmpty())
+    {
+        finish(false, prepared.error);
+    }
+    else if (prepared.romLength == 0 || prepared.diskImage.isEmpty())
+    {
+        finish(false, "The base ROM or disk image is empty.");
+    }
+    else if (!prepared.needsCompression)
+    {
+        combine(prepared.diskImage);
+    }
+    else if (!prepared.compressedImage.isEmpty())
+    {
+        combine(prepared.compressedImage);
+    }
+    else
+    {
+        const QVector<int> blockIndexes = FC8Compressor::blockIndexList(prepared.diskImage.length(), inputs.blockSize);
+        if (blockCache)
+        {
+            blockCache->resetStatistics();
+        }
+        const QFuture<QByteArray> compressedBlocks = QtConcurrent::mapped(blockIndexes,
+                FC8Compressor::BlockCompressor(prepared.diskImage, inputs.blockSize, blockCache));
+        compressionWatcher.setFuture(compressedBlocks);
+        compressing = true;
+
+        if (inputs.streamLimit > 0)
+        {
+            // The stream takes it from here; we just save the compressed image
+            // once it's done
+            stream = new CompressedImageStream(prepared.diskImage, inputs.blockSize, compressedBlocks,
+                                               inputs.streamLimit - prepared.romLength);
+            streaming = true;
+            combine(QByteArray(), stream);
+        }
+        else
+        {
+            emit progressChanged("Compressing disk image...", 0, blockIndexes.count());
+        }
+    }
+}
+
+void ROMBuilder::compressionProgressChanged(int value)
+{
+    // The write's progress is what matters when streaming
+    if (!compressing || streaming)
+    {
+        return;
+    }
+
+    emit progressChanged("Compressing disk image...",
+                         value - compressionWatcher.progressMinimum(),
+                         compressionWatcher.progressMaximum() - compressionWatcher.progressMinimum());
+}
+
+void ROMBuilder::compressionFinished()
+{
+    if (!compressing)
+    {
+        return;
+    }
+    compressing = false;
+
+    if (streaming)
+    {
+        // The blocks are all done, so all that's left is putting them together and
+        // checking them, if the stream hasn't already. It only does that once, no
+        // matter which thread asks first.
+        const QByteArray compressed = stream && !compressionWatcher.isCanceled() ?
+                    stream->compressedImage() : QByteArray();
+        streaming = false;
+        if (!compressed.isEmpty())
+        {
+            prepared.compressedImage = compressed;
+            if (imageCache)
+            {
+                imageCache->store(prepared.hash, inputs.blockSize, compressed);
+            }
+            emit compressedImageReady();
+        }
+        return;
+    }
+
+    if (compressionWatcher.isCanceled() || cancelRequested.loadAcquire())
+    {
+        finish(false);
+        return;
+    }
+
+    const QList<QByteArray> blocks = compressionWatcher.future().results();
+    if (blockCache)
+    {
+        qDebug() << "FC8 compression reused" << blockCache->hits() << "of" << blocks.count() << "blocks";
+    }
+
+    prepared.compressedImage = FC8StreamCompressor::assemble(blocks, prepared.diskImage.length(), inputs.blockSize);
+    if (prepared.compressedImage.isEmpty())
+    {
+        finish(false, "Unable to compress the disk image.");
+        return;
+    }
+
+    // One last round trip before it goes anywhere near a SIMM
+    if (!FC8Decoder::verify(prepared.compressedImage, prepared.diskImage))
+    {
+        finish(false, "The compressed disk image didn't decompress back to the original.");
+        return;
+    }
+
+    // Save it for next time, even if that's in a later session
+    if (imageCache)
+    {
+        imageCache->store(prepared.hash, inputs.blockSize, prepared.compressedImage);
+    }
+    combine(prepared.compressedImage);
+}
+
+CombinedROMDevice *ROMBuilder::takeResult()
+{
+    CombinedROMDevice *result = combinedROM;
+    combinedROM = NULL;
+    return result;
+}
+
+void ROMBuilder::combine(QByteArray const &diskImage, CompressedImageStream *diskStream)
+{
+    combinedROM = new CombinedROMDevice();
+    if (diskStream)
+    {
+        combinedROM->setDiskImage(diskStream);
+    }
+    else
+    {
+        combinedROM->setDiskImage(diskImage);
+    }
+
+    // The same ROM the patches were worked out for, so there's nothing to check
+    combinedROM->setBaseROM(inputs.baseROM);
+    combinedROM->setPatches(prepared.romPatches);
+    finish(true);
+}
+
+void ROMBuilder::finish(bool succeeded, QString const &error)
+{
+    // Don't hang on to the big stuff we won't need anymore
+    prepared.romPatches.clear();
+    prepared.diskImage.clear();
+    inputs.baseROM.clear();
+    inputs.diskImage.clear();
+    inputs.compressedImage.clear();
+
+    if (!succeeded)
+    {
+        delete combinedROM;
+        combinedROM = NULL;
+        prepared.hash.clear();
+        prepared.compressedImage.clear();
+    }
+
+    cancelled = !succeeded && cancelRequested.loadAcquire();
+    errorText = error;
+    running = false;
+    emit finished(succeeded);
+}
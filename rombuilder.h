@@ -0,0 +1,121 @@
+#ifndef ROMBUILDER_H
+#define ROMBUILDER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QPointer>
+#include "fc8blockcache.h"
+#include "compressedimagecache.h"
+#include "combinedromdevice.h"
+#include "compressedimagestream.h"
+
+// Puts together a base ROM and a disk image into one combined ROM without tying up
+// the GUI thread: the ROM is identified and its patches are worked out, and the
+// disk image is hashed (once) on a worker thread; then, if the disk image has to
+// be compressed, its blocks are spread across the thread pool with progress
+// reported as each one is done. It can be cancelled at any point, and
+// finished() is emitted once it's all over either way.
+//
+// The result is a CombinedROMDevice, so the two never actually get copied into one
+// array. When the ROM is going straight to a SIMM, it doesn't have to wait for
+// compression at all: with a stream limit set, it finishes as soon as the patches
+// are known, and the disk image part is a CompressedImageStream that's compressed
+// while it's being written.
+class ROMBuilder : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Inputs
+    {
+        Inputs() : blockSize(0), streamLimit(0) {}
+
+        // What's in the files, straight from the caller's FileContentCache so
+        // they're only ever read once. Empty if they couldn't be read.
+        QByteArray baseROM;
+        QByteArray diskImage;
+        int blockSize;
+        // The compressed image the caller already has on hand, if any. It's used
+        // if it turns out to be for the same disk image.
+        QByteArray compressedImageHash;
+        QByteArray compressedImage;
+        // If this isn't 0, a disk image that needs compressing is compressed while
+        // the result is written, and the result can't get any bigger than this
+        qint64 streamLimit;
+    };
+
+    explicit ROMBuilder(FC8BlockCache *blockCache, CompressedImageCache *imageCache, QObject *parent = NULL);
+    ~ROMBuilder();
+
+    bool isRunning() const { return running; }
+    bool wasCancelled() const { return cancelled; }
+    QString errorString() const { return errorText; }
+
+    // Whoever takes the result is responsible for deleting it. It's NULL if there
+    // wasn't one (or it's already been taken).
+    CombinedROMDevice *takeResult();
+
+    // The disk image after compression, along with the hash of the uncompressed
+    // version. Both are empty if the disk image didn't need compressing. When it's
+    // compressed while it's written, the image isn't there until
+    // compressedImageReady() is emitted.
+    QByteArray compressedImageHash() const { return prepared.hash; }
+    QByteArray compressedImage() const { return prepared.compressedImage; }
+    // Whether the disk image is still being compressed for a result that's already
+    // been handed over
+    bool isStreaming() const { return streaming; }
+
+    void start(Inputs const &inputs);
+
+public slots:
+    void cancel();
+
+signals:
+    // max is 0 if there's no way to tell how far along we are
+    void progressChanged(QString const &stage, int value, int max);
+    void finished(bool succeeded);
+    // Only when the disk image was compressed while it was written
+    void compressedImageReady();
+
+private slots:
+    void preparationFinished();
+    void compressionProgressChanged(int value);
+    void compressionFinished();
+
+private:
+    struct Prepared
+    {
+        Prepared() : romLength(0), needsCompression(false) {}
+
+        qint64 romLength;
+        QList<ROMPatch> romPatches;
+        QByteArray diskImage;
+        bool needsCompression;
+        QByteArray hash;
+        QByteArray compressedImage;
+        QString error;
+    };
+
+    static Prepared prepare(Inputs inputs, QAtomicInt *cancelFlag, CompressedImageCache *imageCache);
+    void combine(QByteArray const &diskImage, CompressedImageStream *diskStream = NULL);
+    void finish(bool succeeded, QString const &error = QString());
+
+    FC8BlockCache *blockCache;
+    CompressedImageCache *imageCache;
+    QFutureWatcher<Prepared> preparationWatcher;
+    QFutureWatcher<QByteArray> compressionWatcher;
+    QAtomicInt cancelRequested;
+    Inputs inputs;
+    Prepared prepared;
+    CombinedROMDevice *combinedROM;
+    QPointer<CompressedImageStream> stream;
+    // Whether compressionWatcher is watching compression for this build
+    bool compressing;
+    bool streaming;
+    bool running;
+    bool cancelled;
+    QString errorText;
+};
+
+#endif // ROMBUILDER_H
@@ -0,0 +1,165 @@
+#include "romchecksum.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ROM_CHECKSUM_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ROM_CHECKSUM_NEON
+#include <arm_neon.h>
+#endif
+
+#define ROM_HEADER_CHECKSUM_OFFSET      0x00
+#define ROM_HEADER_LENGTH_OFFSET        0x40
+
+static uint32_t readBigEndian32(QByteArray const &data, int offset)
+{
+    if (data.size() < offset + 4)
+    {
+        return 0;
+    }
+
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(data.constData()) + offset;
+    return (static_cast<uint32_t>(p[0]) << 24) |
+           (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) |
+           (static_cast<uint32_t>(p[3]) << 0);
+}
+
+uint32_t ROMChecksum::checksumInHeader(QByteArray const &rom)
+{
+    return readBigEndian32(rom, ROM_HEADER_CHECKSUM_OFFSET);
+}
+
+uint32_t ROMChecksum::lengthInHeader(QByteArray const &rom)
+{
+    return readBigEndian32(rom, ROM_HEADER_LENGTH_OFFSET);
+}
+
+// Adds up the big-endian 16-bit words in data (len is rounded down to a whole word).
+// Rather than byte swapping every word, this adds up the high bytes and the low bytes
+// separately, since sum(hi * 256 + lo) = 256 * sum(hi) + sum(lo). Both of those are
+// just horizontal byte sums, which SSE2 and NEON are good at.
+uint32_t ROMChecksum::sumWords(const uint8_t *data, size_t len)
+{
+    uint64_t hiSum = 0;
+    uint64_t loSum = 0;
+    size_t i = 0;
+
+#if defined(ROM_CHECKSUM_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i hiMask = _mm_set1_epi16(0x00FF);
+    __m128i hiAcc = _mm_setzero_si128();
+    __m128i loAcc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16)
+    {
+        // In memory order the high byte of each word comes first, so it ends up in
+        // the bottom of each 16-bit element. _mm_sad_epu8 against zero sums up each
+        // half of the register into a 64-bit total, which can't overflow.
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        hiAcc = _mm_add_epi64(hiAcc, _mm_sad_epu8(_mm_and_si128(v, hiMask), zero));
+        loAcc = _mm_add_epi64(loAcc, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+    }
+
+    uint64_t hiParts[2];
+    uint64_t loParts[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(hiParts), hiAcc);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(loParts), loAcc);
+    hiSum = hiParts[0] + hiParts[1];
+    loSum = loParts[0] + loParts[1];
+#elif defined(ROM_CHECKSUM_NEON)
+    uint32x4_t hiAcc = vdupq_n_u32(0);
+    uint32x4_t loAcc = vdupq_n_u32(0);
+    for (; i + 32 <= len; i += 32)
+    {
+        // vld2 splits the even (high) and odd (low) bytes for us. Each 32-bit lane
+        // collects at most 4 * 255 per pass, so this is good for way more than a
+        // SIMM's worth of data before it could overflow.
+        const uint8x16x2_t v = vld2q_u8(data + i);
+        hiAcc = vpadalq_u16(hiAcc, vpaddlq_u8(v.val[0]));
+        loAcc = vpadalq_u16(loAcc, vpaddlq_u8(v.val[1]));
+    }
+
+    uint32_t hiParts[4];
+    uint32_t loParts[4];
+    vst1q_u32(hiParts, hiAcc);
+    vst1q_u32(loParts, loAcc);
+    for (int x = 0; x < 4; x++)
+    {
+        hiSum += hiParts[x];
+        loSum += loParts[x];
+    }
+#endif
+
+    for (; i + 2 <= len; i += 2)
+    {
+        hiSum += data[i];
+        loSum += data[i + 1];
+    }
+
+    return static_cast<uint32_t>((hiSum << 8) + loSum);
+}
+
+uint32_t ROMChecksum::calculate(const uint8_t *rom, size_t len)
+{
+    // The checksum itself isn't included
+    if (len <= 4)
+    {
+        return 0;
+    }
+    return sumWords(rom + 4, len - 4);
+}
+
+bool ROMChecksum::calculate(QByteArray const &rom, uint32_t len, uint32_t &checksum)
+{
+    if (static_cast<uint32_t>(rom.length()) < len)
+    {
+        return false;
+    }
+
+    checksum = calculate(reinterpret_cast<const uint8_t *>(rom.constData()), len);
+    return true;
+}
+
+QList<QPair<uint32_t, uint32_t> > ROMChecksum::powerOfTwoChecksums(QByteArray const &rom,
+                                                                   uint32_t minLength, uint32_t maxLength)
+{
+    QList<QPair<uint32_t, uint32_t> > checksums;
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(rom.constData());
+    const uint32_t romLength = static_cast<uint32_t>(rom.length());
+
+    // Each length's checksum is the previous one plus the words in between, so
+    // every byte only gets looked at once.
+    uint32_t checksum = 0;
+    uint32_t start = 4;
+    for (uint32_t len = minLength; len > 0 && len <= maxLength && len <= romLength; len *= 2)
+    {
+        if (len > start)
+        {
+            checksum += sumWords(data + start, len - start);
+            start = len;
+        }
+        checksums.append(qMakePair(len, checksum));
+
+        // Don't wrap around back to 0
+        if (len >= 0x80000000U)
+        {
+            break;
+        }
+    }
+
+    return checksums;
+}
+
+uint32_t ROMChecksum::findMatchingLength(QByteArray const &rom, uint32_t expected,
+                                         uint32_t minLength, uint32_t maxLength)
+{
+    QList<QPair<uint32_t, uint32_t> > checksums = powerOfTwoChecksums(rom, minLength, maxLength);
+    for (int x = 0; x < checksums.count(); x++)
+    {
+        if (checksums[x].second == expected)
+        {
+            return checksums[x].first;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef ROMCHECKSUM_H
+#define ROMCHECKSUM_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <stddef.h>
+#include <stdint.h>
+
+// The checksum stored in the first 4 bytes of a Mac ROM: the sum of all the big-endian
+// 16-bit words after it, up to the length of the ROM.
+class ROMChecksum
+{
+public:
+    // Where the ROM keeps its own checksum and length (the length is only there in
+    // ROM version 7A and later)
+    static uint32_t checksumInHeader(QByteArray const &rom);
+    static uint32_t lengthInHeader(QByteArray const &rom);
+
+    // The checksum of the first len bytes of the ROM. len should be even.
+    static uint32_t calculate(const uint8_t *rom, size_t len);
+    static bool calculate(QByteArray const &rom, uint32_t len, uint32_t &checksum);
+
+    // The checksum of the first minLength, 2*minLength, 4*minLength... bytes up to
+    // maxLength (or the end of the ROM), all in one pass over the data. Each entry is
+    // (length, checksum).
+    static QList<QPair<uint32_t, uint32_t> > powerOfTwoChecksums(QByteArray const &rom,
+                                                                 uint32_t minLength, uint32_t maxLength);
+
+    // For old ROMs that don't say how long they are: the first of the power-of-two
+    // lengths above whose checksum matches expected, or 0 if none do.
+    static uint32_t findMatchingLength(QByteArray const &rom, uint32_t expected,
+                                       uint32_t minLength, uint32_t maxLength);
+
+private:
+    static uint32_t sumWords(const uint8_t *data, size_t len);
+};
+
+#endif // ROMCHECKSUM_H
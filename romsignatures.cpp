@@ -0,0 +1,350 @@
+#include "romsignatures.h"
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <string.h>
+
+// For string literals, which may have NULs in them
+#define SIGNATURE_BYTES(s)      s, static_cast<int>(sizeof(s) - 1)
+
+#define ROM_SCAN_CACHE_SIZE     4
+
+// bbraun's 8 MB 0.9.6 base image has a bug that can cause a bus error when booting with R+A
+// if a write is attempted before the ROM disk has been copied to RAM. Work around this
+// bug if the driver exactly matches the known broken driver. The fix is, when deciding if
+// a write operation is allowed or not, to look at origdisk instead of drvsts.writeProt.
+// writeProt can say the drive is writable even though it hasn't been copied to RAM yet.
+// When origdisk is non-null, we're guaranteed it's in RAM, so it's a safer check.
+static const ROMDriverFix bbraun8MBWriteProtectFix =
+{
+    0x51D40, 0x7BC, "\x0E\x12\x43\x36\x03\x48\x5C\xDE\x2E\x4C\x04\xE3\x30\xF9\xD2\x0B",
+    {
+        {0x521F1, 0xAA},    // Change opcode from tst.b to tst.l
+        {0x521F3, 0x22},    // Change tested data from drvsts.writeProt to origdisk
+        {0x521F4, 0x67},    // Change bne to beq
+    },
+    3
+};
+
+// If more than one of these matches, the first one wins
+static const ROMFamily romFamilies[] =
+{
+    {"Garrett's Workshop", 0x51DC4,
+     {SIGNATURE_BYTES("Garrett's Workshop ROM Disk"), -1},
+     0x51DAC, false, 0, NULL},
+
+    // BMOW's driver is the one that introduced compression, and it finds the disk
+    // size on its own.
+    {"BMOW", 0x51DC4,
+     {SIGNATURE_BYTES(" block-compressed disk image"), -1},
+     -1, false, 0, NULL},
+
+    // bbraun's ROM disk driver as patched into a Quadra ROM by CayMac. It isn't at
+    // a fixed location, but the disk size goes right after this sequence.
+    {"bbraun (Quadra)", 0x100000,
+     {SIGNATURE_BYTES("\x3F\xFF\xFF\xF8\x00\x00\x00\x00\x01\x08\x00\x00\x01\x0C\x40\x90\x00\x00"), -1},
+     -1, true, 0, NULL},
+
+    // A known byte pattern in bbraun's ROM disk driver...
+    {"bbraun 8 MB", 0x51DC4,
+     {SIGNATURE_BYTES("\x4E\xBA\x04\xDC"), 0x51DC0},
+     0x52500, false, 0, &bbraun8MBWriteProtectFix},
+
+    // ...which is slightly different in the 2 MB version
+    {"bbraun 2 MB", 0x51DC4,
+     {SIGNATURE_BYTES("\x4E\xBA\x03\x02"), 0x51DC0},
+     -1, false, 1572864, NULL},
+};
+
+// This string shows up in custom ROMs that support compression
+static const ROMSignature compressionSignature = {SIGNATURE_BYTES(" block-compressed disk image"), -1};
+
+MultiPatternMatcher::MultiPatternMatcher()
+{
+    build();
+}
+
+int MultiPatternMatcher::addPattern(QByteArray const &pattern)
+{
+    patterns.append(pattern);
+
+    // There are only ever a handful of patterns, so just start over each time. That
+    // way the matcher is always ready to go and is safe to share between threads.
+    build();
+    return patterns.count() - 1;
+}
+
+void MultiPatternMatcher::build()
+{
+    // Start with a trie of all the patterns. -1 means there's no child yet.
+    QVector<int> trie(256, -1);
+    outputs.clear();
+    outputs.append(QList<int>());
+
+    for (int p = 0; p < patterns.count(); p++)
+    {
+        QByteArray const &pattern = patterns[p];
+        if (pattern.isEmpty())
+        {
+            continue;
+        }
+
+        int state = 0;
+        for (int i = 0; i < pattern.size(); i++)
+        {
+            const int c = static_cast<uint8_t>(pattern.at(i));
+            if (trie[state * 256 + c] < 0)
+            {
+                trie[state * 256 + c] = outputs.count();
+                outputs.append(QList<int>());
+                trie.resize(trie.size() + 256);
+                memset(trie.data() + trie.size() - 256, 0xFF, 256 * sizeof(int));
+            }
+            state = trie[state * 256 + c];
+        }
+        outputs[state].append(p);
+    }
+
+    // Then go through it breadth first, filling in the failure links and turning
+    // every missing child into a direct transition, so searching never backtracks.
+    QVector<int> failure(outputs.count(), 0);
+    QList<int> queue;
+    for (int c = 0; c < 256; c++)
+    {
+        if (trie[c] < 0)
+        {
+            trie[c] = 0;
+        }
+        else
+        {
+            queue.append(trie[c]);
+        }
+    }
+
+    while (!queue.isEmpty())
+    {
+        const int state = queue.takeFirst();
+        for (int c = 0; c < 256; c++)
+        {
+            const int child = trie[state * 256 + c];
+            const int fallback = trie[failure[state] * 256 + c];
+            if (child < 0)
+            {
+                trie[state * 256 + c] = fallback;
+            }
+            else
+            {
+                failure[child] = fallback;
+                outputs[child] += outputs[fallback];
+                queue.append(child);
+            }
+        }
+    }
+
+    transitions.resize(trie.size());
+    for (int i = 0; i < trie.size(); i++)
+    {
+        transitions[i] = static_cast<uint16_t>(trie[i]);
+    }
+}
+
+QVector<int> MultiPatternMatcher::firstMatches(const uint8_t *data, int len) const
+{
+    QVector<int> matches(patterns.count(), -1);
+
+    int remaining = 0;
+    for (int p = 0; p < patterns.count(); p++)
+    {
+        if (!patterns[p].isEmpty())
+        {
+            remaining++;
+        }
+    }
+
+    const uint16_t *table = transitions.constData();
+    int state = 0;
+    for (int i = 0; i < len && remaining > 0; i++)
+    {
+        state = table[state * 256 + data[i]];
+        QList<int> const &found = outputs.at(state);
+        for (int x = 0; x < found.count(); x++)
+        {
+            const int p = found[x];
+            if (matches[p] < 0)
+            {
+                matches[p] = i - patterns[p].size() + 1;
+                remaining--;
+            }
+        }
+    }
+
+    return matches;
+}
+
+QVector<int> MultiPatternMatcher::firstMatches(QByteArray const &data) const
+{
+    return firstMatches(reinterpret_cast<const uint8_t *>(data.constData()), data.size());
+}
+
+// Everything that has to be searched for, all in one matcher. The family signatures
+// that float come first, in table order, and then the compression one.
+static MultiPatternMatcher const &floatingSignatureMatcher()
+{
+    static MultiPatternMatcher *matcher = NULL;
+    static QMutex mutex;
+
+    QMutexLocker locker(&mutex);
+    if (!matcher)
+    {
+        matcher = new MultiPatternMatcher();
+        for (size_t i = 0; i < sizeof(romFamilies) / sizeof(romFamilies[0]); i++)
+        {
+            ROMSignature const &sig = romFamilies[i].signature;
+            // Fixed position ones are simple enough to just check directly
+            matcher->addPattern(sig.offset < 0 ? QByteArray(sig.bytes, sig.length) : QByteArray());
+        }
+        matcher->addPattern(QByteArray(compressionSignature.bytes, compressionSignature.length));
+    }
+    return *matcher;
+}
+
+ROMScanResult ROMSignatures::scan(QByteArray const &rom)
+{
+    static QList<QPair<QByteArray, ROMScanResult> > cache;
+    static QMutex cacheMutex;
+
+    QMutexLocker locker(&cacheMutex);
+    for (int x = 0; x < cache.count(); x++)
+    {
+        // The last few ROMs scanned are kept along with their results, keyed on
+        // their whole contents. Comparing a ROM with each of them in full is still
+        // a lot quicker than scanning it again.
+        if (cache[x].first == rom)
+        {
+            if (x > 0)
+            {
+                cache.move(x, 0);
+            }
+            return cache[0].second;
+        }
+    }
+    locker.unlock();
+
+    ROMScanResult result = scanUncached(rom);
+
+    locker.relock();
+    cache.prepend(qMakePair(rom, result));
+    while (cache.count() > ROM_SCAN_CACHE_SIZE)
+    {
+        cache.removeLast();
+    }
+    return result;
+}
+
+ROMScanResult ROMSignatures::scanUncached(QByteArray const &rom)
+{
+    const int numFamilies = static_cast<int>(sizeof(romFamilies) / sizeof(romFamilies[0]));
+    const QVector<int> matches = floatingSignatureMatcher().firstMatches(rom);
+
+    ROMScanResult result;
+    result.supportsCompression = matches[numFamilies] >= 0;
+
+    for (int i = 0; i < numFamilies; i++)
+    {
+        ROMFamily const &family = romFamilies[i];
+        if (static_cast<uint32_t>(rom.size()) < family.minimumROMSize)
+        {
+            continue;
+        }
+
+        int matchOffset = -1;
+        if (family.signature.offset < 0)
+        {
+            matchOffset = matches[i];
+        }
+        else if (family.signature.offset + family.signature.length <= rom.size() &&
+                 memcmp(rom.constData() + family.signature.offset,
+                        family.signature.bytes, family.signature.length) == 0)
+        {
+            matchOffset = family.signature.offset;
+        }
+
+        if (matchOffset >= 0)
+        {
+            result.family = &family;
+            result.diskSizeOffset = family.diskSizeFollowsSignature ?
+                        matchOffset + family.signature.length : family.diskSizeOffset;
+            break;
+        }
+    }
+
+    return result;
+}
+
+void ROMSignatures::patch(QByteArray &rom, ROMScanResult const &result, uint32_t diskImageSize)
+{
+    applyPatches(rom, 0, patches(rom, result, diskImageSize));
+}
+
+QList<ROMPatch> ROMSignatures::patches(QByteArray const &rom, ROMScanResult const &result, uint32_t diskImageSize)
+{
+    QList<ROMPatch> list;
+    if (!result.family)
+    {
+        return list;
+    }
+
+    if (result.diskSizeOffset >= 0 && result.diskSizeOffset + 4 <= rom.size())
+    {
+        QByteArray size(4, static_cast<char>(0));
+        size[0] = (diskImageSize >> 24) & 0xFF;
+        size[1] = (diskImageSize >> 16) & 0xFF;
+        size[2] = (diskImageSize >> 8) & 0xFF;
+        size[3] = (diskImageSize >> 0) & 0xFF;
+        list.append(ROMPatch(result.diskSizeOffset, size));
+    }
+
+    // The fix's checksum covers the ROM with the size already patched in
+    ROMDriverFix const *fix = result.family->fix;
+    if (fix)
+    {
+        QByteArray region = rom.mid(fix->regionOffset, fix->regionLength);
+        applyPatches(region, fix->regionOffset, list);
+        if (QCryptographicHash::hash(region, QCryptographicHash::Md5) == QByteArray(fix->regionMD5, 16))
+        {
+            for (int x = 0; x < fix->numChanges; x++)
+            {
+                list.append(ROMPatch(fix->changes[x].offset, QByteArray(1, static_cast<char>(fix->changes[x].value))));
+            }
+        }
+    }
+
+    return list;
+}
+
+void ROMSignatures::applyPatches(QByteArray &data, uint32_t offset, QList<ROMPatch> const &patches)
+{
+    const qint64 start = offset;
+    const qint64 end = start + data.length();
+    foreach (ROMPatch const &patch, patches)
+    {
+        // Only whatever part of it lands in here
+        const qint64 from = qMax(start, static_cast<qint64>(patch.offset));
+        const qint64 to = qMin(end, static_cast<qint64>(patch.offset) + patch.bytes.length());
+        for (qint64 i = from; i < to; i++)
+        {
+            data[static_cast<int>(i - start)] = patch.bytes[static_cast<int>(i - patch.offset)];
+        }
+    }
+}
+
+QList<ROMFamily const *> ROMSignatures::families()
+{
+    QList<ROMFamily const *> list;
+    for (size_t i = 0; i < sizeof(romFamilies) / sizeof(romFamilies[0]); i++)
+    {
+        list.append(&romFamilies[i]);
+    }
+    return list;
+}
@@ -0,0 +1,116 @@
+#ifndef ROMSIGNATURES_H
+#define ROMSIGNATURES_H
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <stdint.h>
+
+// Finds the first occurrence of each of a set of byte patterns in a single pass over
+// the data, using an Aho-Corasick automaton. Set it up once, then search as many
+// buffers as you like.
+class MultiPatternMatcher
+{
+public:
+    MultiPatternMatcher();
+
+    // Returns the index of the pattern, used in the results of firstMatches()
+    int addPattern(QByteArray const &pattern);
+    int patternCount() const { return patterns.count(); }
+
+    // For each pattern, the offset where it first starts in data, or -1. Stops
+    // early once everything has been found.
+    QVector<int> firstMatches(const uint8_t *data, int len) const;
+    QVector<int> firstMatches(QByteArray const &data) const;
+
+private:
+    void build();
+
+    QList<QByteArray> patterns;
+
+    // Each state has a full 256-entry transition row, so the search loop is just a
+    // table lookup per byte. There are only ever a few dozen states.
+    QVector<uint16_t> transitions;
+    QVector<QList<int> > outputs;
+};
+
+// A byte pattern in a patched ROM's disk driver that shows it's a particular kind
+// of custom ROM.
+struct ROMSignature
+{
+    const char *bytes;
+    int length;
+    int32_t offset;             // where it has to be, or -1 to look for it anywhere
+};
+
+// A fix for a known bug in a particular version of a ROM disk driver. It's only
+// applied if the MD5 of the given region of the ROM matches exactly.
+struct ROMDriverFix
+{
+    uint32_t regionOffset;
+    uint32_t regionLength;
+    const char *regionMD5;      // 16 bytes
+    struct { uint32_t offset; uint8_t value; } changes[4];
+    int numChanges;
+};
+
+// Everything we know about one family of custom ROMs with ROM disk support. To
+// teach the app about a new one, add an entry to the table in romsignatures.cpp.
+struct ROMFamily
+{
+    const char *name;
+    uint32_t minimumROMSize;
+    ROMSignature signature;
+    // Where the size of the disk image has to be patched in: at a fixed offset, or
+    // just after the signature if it floats around (-1 if it's not patched at all)
+    int32_t diskSizeOffset;
+    bool diskSizeFollowsSignature;
+    uint32_t maxDiskImageSize;  // 0 for no limit
+    const ROMDriverFix *fix;
+};
+
+// What ROMSignatures::scan() found out about a ROM
+struct ROMScanResult
+{
+    ROMScanResult() : family(NULL), supportsCompression(false), diskSizeOffset(-1) {}
+
+    ROMFamily const *family;    // NULL if it's not a ROM we know how to patch
+    bool supportsCompression;
+    int diskSizeOffset;         // where the disk image size goes, or -1
+};
+
+// Bytes to change at one spot in a ROM, for when it isn't worth copying the whole
+// ROM just to change a few of them
+struct ROMPatch
+{
+    ROMPatch() : offset(0) {}
+    ROMPatch(uint32_t offset, QByteArray const &bytes) : offset(offset), bytes(bytes) {}
+
+    uint32_t offset;
+    QByteArray bytes;
+};
+
+class ROMSignatures
+{
+public:
+    // Checks a ROM against all the known signatures in one pass. The last few
+    // results are remembered, so calling this over and over on the same ROM (which
+    // the GUI does a lot) is cheap.
+    static ROMScanResult scan(QByteArray const &rom);
+
+    // Patches the disk image size (and any known driver bugs) into the ROM
+    static void patch(QByteArray &rom, ROMScanResult const &result, uint32_t diskImageSize);
+
+    // The same changes patch() would make, without making them
+    static QList<ROMPatch> patches(QByteArray const &rom, ROMScanResult const &result, uint32_t diskImageSize);
+
+    // Makes the changes to the part of a ROM that starts at offset
+    static void applyPatches(QByteArray &data, uint32_t offset, QList<ROMPatch> const &patches);
+
+    static QList<ROMFamily const *> families();
+
+private:
+    static ROMScanResult scanUncached(QByteArray const &rom);
+};
+
+#endif // ROMSIGNATURES_H
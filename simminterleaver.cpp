@@ -0,0 +1,430 @@
+#include "simminterleaver.h"
+#include "bufferpool.h"
+#include <QFile>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMM_INTERLEAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMM_INTERLEAVE_NEON
+#include <arm_neon.h>
+#endif
+
+// The kernels below all work in terms of byte lanes (lane 0 = the first byte(s) of
+// each 32-bit word) rather than chip numbers. They handle as many whole blocks as
+// they can and return how many words they got through; the caller does the rest.
+
+#if defined(SIMM_INTERLEAVE_SSE2)
+
+static size_t interleave4x8Vector(const uint8_t * const lanes[4], size_t words, uint8_t *out)
+{
+    size_t w;
+    for (w = 0; w + 16 <= words; w += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes[0] + w));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes[1] + w));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes[2] + w));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes[3] + w));
+
+        // a0 b0 a1 b1... and c0 d0 c1 d1..., then zip those together 16 bits at a time
+        const __m128i abLo = _mm_unpacklo_epi8(a, b);
+        const __m128i abHi = _mm_unpackhi_epi8(a, b);
+        const __m128i cdLo = _mm_unpacklo_epi8(c, d);
+        const __m128i cdHi = _mm_unpackhi_epi8(c, d);
+
+        __m128i *dst = reinterpret_cast<__m128i *>(out + w * 4);
+        _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(abLo, cdLo));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(abLo, cdLo));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(abHi, cdHi));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(abHi, cdHi));
+    }
+    return w;
+}
+
+static size_t interleave2x16Vector(const uint8_t * const lanes[2], size_t words, uint8_t *out)
+{
+    size_t w;
+    for (w = 0; w + 8 <= words; w += 8)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes[0] + w * 2));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes[1] + w * 2));
+
+        __m128i *dst = reinterpret_cast<__m128i *>(out + w * 4);
+        _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(a, b));
+    }
+    return w;
+}
+
+static size_t deinterleave4x8Vector(const uint8_t *simm, size_t words, uint8_t * const lanes[4])
+{
+    // SSE2 has no byte shuffle, so each lane is shifted down to the bottom of its
+    // 32-bit word and then narrowed with the saturating packs (which can't saturate,
+    // since everything is 0-255 by then).
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    size_t w;
+    for (w = 0; w + 16 <= words; w += 16)
+    {
+        const __m128i *src = reinterpret_cast<const __m128i *>(simm + w * 4);
+        const __m128i v0 = _mm_loadu_si128(src + 0);
+        const __m128i v1 = _mm_loadu_si128(src + 1);
+        const __m128i v2 = _mm_loadu_si128(src + 2);
+        const __m128i v3 = _mm_loadu_si128(src + 3);
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            const __m128i shift = _mm_cvtsi32_si128(lane * 8);
+            const __m128i x0 = _mm_and_si128(_mm_srl_epi32(v0, shift), byteMask);
+            const __m128i x1 = _mm_and_si128(_mm_srl_epi32(v1, shift), byteMask);
+            const __m128i x2 = _mm_and_si128(_mm_srl_epi32(v2, shift), byteMask);
+            const __m128i x3 = _mm_and_si128(_mm_srl_epi32(v3, shift), byteMask);
+            const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(x0, x1), _mm_packs_epi32(x2, x3));
+            if (lanes[lane])
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[lane] + w), packed);
+            }
+        }
+    }
+    return w;
+}
+
+static size_t deinterleave2x16Vector(const uint8_t *simm, size_t words, uint8_t * const lanes[2])
+{
+    // Same idea as above. Sign extending each half to 32 bits first means the signed
+    // pack gives back exactly the original 16 bits.
+    size_t w;
+    for (w = 0; w + 8 <= words; w += 8)
+    {
+        const __m128i *src = reinterpret_cast<const __m128i *>(simm + w * 4);
+        const __m128i v0 = _mm_loadu_si128(src + 0);
+        const __m128i v1 = _mm_loadu_si128(src + 1);
+
+        if (lanes[0])
+        {
+            const __m128i lo0 = _mm_srai_epi32(_mm_slli_epi32(v0, 16), 16);
+            const __m128i lo1 = _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[0] + w * 2), _mm_packs_epi32(lo0, lo1));
+        }
+        if (lanes[1])
+        {
+            const __m128i hi0 = _mm_srai_epi32(v0, 16);
+            const __m128i hi1 = _mm_srai_epi32(v1, 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[1] + w * 2), _mm_packs_epi32(hi0, hi1));
+        }
+    }
+    return w;
+}
+
+#elif defined(SIMM_INTERLEAVE_NEON)
+
+static size_t interleave4x8Vector(const uint8_t * const lanes[4], size_t words, uint8_t *out)
+{
+    size_t w;
+    for (w = 0; w + 16 <= words; w += 16)
+    {
+        uint8x16x4_t v;
+        v.val[0] = vld1q_u8(lanes[0] + w);
+        v.val[1] = vld1q_u8(lanes[1] + w);
+        v.val[2] = vld1q_u8(lanes[2] + w);
+        v.val[3] = vld1q_u8(lanes[3] + w);
+        vst4q_u8(out + w * 4, v);
+    }
+    return w;
+}
+
+static size_t interleave2x16Vector(const uint8_t * const lanes[2], size_t words, uint8_t *out)
+{
+    // Treating the pairs of bytes as 16-bit elements keeps them in memory order,
+    // whatever the endianness.
+    size_t w;
+    for (w = 0; w + 8 <= words; w += 8)
+    {
+        uint8x16x2_t v;
+        v.val[0] = vld1q_u8(lanes[0] + w * 2);
+        v.val[1] = vld1q_u8(lanes[1] + w * 2);
+        uint16x8x2_t v16;
+        v16.val[0] = vreinterpretq_u16_u8(v.val[0]);
+        v16.val[1] = vreinterpretq_u16_u8(v.val[1]);
+        vst2q_u16(reinterpret_cast<uint16_t *>(out + w * 4), v16);
+    }
+    return w;
+}
+
+static size_t deinterleave4x8Vector(const uint8_t *simm, size_t words, uint8_t * const lanes[4])
+{
+    size_t w;
+    for (w = 0; w + 16 <= words; w += 16)
+    {
+        const uint8x16x4_t v = vld4q_u8(simm + w * 4);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (lanes[lane])
+            {
+                vst1q_u8(lanes[lane] + w, v.val[lane]);
+            }
+        }
+    }
+    return w;
+}
+
+static size_t deinterleave2x16Vector(const uint8_t *simm, size_t words, uint8_t * const lanes[2])
+{
+    size_t w;
+    for (w = 0; w + 8 <= words; w += 8)
+    {
+        const uint16x8x2_t v = vld2q_u16(reinterpret_cast<const uint16_t *>(simm + w * 4));
+        for (int lane = 0; lane < 2; lane++)
+        {
+            if (lanes[lane])
+            {
+                vst1q_u8(lanes[lane] + w * 2, vreinterpretq_u8_u16(v.val[lane]));
+            }
+        }
+    }
+    return w;
+}
+
+#else
+
+// No vector unit we know about; the scalar loops below do everything
+static size_t interleave4x8Vector(const uint8_t * const *, size_t, uint8_t *) { return 0; }
+static size_t interleave2x16Vector(const uint8_t * const *, size_t, uint8_t *) { return 0; }
+static size_t deinterleave4x8Vector(const uint8_t *, size_t, uint8_t * const *) { return 0; }
+static size_t deinterleave2x16Vector(const uint8_t *, size_t, uint8_t * const *) { return 0; }
+
+#endif
+
+SIMMInterleaver::SIMMInterleaver(SIMMLaneLayout layout) :
+    _layout(layout)
+{
+}
+
+uint8_t SIMMInterleaver::chipMask(int chip) const
+{
+    if (chip < 0 || chip >= chipCount())
+    {
+        return 0;
+    }
+
+    // The mask has a bit per byte lane, and IC1 is at the top
+    if (_layout == SIMMLayout2x16)
+    {
+        return chip == 0 ? 0x0C : 0x03;
+    }
+    return 1 << (3 - chip);
+}
+
+void SIMMInterleaver::interleave(const uint8_t * const chips[], const size_t chipLengths[],
+                                 size_t chipLength, uint8_t *out) const
+{
+    const int numLanes = chipCount();
+    const int laneBytes = bytesPerChipPerWord();
+    const size_t words = chipLength / laneBytes;
+
+    const uint8_t *lanes[4];
+    size_t laneLengths[4];
+    size_t fullWords = words;
+    for (int lane = 0; lane < numLanes; lane++)
+    {
+        const int chip = numLanes - 1 - lane;
+        lanes[lane] = chips[chip];
+        laneLengths[lane] = chips[chip] ? qMin(chipLengths[chip], chipLength) : 0;
+        fullWords = qMin(fullWords, laneLengths[lane] / laneBytes);
+    }
+
+    // The vector code can run as far as every chip has real data. Past that (for
+    // short or missing chips) it's the slow way, padding with 0xFF.
+    size_t w = (_layout == SIMMLayout2x16) ?
+                interleave2x16Vector(lanes, fullWords, out) :
+                interleave4x8Vector(lanes, fullWords, out);
+
+    for (; w < words; w++)
+    {
+        uint8_t *dst = out + w * 4;
+        for (int lane = 0; lane < numLanes; lane++)
+        {
+            for (int b = 0; b < laneBytes; b++)
+            {
+                const size_t index = w * laneBytes + b;
+                *dst++ = (index < laneLengths[lane]) ? lanes[lane][index] : 0xFF;
+            }
+        }
+    }
+}
+
+void SIMMInterleaver::deinterleave(const uint8_t *simm, size_t simmLength, uint8_t * const chips[]) const
+{
+    const int numLanes = chipCount();
+    const int laneBytes = bytesPerChipPerWord();
+    const size_t words = simmLength / 4;
+
+    uint8_t *lanes[4];
+    for (int lane = 0; lane < numLanes; lane++)
+    {
+        lanes[lane] = chips[numLanes - 1 - lane];
+    }
+
+    size_t w = (_layout == SIMMLayout2x16) ?
+                deinterleave2x16Vector(simm, words, lanes) :
+                deinterleave4x8Vector(simm, words, lanes);
+
+    for (; w < words; w++)
+    {
+        const uint8_t *src = simm + w * 4;
+        for (int lane = 0; lane < numLanes; lane++)
+        {
+            if (lanes[lane])
+            {
+                memcpy(lanes[lane] + w * laneBytes, src, laneBytes);
+            }
+            src += laneBytes;
+        }
+    }
+}
+
+QByteArray SIMMInterleaver::interleave(QList<QByteArray> const &chips) const
+{
+    const uint8_t *chipData[4] = {NULL, NULL, NULL, NULL};
+    size_t chipLengths[4] = {0, 0, 0, 0};
+    size_t chipLength = 0;
+    for (int chip = 0; chip < chipCount() && chip < chips.count(); chip++)
+    {
+        chipData[chip] = reinterpret_cast<const uint8_t *>(chips[chip].constData());
+        chipLengths[chip] = chips[chip].size();
+        chipLength = qMax(chipLength, chipLengths[chip]);
+    }
+
+    // An odd-sized image for a 16-bit chip gets padded out to a whole word
+    chipLength = (chipLength + bytesPerChipPerWord() - 1) / bytesPerChipPerWord() * bytesPerChipPerWord();
+
+    QByteArray simm(static_cast<int>(chipLength * chipCount()), Qt::Uninitialized);
+    interleave(chipData, chipLengths, chipLength, reinterpret_cast<uint8_t *>(simm.data()));
+    return simm;
+}
+
+QList<QByteArray> SIMMInterleaver::deinterleave(QByteArray const &simm) const
+{
+    const int chipLength = simm.size() / 4 * bytesPerChipPerWord();
+
+    QList<QByteArray> chips;
+    uint8_t *chipData[4];
+    for (int chip = 0; chip < chipCount(); chip++)
+    {
+        chips.append(QByteArray(chipLength, Qt::Uninitialized));
+        chipData[chip] = reinterpret_cast<uint8_t *>(chips[chip].data());
+    }
+
+    deinterleave(reinterpret_cast<const uint8_t *>(simm.constData()), simm.size(), chipData);
+    return chips;
+}
+
+bool SIMMInterleaver::interleaveFiles(QStringList const &paths, qint64 maxChipSize,
+                                      QByteArray &simm, QString *errorString) const
+{
+    QFile files[4];
+    QByteArray unmapped[4];
+    const uint8_t *chipData[4] = {NULL, NULL, NULL, NULL};
+    size_t chipLengths[4] = {0, 0, 0, 0};
+    size_t chipLength = 0;
+
+    for (int chip = 0; chip < paths.count(); chip++)
+    {
+        if (paths[chip].isEmpty())
+        {
+            continue;
+        }
+
+        if (chip >= chipCount())
+        {
+            if (errorString) *errorString = QString("This SIMM only has %1 chips.").arg(chipCount());
+            return false;
+        }
+
+        QFile &f = files[chip];
+        f.setFileName(paths[chip]);
+        if (!f.open(QFile::ReadOnly))
+        {
+            if (errorString) *errorString = QString("Unable to open %1: %2").arg(paths[chip], f.errorString());
+            return false;
+        }
+
+        const qint64 size = f.size();
+        if (size > maxChipSize)
+        {
+            if (errorString) *errorString = QString("%1 is too big for the chip.").arg(paths[chip]);
+            return false;
+        }
+
+        // Map the file if we can so it doesn't get copied twice. It stays mapped
+        // until the QFile goes away.
+        if (size > 0)
+        {
+            chipData[chip] = f.map(0, size);
+            if (!chipData[chip])
+            {
+                unmapped[chip] = f.readAll();
+                if (unmapped[chip].size() != size)
+                {
+                    if (errorString) *errorString = QString("Unable to read %1: %2").arg(paths[chip], f.errorString());
+                    return false;
+                }
+                chipData[chip] = reinterpret_cast<const uint8_t *>(unmapped[chip].constData());
+            }
+        }
+        chipLengths[chip] = static_cast<size_t>(size);
+        chipLength = qMax(chipLength, chipLengths[chip]);
+    }
+
+    chipLength = (chipLength + bytesPerChipPerWord() - 1) / bytesPerChipPerWord() * bytesPerChipPerWord();
+
+    // resize() rather than a new array, so a leased buffer's memory gets used
+    simm.resize(static_cast<int>(chipLength * chipCount()));
+    interleave(chipData, chipLengths, chipLength, reinterpret_cast<uint8_t *>(simm.data()));
+    return true;
+}
+
+bool SIMMInterleaver::deinterleaveToFiles(QByteArray const &simm, QStringList const &paths,
+                                          QString *errorString) const
+{
+    const int chipLength = simm.size() / 4 * bytesPerChipPerWord();
+
+    // Only bother splitting out the chips that are actually wanted
+    QByteArray *chips[4] = {NULL, NULL, NULL, NULL};
+    uint8_t *chipData[4] = {NULL, NULL, NULL, NULL};
+    for (int chip = 0; chip < chipCount() && chip < paths.count(); chip++)
+    {
+        if (!paths[chip].isEmpty())
+        {
+            chips[chip] = BufferPool::shared().lease(chipLength);
+            chips[chip]->resize(chipLength);
+            chipData[chip] = reinterpret_cast<uint8_t *>(chips[chip]->data());
+        }
+    }
+
+    deinterleave(reinterpret_cast<const uint8_t *>(simm.constData()), simm.size(), chipData);
+
+    bool success = true;
+    for (int chip = 0; chip < chipCount() && chip < paths.count() && success; chip++)
+    {
+        if (!chipData[chip])
+        {
+            continue;
+        }
+
+        QFile f(paths[chip]);
+        if (!f.open(QFile::WriteOnly | QFile::Truncate) ||
+            f.write(*chips[chip]) != chips[chip]->size())
+        {
+            if (errorString) *errorString = QString("Unable to write %1: %2").arg(paths[chip], f.errorString());
+            success = false;
+        }
+        f.close();
+    }
+
+    for (int chip = 0; chip < 4; chip++)
+    {
+        BufferPool::shared().release(chips[chip]);
+    }
+    return success;
+}
@@ -0,0 +1,71 @@
+#ifndef SIMMINTERLEAVER_H
+#define SIMMINTERLEAVER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
+#include <stddef.h>
+#include <stdint.h>
+
+// How the chips on a SIMM share the 32-bit data bus
+typedef enum SIMMLaneLayout
+{
+    SIMMLayout4x8,      // four 8-bit chips, one per byte lane
+    SIMMLayout2x16      // two 16-bit chips, one per pair of byte lanes
+} SIMMLaneLayout;
+
+// Splits a SIMM image into separate per-chip images and puts them back together.
+//
+// Chips are numbered the way they are on the board, starting with IC1 = 0. IC1 always
+// holds the last (least significant) lane(s) of each 32-bit word in the SIMM image:
+//
+//   4x8:  IC4 IC3 IC2 IC1   (one byte each)
+//   2x16: IC2 IC2 IC1 IC1   (the chip's 16-bit words are kept in the order they're
+//                            stored in the SIMM image)
+//
+// The heavy lifting is done with SSE2 or NEON where available, so splitting or
+// combining a full 8 MB SIMM takes a few milliseconds.
+class SIMMInterleaver
+{
+public:
+    explicit SIMMInterleaver(SIMMLaneLayout layout = SIMMLayout4x8);
+
+    SIMMLaneLayout layout() const { return _layout; }
+    int chipCount() const { return _layout == SIMMLayout2x16 ? 2 : 4; }
+    int bytesPerChipPerWord() const { return 4 / chipCount(); }
+
+    // The write chip mask (see Programmer::writeToSIMM()) that selects a chip
+    uint8_t chipMask(int chip) const;
+
+    // Combines chipCount() chip images into a SIMM image of chipLength * chipCount()
+    // bytes. A chip that's NULL or shorter than chipLength is filled out with 0xFF.
+    // chipLength should be a multiple of bytesPerChipPerWord().
+    void interleave(const uint8_t * const chips[], const size_t chipLengths[],
+                    size_t chipLength, uint8_t *out) const;
+
+    // Splits simmLength bytes of a SIMM image into chipCount() chip images. Only
+    // whole 32-bit words are split up, so each chip gets simmLength / 4 *
+    // bytesPerChipPerWord() bytes and a partial word on the end is left out. NULL
+    // chips are skipped.
+    void deinterleave(const uint8_t *simm, size_t simmLength, uint8_t * const chips[]) const;
+
+    // Same as above, on whole buffers
+    QByteArray interleave(QList<QByteArray> const &chips) const;
+    QList<QByteArray> deinterleave(QByteArray const &simm) const;
+
+    // Reads the chip image files in paths (in chip order; an empty path means that
+    // chip isn't being written) straight into a SIMM image. Fails if a file can't be
+    // read or is bigger than maxChipSize. simm is resized rather than replaced, so if
+    // it already has room (like a buffer from BufferPool), nothing gets allocated.
+    bool interleaveFiles(QStringList const &paths, qint64 maxChipSize,
+                         QByteArray &simm, QString *errorString = NULL) const;
+
+    // Splits a SIMM image and saves the chips that have a path in paths
+    bool deinterleaveToFiles(QByteArray const &simm, QStringList const &paths,
+                             QString *errorString = NULL) const;
+
+private:
+    SIMMLaneLayout _layout;
+};
+
+#endif // SIMMINTERLEAVER_H
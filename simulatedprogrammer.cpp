@@ -0,0 +1,619 @@
+#include "simulatedprogrammer.h"
+#include "programmerprotocol.h"
+#include <QDebug>
+#include <stdlib.h>
+
+SimulatedProgrammer::Timing::Timing() :
+    linkLatencyUs(1000),            // about what a full speed USB round trip costs
+    linkBytesPerSecond(1000000),
+    chipEraseMs(4000),
+    blockEraseMs(250),
+    programUsPerByte(10),
+    electricalTestMs(200),
+    replugMs(500)
+{
+}
+
+SimulatedProgrammer::Faults::Faults() :
+    eraseFails(false),
+    readFails(false),
+    writeErrorAtChunk(-1),
+    deadChipMask(0),
+    readBitErrorRate(0)
+{
+}
+
+SimulatedProgrammer::SimulatedProgrammer(uint32_t capacity, QObject *parent) :
+    QIODevice(parent),
+    simm(capacity, static_cast<char>(0xFF)),
+    firmwareVersion(0x01030000),
+    inBootloader(false),
+    state(StateIdle),
+    shiftedUnlock(false),
+    verifyWhileWriting(false),
+    chipMask(0x0F),
+    sectorLayoutValid(true),
+    wordValue(0),
+    wordBytes(0),
+    pendingCount(0),
+    pendingOffset(0),
+    writeAddress(0),
+    chunksWritten(0),
+    readAddress(0),
+    readRemaining(0),
+    incomingDoneUs(0),
+    wireFreeUs(0)
+{
+    // Pretend it's a SIMM with four 2 MB chips that need the shifted unlock
+    // sequence (M29F160FB). With the straight unlock they just read as erased.
+    for (int chip = 0; chip < 4; chip++)
+    {
+        setChipIdentity(false, chip, 0xFF, 0xFF);
+        setChipIdentity(true, chip, 0x01, 0xD8);
+    }
+
+    clock.start();
+    replyTimer.setSingleShot(true);
+    connect(&replyTimer, SIGNAL(timeout()), SLOT(deliverReplies()));
+}
+
+void SimulatedProgrammer::setChipIdentity(bool shiftedUnlock, int chipIndex, uint8_t manufacturer, uint8_t device)
+{
+    if (chipIndex >= 0 && chipIndex < 4)
+    {
+        chipIDs[shiftedUnlock][chipIndex][0] = manufacturer;
+        chipIDs[shiftedUnlock][chipIndex][1] = device;
+    }
+}
+
+bool SimulatedProgrammer::isSequential() const
+{
+    return true;
+}
+
+qint64 SimulatedProgrammer::bytesAvailable() const
+{
+    return replyBuffer.size() + QIODevice::bytesAvailable();
+}
+
+void SimulatedProgrammer::close()
+{
+    // Like the real thing, anything still in flight when the port is closed is lost,
+    // and the next thing the board sees will be a new command.
+    replyTimer.stop();
+    pendingReplies.clear();
+    replyBuffer.clear();
+    state = StateIdle;
+    wordBytes = 0;
+    QIODevice::close();
+}
+
+qint64 SimulatedProgrammer::readData(char *data, qint64 maxSize)
+{
+    qint64 len = qMin(maxSize, static_cast<qint64>(replyBuffer.size()));
+    memcpy(data, replyBuffer.constData(), len);
+    replyBuffer.remove(0, static_cast<int>(len));
+    return len;
+}
+
+qint64 SimulatedProgrammer::writeData(const char *data, qint64 len)
+{
+    // Whatever we were sent can't be acted on until it has all arrived
+    incomingDoneUs = qMax(incomingDoneUs, nowUs()) + transferUs(len);
+
+    for (qint64 x = 0; x < len; x++)
+    {
+        handleByte(static_cast<uint8_t>(data[x]));
+    }
+
+    return len;
+}
+
+void SimulatedProgrammer::handleByte(uint8_t c)
+{
+    switch (state)
+    {
+    case StateIdle:
+        handleCommand(c);
+        break;
+
+    case StateSectorLayoutCount:
+        if (collectWord(c))
+        {
+            if (wordValue == 0)
+            {
+                // End of the list
+                reply(sectorLayoutValid ? CommandReplyOK : CommandReplyError);
+                state = StateIdle;
+            }
+            else
+            {
+                pendingCount = wordValue;
+                state = StateSectorLayoutSize;
+            }
+        }
+        break;
+
+    case StateSectorLayoutSize:
+        if (collectWord(c))
+        {
+            // Keep accepting the rest of the list even if this group is bad; the
+            // computer sends the whole thing before it waits for a reply.
+            if (wordValue == 0)
+            {
+                sectorLayoutValid = false;
+            }
+            sectorLayout.append(qMakePair(pendingCount, wordValue));
+            state = StateSectorLayoutCount;
+        }
+        break;
+
+    case StateChipMaskValue:
+        chipMask = c & 0x0F;
+        reply(CommandReplyOK);
+        state = StateIdle;
+        break;
+
+    case StateErasePortionOffset:
+        if (collectWord(c))
+        {
+            pendingOffset = wordValue;
+            state = StateErasePortionLength;
+        }
+        break;
+
+    case StateErasePortionLength:
+        if (collectWord(c))
+        {
+            uint32_t length = wordValue;
+            state = StateIdle;
+            if ((pendingOffset % BLOCK_ERASE_SIZE) || (length % BLOCK_ERASE_SIZE) || (length == 0) ||
+                (static_cast<qint64>(pendingOffset) + length > simm.size()))
+            {
+                reply(ProgrammerErasePortionError);
+                break;
+            }
+
+            reply(ProgrammerErasePortionOK);
+            if (_faults.eraseFails)
+            {
+                reply(ProgrammerErasePortionError, _timing.blockEraseMs * 1000LL);
+                break;
+            }
+            eraseRange(pendingOffset, length);
+            reply(ProgrammerErasePortionFinished, (length / BLOCK_ERASE_SIZE) * _timing.blockEraseMs * 1000LL);
+        }
+        break;
+
+    case StateWriteAtOffset:
+        if (collectWord(c))
+        {
+            writeAddress = wordValue;
+            chunksWritten = 0;
+            if (writeAddress < static_cast<uint32_t>(simm.size()))
+            {
+                reply(CommandReplyOK);
+                state = StateWriteWaitingCommand;
+            }
+            else
+            {
+                reply(CommandReplyError);
+                state = StateIdle;
+            }
+        }
+        break;
+
+    case StateWriteWaitingCommand:
+        switch (c)
+        {
+        case ComputerWriteMore:
+            if (static_cast<qint64>(writeAddress) + WRITE_CHUNK_SIZE > simm.size())
+            {
+                reply(ProgrammerWriteError);
+                state = StateIdle;
+            }
+            else
+            {
+                reply(ProgrammerWriteOK);
+                chunk.clear();
+                state = StateWriteReceivingData;
+            }
+            break;
+        case ComputerWriteFinish:
+            reply(ProgrammerWriteOK);
+            state = StateIdle;
+            break;
+        case ComputerWriteCancel:
+            reply(ProgrammerWriteConfirmCancel);
+            state = StateIdle;
+            break;
+        default:
+            reply(ProgrammerWriteError);
+            state = StateIdle;
+            break;
+        }
+        break;
+
+    case StateWriteReceivingData:
+        chunk.append(static_cast<char>(c));
+        if (chunk.size() >= WRITE_CHUNK_SIZE)
+        {
+            programChunk();
+        }
+        break;
+
+    case StateReadOffset:
+        if (collectWord(c))
+        {
+            readAddress = wordValue;
+            state = StateReadLength;
+        }
+        break;
+
+    case StateReadLength:
+        if (collectWord(c))
+        {
+            readRemaining = wordValue;
+            if (_faults.readFails || readRemaining == 0 || (readRemaining % READ_CHUNK_SIZE) ||
+                (static_cast<qint64>(readAddress) + readRemaining > simm.size()))
+            {
+                reply(ProgrammerReadError);
+                state = StateIdle;
+            }
+            else
+            {
+                reply(ProgrammerReadOK);
+                sendReadChunk();
+                state = StateReadWaitingAck;
+            }
+        }
+        break;
+
+    case StateReadWaitingAck:
+        if (c == ComputerReadOK)
+        {
+            if (readRemaining > 0)
+            {
+                reply(ProgrammerReadMoreData);
+                sendReadChunk();
+            }
+            else
+            {
+                reply(ProgrammerReadFinished);
+                state = StateIdle;
+            }
+        }
+        else
+        {
+            reply(ProgrammerReadConfirmCancel);
+            state = StateIdle;
+        }
+        break;
+
+    case StateBootloaderWaitingCommand:
+        switch (c)
+        {
+        case ComputerBootloaderWriteMore:
+            reply(BootloaderWriteOK);
+            chunk.clear();
+            state = StateBootloaderReceivingData;
+            break;
+        case ComputerBootloaderFinish:
+            reply(BootloaderWriteOK);
+            state = StateIdle;
+            break;
+        case ComputerBootloaderCancel:
+            reply(BootloaderWriteConfirmCancel);
+            state = StateIdle;
+            break;
+        default:
+            reply(BootloaderWriteError);
+            state = StateIdle;
+            break;
+        }
+        break;
+
+    case StateBootloaderReceivingData:
+        chunk.append(static_cast<char>(c));
+        if (chunk.size() >= FIRMWARE_CHUNK_SIZE)
+        {
+            // We don't keep the firmware, but it takes time to flash it
+            reply(CommandReplyOK, static_cast<qint64>(FIRMWARE_CHUNK_SIZE) * _timing.programUsPerByte);
+            state = StateBootloaderWaitingCommand;
+        }
+        break;
+    }
+}
+
+void SimulatedProgrammer::handleCommand(uint8_t c)
+{
+    // The mode switch commands and the state query work in either mode; the rest
+    // depends on whether we're pretending to be in the bootloader.
+    if (c == GetBootloaderState)
+    {
+        reply(CommandReplyOK);
+        reply(inBootloader ? BootloaderStateInBootloader : BootloaderStateInProgrammer);
+        return;
+    }
+    else if (c == EnterBootloader || c == EnterProgrammer)
+    {
+        // No reply; the board drops off the bus and comes back in the other mode
+        inBootloader = (c == EnterBootloader);
+        QTimer::singleShot(_timing.replugMs, this, SIGNAL(replugged()));
+        return;
+    }
+
+    if (inBootloader)
+    {
+        if (c == BootloaderEraseAndWriteProgram)
+        {
+            // The bootloader erases its flash before saying it's ready
+            reply(CommandReplyOK, _timing.blockEraseMs * 1000LL);
+            state = StateBootloaderWaitingCommand;
+        }
+        else
+        {
+            reply(CommandReplyInvalid);
+        }
+        return;
+    }
+
+    switch (c)
+    {
+    case EnterWaitingMode:
+        reply(CommandReplyOK);
+        break;
+    case DoElectricalTest:
+    {
+        reply(CommandReplyOK);
+        QByteArray results;
+        for (int i = 0; i < _faults.shortedPins.count(); i++)
+        {
+            results.append(static_cast<char>(ProgrammerElectricalTestFail));
+            results.append(static_cast<char>(_faults.shortedPins[i].first));
+            results.append(static_cast<char>(_faults.shortedPins[i].second));
+        }
+        results.append(static_cast<char>(ProgrammerElectricalTestDone));
+        reply(results, _timing.electricalTestMs * 1000LL);
+        break;
+    }
+    case IdentifyChips:
+    {
+        reply(CommandReplyOK);
+        QByteArray ids;
+        for (int chip = 0; chip < 4; chip++)
+        {
+            ids.append(static_cast<char>(chipIDs[shiftedUnlock][chip][0]));
+            ids.append(static_cast<char>(chipIDs[shiftedUnlock][chip][1]));
+        }
+        ids.append(static_cast<char>(ProgrammerIdentifyDone));
+        reply(ids);
+        break;
+    }
+    case ReadChips:
+        reply(CommandReplyOK);
+        readAddress = 0;
+        state = StateReadLength;
+        break;
+    case ReadChipsAt:
+        reply(CommandReplyOK);
+        state = StateReadOffset;
+        break;
+    case EraseChips:
+        if (_faults.eraseFails)
+        {
+            reply(CommandReplyError, _timing.chipEraseMs * 1000LL);
+        }
+        else
+        {
+            eraseRange(0, simm.size());
+            reply(CommandReplyOK, _timing.chipEraseMs * 1000LL);
+        }
+        break;
+    case WriteChips:
+        reply(CommandReplyOK);
+        writeAddress = 0;
+        chunksWritten = 0;
+        state = StateWriteWaitingCommand;
+        break;
+    case WriteChipsAt:
+        reply(CommandReplyOK);
+        state = StateWriteAtOffset;
+        break;
+    case ErasePortion:
+        reply(CommandReplyOK);
+        state = StateErasePortionOffset;
+        break;
+    case SetSIMMLayout_AddressStraight:
+    case SetSIMMLayout_AddressShifted:
+        shiftedUnlock = (c == SetSIMMLayout_AddressShifted);
+        reply(CommandReplyOK);
+        break;
+    case SetVerifyWhileWriting:
+    case SetNoVerifyWhileWriting:
+        verifyWhileWriting = (c == SetVerifyWhileWriting);
+        reply(CommandReplyOK);
+        break;
+    case SetChipsMask:
+        reply(CommandReplyOK);
+        state = StateChipMaskValue;
+        break;
+    case SetSectorLayout:
+        reply(CommandReplyOK);
+        sectorLayout.clear();
+        sectorLayoutValid = true;
+        state = StateSectorLayoutCount;
+        break;
+    case GetFirmwareVersion:
+    {
+        reply(CommandReplyOK);
+        QByteArray version;
+        version.append(static_cast<char>((firmwareVersion >> 24) & 0xFF));
+        version.append(static_cast<char>((firmwareVersion >> 16) & 0xFF));
+        version.append(static_cast<char>((firmwareVersion >> 8) & 0xFF));
+        version.append(static_cast<char>((firmwareVersion >> 0) & 0xFF));
+        version.append(static_cast<char>(ProgrammerGetFWVersionDone));
+        reply(version);
+        break;
+    }
+    default:
+        reply(CommandReplyInvalid);
+        break;
+    }
+}
+
+// Words are sent least significant byte first. Returns true once all four bytes
+// have arrived, with the result in wordValue.
+bool SimulatedProgrammer::collectWord(uint8_t c)
+{
+    if (wordBytes == 0)
+    {
+        wordValue = 0;
+    }
+
+    wordValue |= static_cast<uint32_t>(c) << (8 * wordBytes);
+    if (++wordBytes == 4)
+    {
+        wordBytes = 0;
+        return true;
+    }
+    return false;
+}
+
+void SimulatedProgrammer::reply(uint8_t b, qint64 extraDelayUs)
+{
+    reply(QByteArray(1, static_cast<char>(b)), extraDelayUs);
+}
+
+void SimulatedProgrammer::reply(QByteArray const &data, qint64 extraDelayUs)
+{
+    // The board can't start on this until it has received the request and finished
+    // whatever it was told to do (extraDelayUs), and the reply has to wait its turn
+    // on the wire behind anything sent before it.
+    qint64 readyUs = qMax(incomingDoneUs, nowUs()) + extraDelayUs;
+    incomingDoneUs = readyUs;
+    qint64 wireStartUs = qMax(readyUs, wireFreeUs);
+    wireFreeUs = wireStartUs + transferUs(data.size());
+    qint64 dueUs = wireFreeUs + _timing.linkLatencyUs;
+
+    pendingReplies.append(qMakePair(dueUs, data));
+    if (!replyTimer.isActive())
+    {
+        replyTimer.start(static_cast<int>(qMax(static_cast<qint64>(0), (dueUs - nowUs()) / 1000)));
+    }
+}
+
+void SimulatedProgrammer::deliverReplies()
+{
+    // Anything due within the timer's resolution goes out now
+    qint64 cutoffUs = nowUs() + 500;
+    bool delivered = false;
+    while (!pendingReplies.isEmpty() && pendingReplies.first().first <= cutoffUs)
+    {
+        replyBuffer.append(pendingReplies.takeFirst().second);
+        delivered = true;
+    }
+
+    if (!pendingReplies.isEmpty())
+    {
+        replyTimer.start(static_cast<int>(qMax(static_cast<qint64>(0), (pendingReplies.first().first - nowUs()) / 1000)));
+    }
+
+    if (delivered && isOpen())
+    {
+        emit readyRead();
+    }
+}
+
+void SimulatedProgrammer::sendReadChunk()
+{
+    QByteArray data = simm.mid(readAddress, READ_CHUNK_SIZE);
+    if (_faults.readBitErrorRate > 0)
+    {
+        for (int x = 0; x < data.size(); x++)
+        {
+            if (qrand() < _faults.readBitErrorRate * RAND_MAX)
+            {
+                data[x] = data[x] ^ static_cast<char>(1 << (qrand() % 8));
+            }
+        }
+    }
+
+    readAddress += READ_CHUNK_SIZE;
+    readRemaining -= READ_CHUNK_SIZE;
+    reply(data);
+}
+
+void SimulatedProgrammer::programChunk()
+{
+    if (chunksWritten == _faults.writeErrorAtChunk)
+    {
+        reply(ProgrammerWriteError);
+        state = StateIdle;
+        return;
+    }
+
+    // Flash can only clear bits, so programming is an AND with what's there.
+    // Each byte lane of the 32-bit bus is a separate chip (bit n of the mask is lane n).
+    char *dest = simm.data() + writeAddress;
+    uint8_t badChips = 0;
+    for (int x = 0; x < WRITE_CHUNK_SIZE; x++)
+    {
+        const int lane = (writeAddress + x) % 4;
+        if (!(chipMask & (1 << lane)))
+        {
+            continue;
+        }
+        if (!(_faults.deadChipMask & (1 << lane)))
+        {
+            dest[x] &= chunk[x];
+        }
+        if (verifyWhileWriting && dest[x] != chunk[x])
+        {
+            // Reported the same way the computer numbers the chips: IC4 is lane 0
+            badChips |= 1 << (3 - lane);
+        }
+    }
+
+    writeAddress += WRITE_CHUNK_SIZE;
+    chunksWritten++;
+
+    // All four chips program their share of the chunk at the same time
+    qint64 programUs = static_cast<qint64>(WRITE_CHUNK_SIZE / 4) * _timing.programUsPerByte;
+    if (badChips)
+    {
+        reply(ProgrammerWriteVerificationError | badChips, programUs);
+        state = StateIdle;
+    }
+    else
+    {
+        reply(CommandReplyOK, programUs);
+        state = StateWriteWaitingCommand;
+    }
+}
+
+void SimulatedProgrammer::eraseRange(uint32_t offset, uint32_t length)
+{
+    char *p = simm.data() + offset;
+    for (uint32_t x = 0; x < length; x++)
+    {
+        if (chipMask & (1 << ((offset + x) % 4)))
+        {
+            p[x] = static_cast<char>(0xFF);
+        }
+    }
+}
+
+qint64 SimulatedProgrammer::nowUs() const
+{
+    return clock.nsecsElapsed() / 1000;
+}
+
+qint64 SimulatedProgrammer::transferUs(qint64 len) const
+{
+    if (_timing.linkBytesPerSecond <= 0)
+    {
+        return 0;
+    }
+    return len * 1000000 / _timing.linkBytesPerSecond;
+}
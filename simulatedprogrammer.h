@@ -0,0 +1,138 @@
+#ifndef SIMULATEDPROGRAMMER_H
+#define SIMULATEDPROGRAMMER_H
+
+#include <QIODevice>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QList>
+#include <QPair>
+#include <stdint.h>
+
+// A pretend programmer board that lives entirely inside the app. It plugs in where
+// the serial port normally goes (see Programmer::setTransport()) and speaks the same
+// protocol as the real firmware, backed by an in-memory SIMM. It's meant for trying
+// things out and for benchmarking the host side without any hardware, so the link
+// speed and chip timings are adjustable, and it can be told to misbehave in various
+// ways to exercise error handling.
+class SimulatedProgrammer : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    struct Timing
+    {
+        Timing();
+
+        int linkLatencyUs;          // delay before each reply starts arriving
+        int linkBytesPerSecond;     // in each direction; 0 means unlimited
+        int chipEraseMs;            // full chip erase
+        int blockEraseMs;           // erase of each BLOCK_ERASE_SIZE chunk of the SIMM
+        int programUsPerByte;       // per byte per chip; the chips program in parallel
+        int electricalTestMs;
+        int replugMs;               // switching between bootloader and programmer
+    };
+
+    struct Faults
+    {
+        Faults();
+
+        bool eraseFails;
+        bool readFails;
+        int writeErrorAtChunk;      // -1 for never
+        uint8_t deadChipMask;       // chips (same bits as the write chip mask) that don't program
+        double readBitErrorRate;    // chance of each byte being corrupted on the way back
+        QList<QPair<uint8_t, uint8_t> > shortedPins;
+    };
+
+    explicit SimulatedProgrammer(uint32_t capacity = 8*1024*1024, QObject *parent = NULL);
+
+    Timing &timing() { return _timing; }
+    Faults &faults() { return _faults; }
+    void setChipIdentity(bool shiftedUnlock, int chipIndex, uint8_t manufacturer, uint8_t device);
+    void setFirmwareVersion(uint32_t version) { firmwareVersion = version; }
+    void setInBootloader(bool inBootloader) { this->inBootloader = inBootloader; }
+
+    QByteArray const &contents() const { return simm; }
+    uint32_t capacity() const { return simm.size(); }
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+    void close();
+
+signals:
+    // Emitted when the simulated board comes back after switching between
+    // bootloader and programmer mode, like a real one re-enumerating on USB
+    void replugged();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 len);
+
+private slots:
+    void deliverReplies();
+
+private:
+    enum State
+    {
+        StateIdle,
+        StateSectorLayoutCount,
+        StateSectorLayoutSize,
+        StateChipMaskValue,
+        StateErasePortionOffset,
+        StateErasePortionLength,
+        StateWriteAtOffset,
+        StateWriteWaitingCommand,
+        StateWriteReceivingData,
+        StateReadOffset,
+        StateReadLength,
+        StateReadWaitingAck,
+        StateBootloaderWaitingCommand,
+        StateBootloaderReceivingData
+    };
+
+    void handleByte(uint8_t c);
+    void handleCommand(uint8_t c);
+    bool collectWord(uint8_t c);
+    void reply(uint8_t b, qint64 extraDelayUs = 0);
+    void reply(QByteArray const &data, qint64 extraDelayUs = 0);
+    void sendReadChunk();
+    void programChunk();
+    void eraseRange(uint32_t offset, uint32_t length);
+    qint64 nowUs() const;
+    qint64 transferUs(qint64 len) const;
+
+    Timing _timing;
+    Faults _faults;
+
+    QByteArray simm;
+    uint8_t chipIDs[2][4][2];
+    uint32_t firmwareVersion;
+    bool inBootloader;
+
+    State state;
+    bool shiftedUnlock;
+    bool verifyWhileWriting;
+    uint8_t chipMask;
+    QList<QPair<uint32_t, uint32_t> > sectorLayout;
+    bool sectorLayoutValid;
+    uint32_t wordValue;
+    int wordBytes;
+    uint32_t pendingCount;
+    uint32_t pendingOffset;
+
+    QByteArray chunk;
+    uint32_t writeAddress;
+    int chunksWritten;
+    uint32_t readAddress;
+    uint32_t readRemaining;
+
+    // Replies are held back until the time they would have arrived over a real link
+    QElapsedTimer clock;
+    qint64 incomingDoneUs;
+    qint64 wireFreeUs;
+    QList<QPair<qint64, QByteArray> > pendingReplies;
+    QByteArray replyBuffer;
+    QTimer replyTimer;
+};
+
+#endif // SIMULATEDPROGRAMMER_H
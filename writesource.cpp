@@ -0,0 +1,221 @@
+#include "writesource.h"
+#include "combinedromdevice.h"
+#include <QtConcurrent/QtConcurrentRun>
+#include <string.h>
+
+// How much is read at a time when the device can't be mapped. It's a multiple of
+// the programmer's write chunk size, so chunks never straddle two pieces.
+#define READ_AHEAD_SIZE     (256 * 1024)
+
+WriteSource::WriteSource(QObject *parent) :
+    QObject(parent),
+    device(NULL),
+    mappedFile(NULL),
+    mapped(NULL),
+    mappedStart(0),
+    mappedPos(0),
+    remaining(0),
+    currentPos(0),
+    nextLength(0),
+    endReached(true)
+{
+    // Reading may mean waiting on compression, and that shouldn't tie up a thread
+    // the compression could be using
+    readAheadPool.setMaxThreadCount(1);
+    connect(&nextWatcher, SIGNAL(finished()), SIGNAL(pieceReady()));
+}
+
+WriteSource::~WriteSource()
+{
+    stop();
+}
+
+void WriteSource::start(QIODevice *device, qint64 length)
+{
+    stop();
+    this->device = device;
+    error.clear();
+    remaining = qBound(Q_INT64_C(0), length, device->size() - device->pos());
+
+    // Files are the easy case. Only the part being written gets mapped, so a big
+    // image doesn't need a big mapping.
+    QFile *file = qobject_cast<QFile *>(device);
+    if (file && remaining > 0)
+    {
+        mapped = file->map(file->pos(), remaining);
+        if (mapped)
+        {
+            mappedFile = file;
+            mappedStart = device->pos();
+            mappedPos = 0;
+            endReached = true;
+            return;
+        }
+    }
+
+    endReached = false;
+    readAhead();
+}
+
+void WriteSource::stop()
+{
+    // A piece that's still being read is probably waiting on compression that
+    // won't be needed now, so call that off instead of waiting for all of it
+    if (!next.isFinished())
+    {
+        CombinedROMDevice *combined = qobject_cast<CombinedROMDevice *>(device);
+        if (combined)
+        {
+            combined->cancelPendingReads();
+        }
+    }
+    next.waitForFinished();
+    next = QFuture<Piece>();
+    if (mappedFile)
+    {
+        // Leave it where it would be if it had been read normally
+        mappedFile->unmap(const_cast<uchar *>(mapped));
+        device->seek(mappedStart + mappedPos);
+    }
+    mappedFile = NULL;
+    mapped = NULL;
+    device = NULL;
+    current.clear();
+    currentPos = 0;
+    nextLength = 0;
+    remaining = 0;
+    endReached = true;
+}
+
+WriteSource::Piece WriteSource::readPiece(QIODevice *device, qint64 length)
+{
+    Piece piece;
+    piece.data.resize(length);
+    qint64 done = 0;
+    while (done < length)
+    {
+        const qint64 n = device->read(piece.data.data() + done, length - done);
+        if (n < 0)
+        {
+            piece.failed = true;
+            piece.error = device->errorString();
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += n;
+    }
+    piece.data.truncate(done);
+    return piece;
+}
+
+void WriteSource::readAhead()
+{
+    // What's being handed out plus what's in flight can't be more than what's left
+    const qint64 requested = remaining - (current.length() - currentPos);
+    nextLength = qMin(static_cast<qint64>(READ_AHEAD_SIZE), requested);
+    if (nextLength > 0)
+    {
+        next = QtConcurrent::run(&readAheadPool, &WriteSource::readPiece, device, nextLength);
+        nextWatcher.setFuture(next);
+    }
+    else
+    {
+        next = QFuture<Piece>();
+    }
+}
+
+bool WriteSource::nextPiece()
+{
+    if (nextLength <= 0)
+    {
+        endReached = true;
+        current.clear();
+        currentPos = 0;
+        return true;
+    }
+
+    const Piece piece = next.result();
+    current = piece.data;
+    currentPos = 0;
+    if (piece.failed)
+    {
+        error = piece.error;
+        return false;
+    }
+
+    // A short piece means the device turned out to be smaller than it said
+    if (current.length() < nextLength)
+    {
+        endReached = true;
+        remaining = current.length();
+        nextLength = 0;
+        next = QFuture<Piece>();
+    }
+    else
+    {
+        readAhead();
+    }
+    return true;
+}
+
+bool WriteSource::isReady() const
+{
+    return mapped || endReached || !error.isEmpty() || currentPos < current.length() ||
+            remaining <= 0 || nextLength <= 0 || next.isFinished();
+}
+
+qint64 WriteSource::available()
+{
+    if (!error.isEmpty())
+    {
+        return -1;
+    }
+    if (!mapped && !endReached && currentPos >= current.length() && remaining > 0 && isReady())
+    {
+        if (!nextPiece())
+        {
+            return -1;
+        }
+    }
+    return remaining;
+}
+
+QByteArray WriteSource::take(int len, int padTo, char fill)
+{
+    if (len > available() || len < 0)
+    {
+        return QByteArray();
+    }
+
+    const char *data;
+    if (mapped)
+    {
+        data = reinterpret_cast<const char *>(mapped) + mappedPos;
+        mappedPos += len;
+    }
+    else
+    {
+        // available() made sure there's something here, and since pieces are a
+        // multiple of the chunk size, the whole chunk is
+        if (currentPos + len > current.length())
+        {
+            return QByteArray();
+        }
+        data = current.constData() + currentPos;
+        currentPos += len;
+    }
+    remaining -= len;
+
+    if (len >= padTo)
+    {
+        return QByteArray::fromRawData(data, len);
+    }
+
+    // Only the last chunk ever needs padding, so this doesn't happen often
+    padded.fill(fill, padTo);
+    memcpy(padded.data(), data, len);
+    return padded;
+}
@@ -0,0 +1,86 @@
+#ifndef WRITESOURCE_H
+#define WRITESOURCE_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QFile>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QThreadPool>
+
+// Hands out the data being written to a SIMM a chunk at a time without the serial
+// link ever having to wait for the disk. Files are mapped, so a chunk is just a
+// view into the mapping. Anything else (a combined ROM that's still being
+// compressed, say) is read on a thread of its own, a big piece at a time, with the
+// next piece already on its way while the current one is being sent.
+//
+// Nothing here ever waits for the read-ahead. When the next piece isn't in yet,
+// isReady() says so, and pieceReady() is emitted once it is.
+//
+// Once it's started, the device belongs to this until stop(); nothing else should
+// touch it in between.
+class WriteSource : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WriteSource(QObject *parent = NULL);
+    ~WriteSource();
+
+    // Starts at wherever the device is now, and goes no further than length bytes
+    void start(QIODevice *device, qint64 length);
+    void stop();
+
+    // Whether there's something to hand out right now (or it's known there isn't
+    // anything more, or that something went wrong)
+    bool isReady() const;
+
+    // How many bytes are left. Until the end of a device that isn't mapped has been
+    // read, it's only as good as the device's size() was. Returns -1 if the device
+    // couldn't be read. Don't count on it (or take()) until isReady().
+    qint64 available();
+
+    // The next len bytes (no more than available()) padded out to padTo with fill.
+    // It's only good until the next call.
+    QByteArray take(int len, int padTo, char fill);
+
+    QString errorString() const { return error; }
+
+signals:
+    // The piece that was being read is in, so isReady() is true now
+    void pieceReady();
+
+private:
+    struct Piece
+    {
+        Piece() : failed(false) {}
+
+        QByteArray data;
+        bool failed;
+        QString error;
+    };
+
+    static Piece readPiece(QIODevice *device, qint64 length);
+    void readAhead();
+    bool nextPiece();
+
+    QIODevice *device;
+    QFile *mappedFile;
+    const uchar *mapped;
+    // Where the device was when the mapping was made, and how far into it we are
+    qint64 mappedStart;
+    qint64 mappedPos;
+    qint64 remaining;
+    // Read-ahead: the piece being handed out, and the one being read
+    QByteArray current;
+    int currentPos;
+    QFuture<Piece> next;
+    QFutureWatcher<Piece> nextWatcher;
+    qint64 nextLength;
+    bool endReached;
+    QThreadPool readAheadPool;
+    QByteArray padded;
+    QString error;
+};
+
+#endif // WRITESOURCE_H